@@ -1,8 +1,9 @@
 #include "alignments.hpp"
+#include "tokenize.hpp"
+#include "paryfor.hpp"
 
 namespace seqwish {
 
-
 uint64_t match_hash(const pos_t& q, const pos_t& t, const uint64_t& l) {
     uint64_t seed = q | t | l;
     seed ^= q + 0x9e3779b97f4a7c15 + (seed << 17) + (seed >> 9);
@@ -16,127 +17,472 @@ bool keep_sparse(const pos_t& q, const pos_t& t, const uint64_t& l, const float
     return match_hash(q, t, l) < std::numeric_limits<uint64_t>::max() * f;
 }
 
-void paf_worker(
-    igzstream& paf_in,
-    std::atomic<bool>& paf_more,
-    std::mutex& paf_in_mutex,
-    mmmulti::iitree<uint64_t, pos_t>& aln_iitree,
+bool keep_sampled(const uint64_t& a, const uint64_t& b, const uint64_t& c, const float f) {
+    // the bits of the keys are spread over the whole hash, so that its fraction below the cutoff is f
+    uint64_t h = wang_hash_64(wang_hash_64(wang_hash_64(a) ^ b) ^ c);
+    return (double)h < (double)std::numeric_limits<uint64_t>::max() * f;
+}
+
+sparse_mode_t parse_sparse_mode(const std::string& mode) {
+    if (mode == "match") {
+        return sparse_mode_t::match;
+    } else if (mode == "window") {
+        return sparse_mode_t::window;
+    } else if (mode == "alignment") {
+        return sparse_mode_t::alignment;
+    }
+    std::cerr << "[seqwish::alignments] error: unknown sparsification mode " << mode << ", expected match, window or alignment" << std::endl;
+    exit(1);
+}
+
+// how many steps we can take through a match run before the query and target land on the same base
+// such self mappings are never recorded as matches
+size_t self_mapping_distance(const pos_t& q, const pos_t& t, const size_t& len) {
+    if (offset(q) == offset(t)) {
+        return 0;
+    } else if (is_rev(q) && offset(q) > offset(t) && (offset(q) - offset(t)) % 2 == 0) {
+        // the query walks backward and the target forward, so they can cross once
+        return std::min(len, (size_t)(offset(q) - offset(t)) / 2);
+    } else {
+        return len;
+    }
+}
+
+aln_buffer_t::aln_buffer_t(mmmulti::iitree<uint64_t, pos_t>* tree,
+                           std::mutex& tree_mutex,
+                           std::atomic<uint64_t>& flushes,
+                           const uint64_t& size)
+    : aln_iitree(tree), aln_iitree_mutex(tree_mutex), flush_count(flushes), max_size(std::max((uint64_t)1, size)) {
+    if (aln_iitree) intervals.reserve(max_size);
+}
+
+aln_buffer_t::~aln_buffer_t(void) {
+    flush();
+}
+
+void aln_buffer_t::flush(void) {
+    if (intervals.empty()) return;
+    {
+        std::lock_guard<std::mutex> guard(aln_iitree_mutex);
+        for (auto& i : intervals) {
+            aln_iitree->add(i.start, i.end, i.pos);
+        }
+    }
+    intervals.clear();
+    ++flush_count;
+}
+
+void match_list_t::load(const std::string& filename, const seqindex_t& seqidx) {
+    std::ifstream in(filename.c_str());
+    if (!in.good()) {
+        std::cerr << "[seqwish::alignments] error: match list " << filename << " is not good!" << std::endl;
+        exit(1);
+    }
+    std::string line;
+    std::vector<std::string> fields;
+    while (std::getline(in, line)) {
+        fields.clear();
+        tokenize(line, fields, " \t", true);
+        if (fields.empty()) continue;
+        if (fields.size() < 2) {
+            std::cerr << "[seqwish::alignments] error: the line \"" << line << "\" of match list " << filename << " is not a pair of sequence names" << std::endl;
+            exit(1);
+        }
+        uint64_t a = seqidx.rank_of_seq_named(fields[0]);
+        uint64_t b = seqidx.rank_of_seq_named(fields[1]);
+        pairs.insert(a < b ? std::make_pair(a, b) : std::make_pair(b, a));
+    }
+}
+
+pair_mapping_key_t::pair_mapping_key_t(const paf_row_t& paf, const uint64_t& file, const uint64_t& offset)
+    : block_length(paf.alignment_block_length), num_matches(paf.num_matches),
+      query_start(paf.query_start), query_end(paf.query_end),
+      target_start(paf.target_start), target_end(paf.target_end),
+      same_strand(paf.query_target_same_strand), file(file), offset(offset) { }
+
+bool pair_mapping_key_t::operator<(const pair_mapping_key_t& o) const {
+    // the columns after the length break ties, so the order doesn't depend on where the rows are in the PAF
+    // unless they are equal in all of them, when the earlier row ranks higher, so that no two rows tie
+    return std::tie(block_length, num_matches, query_start, query_end, target_start, target_end, same_strand, o.file, o.offset)
+        < std::tie(o.block_length, o.num_matches, o.query_start, o.query_end, o.target_start, o.target_end, o.same_strand, file, offset);
+}
+
+static std::pair<uint64_t, uint64_t> seq_pair_of(const paf_row_t& paf, const seqindex_t& seqidx) {
+    uint64_t a = seqidx.rank_of_seq_named(paf.query_sequence_name);
+    uint64_t b = seqidx.rank_of_seq_named(paf.target_sequence_name);
+    return a < b ? std::make_pair(a, b) : std::make_pair(b, a);
+}
+
+bool paf_filter_t::keep_columns(const paf_row_t& paf) const {
+    return paf.alignment_block_length >= min_block_length
+        && (min_identity <= 0 || (paf.alignment_block_length && (float)paf.num_matches / paf.alignment_block_length >= min_identity));
+}
+
+bool paf_filter_t::keep(const paf_row_t& paf, const seqindex_t& seqidx, const uint64_t& file, const uint64_t& offset) const {
+    if (!keep_columns(paf)) return false;
+    if (!pair_mapping_floor.empty()) {
+        auto f = pair_mapping_floor.find(seq_pair_of(paf, seqidx));
+        if (f != pair_mapping_floor.end() && pair_mapping_key_t(paf, file, offset) < f->second) return false;
+    }
+    return true;
+}
+
+void paf_filter_t::rank_pair_mappings(const std::vector<std::string>& paf_files, const seqindex_t& seqidx, const uint64_t& num_threads) {
+    typedef ska::flat_hash_map<std::pair<uint64_t, uint64_t>, std::vector<pair_mapping_key_t>, wang_hash<std::pair<uint64_t, uint64_t>>> pair_mappings_t;
+    std::vector<pair_mappings_t> thread_mappings(num_threads);
+    // each thread keeps the longest mappings it has seen of each pair, trimming them back to max_pair_mappings as they grow
+    auto trim = [&](std::vector<pair_mapping_key_t>& keys) {
+        std::sort(keys.begin(), keys.end(), [](const pair_mapping_key_t& a, const pair_mapping_key_t& b) { return b < a; });
+        keys.resize(std::min(keys.size(), (size_t)max_pair_mappings));
+    };
+    for (uint64_t file = 0; file < paf_files.size(); ++file) {
+        auto& paf_file = paf_files[file];
+        block_reader_t paf_in(paf_file, num_threads);
+        if (!paf_in.good()) {
+            std::cerr << "[seqwish::alignments] error: PAF file " << paf_file << " is not good!" << std::endl;
+            exit(1);
+        }
+        std::vector<paf_block_t> blocks(num_threads);
+        uint64_t offset = 0;
+        bool more = true;
+        while (more) {
+            uint64_t n_blocks = 0;
+            while (n_blocks < blocks.size() && (more = paf_in.next(blocks[n_blocks].text))) {
+                blocks[n_blocks].offset = offset;
+                offset += blocks[n_blocks].text.size();
+                ++n_blocks;
+            }
+            paryfor::parallel_for<uint64_t>(
+                0, n_blocks, num_threads, 1,
+                [&](uint64_t i, int tid) {
+                    auto& mappings = thread_mappings[tid];
+                    paf_row_t paf;
+                    const char* line_begin = blocks[i].text.data();
+                    const char* block_end = line_begin + blocks[i].text.size();
+                    while (line_begin < block_end) {
+                        const char* line_end = (const char*)memchr(line_begin, '\n', block_end - line_begin);
+                        if (line_end == nullptr) line_end = block_end;
+                        const char* line_start = line_begin;
+                        line_begin = line_end + 1;
+                        if (line_start == line_end) continue;
+                        paf.parse(line_start, line_end);
+                        if (!keep_columns(paf)) continue;
+                        if (match_list && !match_list->keep(seqidx.rank_of_seq_named(paf.query_sequence_name),
+                                                            seqidx.rank_of_seq_named(paf.target_sequence_name))) {
+                            continue;
+                        }
+                        auto& keys = mappings[seq_pair_of(paf, seqidx)];
+                        keys.push_back(pair_mapping_key_t(paf, file, blocks[i].offset + (line_start - blocks[i].text.data())));
+                        if (keys.size() >= 2 * max_pair_mappings) trim(keys);
+                    }
+                });
+        }
+    }
+    // merge what the threads found, noting the shortest mapping we keep of the pairs that have too many
+    pair_mappings_t& mappings = thread_mappings[0];
+    for (uint64_t t = 1; t < num_threads; ++t) {
+        for (auto& m : thread_mappings[t]) {
+            auto& keys = mappings[m.first];
+            keys.insert(keys.end(), m.second.begin(), m.second.end());
+        }
+        thread_mappings[t].clear();
+    }
+    for (auto& m : mappings) {
+        if (m.second.size() >= max_pair_mappings) {
+            trim(m.second);
+            pair_mapping_floor[m.first] = m.second.back();
+        }
+    }
+}
+
+void unpack_paf_row(
+    const paf_row_t& paf,
+    aln_buffer_t& aln_buffer,
     const seqindex_t& seqidx,
     const uint64_t& min_match_len,
-    const float& sparsification_factor) {
-    while (paf_more.load()) {
-        paf_in_mutex.lock();
-        std::string line;
-        std::getline(paf_in, line);
-        paf_more.store(paf_in.good());
-        paf_in_mutex.unlock();
-        // Check if there is something to parse
-        if (line.empty()) break;
-        paf_row_t paf(line);
-        // Check if the coordinates are reasonable
-        if (paf.query_sequence_length == 0 || paf.target_sequence_length == 0 ||
-            // Query/Target start (0-based; BED-like; closed)
-            paf.query_start >= paf.query_sequence_length || paf.query_end > paf.query_sequence_length || paf.query_start >= paf.query_end ||
-            // Query/Target end (0-based; BED-like; open)
-            paf.target_start >= paf.target_sequence_length || paf.target_end > paf.target_sequence_length || paf.target_start >= paf.target_end) break;
-        size_t query_idx = seqidx.rank_of_seq_named(paf.query_sequence_name);
-        //size_t query_len = seqidx.nth_seq_length(query_idx);
-        size_t target_idx = seqidx.rank_of_seq_named(paf.target_sequence_name);
-        //size_t target_len = seqidx.nth_seq_length(target_idx);
-        bool q_rev = !paf.query_target_same_strand;
-        size_t q_all_pos = (q_rev ? seqidx.pos_in_all_seqs(query_idx, paf.query_end, false) - 1
-                            : seqidx.pos_in_all_seqs(query_idx, paf.query_start, false));
-        size_t t_all_pos = seqidx.pos_in_all_seqs(target_idx, paf.target_start, false);
-        pos_t q_pos = make_pos_t(q_all_pos, q_rev);
-        pos_t t_pos = make_pos_t(t_all_pos, false);
-        for (auto& c : paf.cigar) {
-            switch (c.op) {
-            case 'M':
-            case '=':
-            case 'X':
+    const float& sparsification_factor,
+    const sparse_mode_t& sparse_mode,
+    const uint64_t& sparse_window,
+    const bool& trust_cigar) {
+    // Check if the coordinates are reasonable
+    if (paf.query_sequence_length == 0 || paf.target_sequence_length == 0 ||
+        // Query/Target start (0-based; BED-like; closed)
+        paf.query_start >= paf.query_sequence_length || paf.query_end > paf.query_sequence_length || paf.query_start >= paf.query_end ||
+        // Query/Target end (0-based; BED-like; open)
+        paf.target_start >= paf.target_sequence_length || paf.target_end > paf.target_sequence_length || paf.target_start >= paf.target_end) return;
+    size_t query_idx = seqidx.rank_of_seq_named(paf.query_sequence_name);
+    //size_t query_len = seqidx.nth_seq_length(query_idx);
+    size_t target_idx = seqidx.rank_of_seq_named(paf.target_sequence_name);
+    //size_t target_len = seqidx.nth_seq_length(target_idx);
+    bool q_rev = !paf.query_target_same_strand;
+    size_t q_all_pos = (q_rev ? seqidx.pos_in_all_seqs(query_idx, paf.query_end, false) - 1
+                        : seqidx.pos_in_all_seqs(query_idx, paf.query_start, false));
+    size_t t_all_pos = seqidx.pos_in_all_seqs(target_idx, paf.target_start, false);
+    if (sparsification_factor != 0 && sparse_mode == sparse_mode_t::alignment) {
+        // the row is kept or dropped whole, and the same for the row that aligns it the other way around
+        size_t a = seqidx.pos_in_all_seqs(query_idx, paf.query_start, false);
+        if (!keep_sampled(std::min(a, t_all_pos), std::max(a, t_all_pos), paf.alignment_block_length, sparsification_factor)) {
+            return;
+        }
+    }
+    pos_t q_pos = make_pos_t(q_all_pos, q_rev);
+    pos_t t_pos = make_pos_t(t_all_pos, false);
+    auto keep_match =
+        [&](const pos_t& q, const pos_t& t, const uint64_t& len) {
+            switch (sparse_mode) {
+            case sparse_mode_t::match:
+                return sparsification_factor == 0 || keep_sparse(q, t, len, sparsification_factor);
+            case sparse_mode_t::window:
             {
-                pos_t q_pos_match_start = q_pos;
-                pos_t t_pos_match_start = t_pos;
-                uint64_t match_len = 0;
-                auto add_match =
-                    [&](void) {
-                        if (match_len
-                            && match_len >= min_match_len
-                            && (sparsification_factor == 0 ||
-                                keep_sparse(q_pos_match_start, t_pos_match_start, match_len,
-                                            sparsification_factor))) {
-                            if (is_rev(q_pos)) {
-                                pos_t x_pos = q_pos;
-                                decr_pos(x_pos); // to guard against underflow when our start is 0-, we need to decr in pos_t space
-                                aln_iitree.add(offset(x_pos), offset(q_pos_match_start)+1, make_pos_t(offset(t_pos)-1, true));
-                                aln_iitree.add(offset(t_pos_match_start), offset(t_pos), make_pos_t(offset(q_pos_match_start), true));
-                            } else {
-                                aln_iitree.add(offset(q_pos_match_start), offset(q_pos), t_pos_match_start);
-                                aln_iitree.add(offset(t_pos_match_start), offset(t_pos), q_pos_match_start);
-                            }
-                        }
-                    };
-                for (size_t i = 0; i < c.len; ++i) {
-                    char query_base = seqidx.at_pos(q_pos);
-                    char target_base = seqidx.at_pos(t_pos);
-                    if (query_base == target_base
-                        && query_base != 'N'
-                        && offset(q_pos) != offset(t_pos)) { // guard against self mappings
-                        if (match_len == 0) {
-                            q_pos_match_start = q_pos;
-                            t_pos_match_start = t_pos;
+                // the matches between the same two windows go together, whichever side is the query
+                uint64_t a = offset(q) / sparse_window;
+                uint64_t b = offset(t) / sparse_window;
+                return sparsification_factor == 0 || keep_sampled(std::min(a, b), std::max(a, b), sparse_window, sparsification_factor);
+            }
+            default:
+                return true;
+            }
+        };
+    for (auto& c : paf.cigar) {
+        if (trust_cigar && c.op == 'X') {
+            // a trusted mismatch needs no checking
+            incr_pos(q_pos, c.len);
+            incr_pos(t_pos, c.len);
+            continue;
+        }
+        // a trusted match only needs to be split where the sequence is N
+        bool trusted = trust_cigar && c.op == '=';
+        switch (c.op) {
+        case 'M':
+        case '=':
+        case 'X':
+        {
+            pos_t q_pos_match_start = q_pos;
+            pos_t t_pos_match_start = t_pos;
+            uint64_t match_len = 0;
+            auto add_match =
+                [&](void) {
+                    if (match_len
+                        && match_len >= min_match_len
+                        && keep_match(q_pos_match_start, t_pos_match_start, match_len)) {
+                        if (is_rev(q_pos)) {
+                            pos_t x_pos = q_pos;
+                            decr_pos(x_pos); // to guard against underflow when our start is 0-, we need to decr in pos_t space
+                            aln_buffer.add(offset(x_pos), offset(q_pos_match_start)+1, make_pos_t(offset(t_pos)-1, true));
+                            aln_buffer.add(offset(t_pos_match_start), offset(t_pos), make_pos_t(offset(q_pos_match_start), true));
+                        } else {
+                            aln_buffer.add(offset(q_pos_match_start), offset(q_pos), t_pos_match_start);
+                            aln_buffer.add(offset(t_pos_match_start), offset(t_pos), q_pos_match_start);
                         }
-                        ++match_len;
-                        incr_pos(q_pos);
-                        incr_pos(t_pos);
-                    } else {
-                        add_match();
-                        incr_pos(q_pos);
-                        incr_pos(t_pos);
-                        match_len = 0;
-                        // break out the last match
                     }
+                };
+            for (size_t i = 0; i < c.len; ) {
+                // compare as much of the run as we can at once, up to where the query would meet itself
+                size_t d = self_mapping_distance(q_pos, t_pos, c.len - i);
+                size_t n = (trusted ? seqidx.non_n_length(offset(t_pos), d)
+                            : seqidx.match_length(q_pos, t_pos, d));
+                if (n) {
+                    if (match_len == 0) {
+                        q_pos_match_start = q_pos;
+                        t_pos_match_start = t_pos;
+                    }
+                    match_len += n;
+                    incr_pos(q_pos, n);
+                    incr_pos(t_pos, n);
+                    i += n;
+                }
+                if (i < c.len) {
+                    // break out the last match at the mismatch, stepping over any run of N at once
+                    add_match();
+                    size_t skip = (trusted ? std::max((size_t)1, seqidx.n_length(offset(t_pos), c.len - i)) : 1);
+                    incr_pos(q_pos, skip);
+                    incr_pos(t_pos, skip);
+                    match_len = 0;
+                    i += skip;
                 }
-                // handle any last match
-                add_match();
             }
+            // handle any last match
+            add_match();
+        }
+            break;
+        case 'I':
+            //std::cerr << "ins " << c.len << std::endl;
+            incr_pos(q_pos, c.len);
+            break;
+        case 'D':
+            //std::cerr << "del " << c.len << std::endl;
+            incr_pos(t_pos, c.len);
+            break;
+        default: break;
+        }
+    }
+}
+
+void paf_worker(
+    paf_block_queue_t& paf_blocks,
+    std::atomic<bool>& paf_more,
+    waiter_t& paf_waiter,
+    mmmulti::iitree<uint64_t, pos_t>* aln_iitree,
+    std::mutex& aln_iitree_mutex,
+    std::atomic<uint64_t>& flush_count,
+    const uint64_t& buffer_size,
+    const seqindex_t& seqidx,
+    const uint64_t& min_match_len,
+    const float& sparsification_factor,
+    const sparse_mode_t& sparse_mode,
+    const uint64_t& sparse_window,
+    const bool& trust_cigar,
+    const paf_filter_t* filter,
+    paf_stats_t* stats,
+    const uint64_t& paf_rank) {
+    paf_block_t* block = nullptr;
+    // reused across lines so that parsing doesn't allocate
+    paf_row_t paf;
+    aln_buffer_t aln_buffer(aln_iitree, aln_iitree_mutex, flush_count, buffer_size);
+    uint64_t rows = 0;
+    uint64_t kept_rows = 0;
+    backoff_t idle(paf_waiter);
+    while (true) {
+        if (!paf_blocks.try_pop(block)) {
+            if (paf_more.load()) {
+                idle.wait();
+                continue;
+            } else if (!paf_blocks.try_pop(block)) {
+                // the reader is done and the queue is drained
                 break;
-            case 'I':
-                //std::cerr << "ins " << c.len << std::endl;
-                incr_pos(q_pos, c.len);
-                break;
-            case 'D':
-                //std::cerr << "del " << c.len << std::endl;
-                incr_pos(t_pos, c.len);
-                break;
-            default: break;
             }
         }
+        idle.reset();
+        // let the reader know there's room in the queue
+        paf_waiter.notify();
+        // each block holds whole lines
+        const char* line_begin = block->text.data();
+        const char* block_end = line_begin + block->text.size();
+        while (line_begin < block_end) {
+            const char* line_end = (const char*)memchr(line_begin, '\n', block_end - line_begin);
+            if (line_end == nullptr) line_end = block_end;
+            const char* line_start = line_begin;
+            line_begin = line_end + 1;
+            // Check if there is something to parse
+            if (line_start == line_end) continue;
+            ++rows;
+            if (filter && filter->match_list) {
+                // rows of pairs that aren't in the list go before we read anything past their names
+                paf.parse_names(line_start, line_end);
+                if (!filter->match_list->keep(seqidx.rank_of_seq_named(paf.query_sequence_name),
+                                              seqidx.rank_of_seq_named(paf.target_sequence_name))) {
+                    continue;
+                }
+            }
+            paf.parse(line_start, line_end);
+            if (filter && !filter->keep(paf, seqidx, paf_rank, block->offset + (line_start - block->text.data()))) continue;
+            ++kept_rows;
+            unpack_paf_row(paf, aln_buffer, seqidx, min_match_len, sparsification_factor, sparse_mode, sparse_window, trust_cigar);
+        }
+        delete block;
+    }
+    if (stats) {
+        stats->rows += rows;
+        stats->kept_rows += kept_rows;
+        stats->matches += aln_buffer.n_intervals / 2;
+        stats->match_bp += aln_buffer.interval_bp / 2;
     }
 }
 
-
-void unpack_paf_alignments(const std::string& paf_file,
-                           mmmulti::iitree<uint64_t, pos_t>& aln_iitree,
-                           const seqindex_t& seqidx,
-                           const uint64_t& min_match_len,
-                           const float& sparsification_factor,
-                           const uint64_t& num_threads) {
-    // go through the PAF file
-    igzstream paf_in(paf_file.c_str());
+// without a tree, we only count what we would have written into it
+static uint64_t read_paf_alignments(const std::string& paf_file,
+                                    mmmulti::iitree<uint64_t, pos_t>* aln_iitree,
+                                    const seqindex_t& seqidx,
+                                    const uint64_t& min_match_len,
+                                    const float& sparsification_factor,
+                                    const bool& trust_cigar,
+                                    const uint64_t& buffer_size,
+                                    const uint64_t& num_threads,
+                                    const paf_filter_t* filter,
+                                    paf_stats_t* stats,
+                                    const sparse_mode_t& sparse_mode,
+                                    const uint64_t& sparse_window,
+                                    const uint64_t& paf_rank) {
+    // go through the PAF file, reading it in line-aligned blocks on this thread
+    // BGZF is inflated on threads of the reader's own while the workers parse, so they split -t between them
+    // inflating a block takes a fraction of the time that parsing its rows and CIGARs does, so the reader gets a quarter
+    uint64_t reader_threads = 1;
+    uint64_t worker_threads = num_threads;
+    if (num_threads > 1 && file_is_bgzf(paf_file)) {
+        reader_threads = std::max((uint64_t)1, num_threads / 4);
+        worker_threads = num_threads - reader_threads;
+    }
+    block_reader_t paf_in(paf_file, reader_threads);
     if (!paf_in.good()) {
         std::cerr << "[seqwish::alignments] error: PAF file " << paf_file << " is not good!" << std::endl;
         exit(1);
     }
-    std::mutex paf_in_mutex;
+    auto paf_blocks_ptr = std::make_unique<paf_block_queue_t>();
+    auto& paf_blocks = *paf_blocks_ptr;
     std::atomic<bool> paf_more; paf_more.store(true);
-    std::vector<std::thread> workers; workers.reserve(num_threads);
-    for (uint64_t t = 0; t < num_threads; ++t) {
-        workers.emplace_back(paf_worker, std::ref(paf_in), std::ref(paf_more), std::ref(paf_in_mutex), std::ref(aln_iitree), std::ref(seqidx), std::ref(min_match_len), std::ref(sparsification_factor));
+    waiter_t paf_waiter;
+    // workers buffer their matches and take turns writing them into the tree
+    std::mutex aln_iitree_mutex;
+    std::atomic<uint64_t> flush_count; flush_count.store(0);
+    std::vector<std::thread> workers; workers.reserve(worker_threads);
+    for (uint64_t t = 0; t < worker_threads; ++t) {
+        workers.emplace_back(paf_worker, std::ref(paf_blocks), std::ref(paf_more), std::ref(paf_waiter), aln_iitree, std::ref(aln_iitree_mutex), std::ref(flush_count), std::ref(buffer_size), std::ref(seqidx), std::ref(min_match_len), std::ref(sparsification_factor), std::ref(sparse_mode), std::ref(sparse_window), std::ref(trust_cigar), filter, stats, std::ref(paf_rank));
+    }
+    paf_block_t* block = new paf_block_t;
+    uint64_t offset = 0;
+    {
+        backoff_t idle(paf_waiter);
+        while (paf_in.next(block->text)) {
+            block->offset = offset;
+            offset += block->text.size();
+            while (!paf_blocks.try_push(block)) {
+                ++profile_counters().queue_full_retries;
+                idle.wait();
+            }
+            idle.reset();
+            paf_waiter.notify();
+            block = new paf_block_t;
+        }
     }
-    for (uint64_t t = 0; t < num_threads; ++t) {
+    delete block;
+    paf_more.store(false);
+    paf_waiter.notify();
+    for (uint64_t t = 0; t < worker_threads; ++t) {
         workers[t].join();
     }
+    return flush_count.load();
+}
+
+uint64_t unpack_paf_alignments(const std::string& paf_file,
+                               mmmulti::iitree<uint64_t, pos_t>& aln_iitree,
+                               const seqindex_t& seqidx,
+                               const uint64_t& min_match_len,
+                               const float& sparsification_factor,
+                               const bool& trust_cigar,
+                               const uint64_t& buffer_size,
+                               const uint64_t& num_threads,
+                               const paf_filter_t* filter,
+                               paf_stats_t* stats,
+                               const sparse_mode_t& sparse_mode,
+                               const uint64_t& sparse_window,
+                               const uint64_t& paf_rank) {
+    return read_paf_alignments(paf_file, &aln_iitree, seqidx, min_match_len, sparsification_factor, trust_cigar, buffer_size, num_threads,
+                               filter, stats, sparse_mode, sparse_window, paf_rank);
+}
+
+void count_paf_alignments(const std::string& paf_file,
+                          const seqindex_t& seqidx,
+                          const uint64_t& min_match_len,
+                          const float& sparsification_factor,
+                          const bool& trust_cigar,
+                          const uint64_t& num_threads,
+                          const paf_filter_t* filter,
+                          paf_stats_t* stats,
+                          const sparse_mode_t& sparse_mode,
+                          const uint64_t& sparse_window,
+                          const uint64_t& paf_rank) {
+    read_paf_alignments(paf_file, nullptr, seqidx, min_match_len, sparsification_factor, trust_cigar, 1, num_threads,
+                        filter, stats, sparse_mode, sparse_window, paf_rank);
 }
 
 }
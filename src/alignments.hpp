@@ -11,32 +11,187 @@
 #include "mmmultimap.hpp"
 #include "mmiitree.hpp"
 #include "seqindex.hpp"
-#include "gzstream.h"
+#include "blockreader.hpp"
+#include "backoff.hpp"
+#include "profile.hpp"
+#include "atomic_queue.h"
+#include "flat_hash_map.hpp"
+#include "wang.hpp"
 #include "pos.hpp"
 
 namespace seqwish {
 
+// line-aligned blocks of PAF text handed from the reader to the workers, with where they start in the file
+struct paf_block_t {
+    std::string text;
+    uint64_t offset = 0;
+};
+typedef atomic_queue::AtomicQueue2<paf_block_t*, 2 << 8> paf_block_queue_t;
+
+// a worker's matches, held back so that the shared interval tree writer sees them in large blocks
+// without a tree, we only count them
+class aln_buffer_t {
+public:
+    aln_buffer_t(mmmulti::iitree<uint64_t, pos_t>* aln_iitree,
+                 std::mutex& aln_iitree_mutex,
+                 std::atomic<uint64_t>& flush_count,
+                 const uint64_t& max_size);
+    ~aln_buffer_t(void);
+    void add(const uint64_t& start, const uint64_t& end, const pos_t& pos) {
+        ++n_intervals;
+        interval_bp += end - start;
+        if (aln_iitree == nullptr) return;
+        intervals.push_back({start, end, pos});
+        if (intervals.size() >= max_size) {
+            flush();
+        }
+    }
+    void flush(void);
+    // what we were given, each match being given once in each direction
+    uint64_t n_intervals = 0;
+    uint64_t interval_bp = 0;
+
+private:
+    struct interval_t { uint64_t start; uint64_t end; pos_t pos; };
+    // reused from flush to flush, so we allocate it only once
+    std::vector<interval_t> intervals;
+    mmmulti::iitree<uint64_t, pos_t>* aln_iitree;
+    std::mutex& aln_iitree_mutex;
+    std::atomic<uint64_t>& flush_count;
+    uint64_t max_size;
+};
+
+// how -f picks the matches it keeps
+enum class sparse_mode_t {
+    match,     // each on its own
+    window,    // all those between a pair of windows of Q together
+    alignment  // all those of a PAF row together
+};
+
+sparse_mode_t parse_sparse_mode(const std::string& mode);
+
+// the pairs of sequences whose alignments we keep, from a file of pairs of names, one pair per line
+// a pair holds in either order, as an alignment of a to b is one of b to a
+class match_list_t {
+public:
+    void load(const std::string& filename, const seqindex_t& seqidx);
+    bool keep(const uint64_t& a, const uint64_t& b) const {
+        return pairs.count(a < b ? std::make_pair(a, b) : std::make_pair(b, a));
+    }
+    uint64_t size(void) const { return pairs.size(); }
+
+private:
+    ska::flat_hash_set<std::pair<uint64_t, uint64_t>, wang_hash<std::pair<uint64_t, uint64_t>>> pairs;
+};
+
+// the columns by which we rank the mappings of a pair of sequences, longest first
+struct pair_mapping_key_t {
+    uint64_t block_length = 0;
+    uint64_t num_matches = 0;
+    uint64_t query_start = 0;
+    uint64_t query_end = 0;
+    uint64_t target_start = 0;
+    uint64_t target_end = 0;
+    bool same_strand = false;
+    // where the row is in the input, as the rank of its file among the PAFs and its offset in that file
+    uint64_t file = 0;
+    uint64_t offset = 0;
+    pair_mapping_key_t(void) { }
+    pair_mapping_key_t(const paf_row_t& paf, const uint64_t& file, const uint64_t& offset);
+    bool operator<(const pair_mapping_key_t& o) const;
+};
+
+// filters on whole PAF rows, decided from their columns before their CIGARs are read
+struct paf_filter_t {
+    const match_list_t* match_list = nullptr;
+    uint64_t min_block_length = 0;
+    float min_identity = 0; // num_matches / alignment_block_length
+    uint64_t max_pair_mappings = 0; // keep only the longest of the mappings between each pair of sequences
+    bool active(void) const { return match_list || min_block_length || min_identity > 0 || max_pair_mappings; }
+    // find the shortest mapping we keep of each pair with more than max_pair_mappings, in a pass over the PAFs
+    void rank_pair_mappings(const std::vector<std::string>& paf_files, const seqindex_t& seqidx, const uint64_t& num_threads);
+    // the filters of the columns, without the match list
+    bool keep_columns(const paf_row_t& paf) const;
+    // the row at the given offset of the file with the given rank
+    bool keep(const paf_row_t& paf, const seqindex_t& seqidx, const uint64_t& file, const uint64_t& offset) const;
+
+private:
+    ska::flat_hash_map<std::pair<uint64_t, uint64_t>, pair_mapping_key_t, wang_hash<std::pair<uint64_t, uint64_t>>> pair_mapping_floor;
+};
+
+// what the alignments gave, summed over the workers
+struct paf_stats_t {
+    std::atomic<uint64_t> rows{0};
+    std::atomic<uint64_t> kept_rows{0};
+    std::atomic<uint64_t> matches{0};
+    std::atomic<uint64_t> match_bp{0};
+};
+
+void unpack_paf_row(
+    const paf_row_t& paf,
+    aln_buffer_t& aln_buffer,
+    const seqindex_t& seqidx,
+    const uint64_t& min_match_len,
+    const float& sparsification_factor,
+    const sparse_mode_t& sparse_mode,
+    const uint64_t& sparse_window,
+    const bool& trust_cigar);
+
 void paf_worker(
-    igzstream& paf_in,
+    paf_block_queue_t& paf_blocks,
     std::atomic<bool>& paf_more,
-    std::mutex& paf_in_mutex,
-    mmmulti::iitree<uint64_t, pos_t>& aln_iitree,
+    waiter_t& paf_waiter,
+    mmmulti::iitree<uint64_t, pos_t>* aln_iitree,
+    std::mutex& aln_iitree_mutex,
+    std::atomic<uint64_t>& flush_count,
+    const uint64_t& buffer_size,
     const seqindex_t& seqidx,
     const uint64_t& min_match_len,
-    const float& sparsification_factor);
+    const float& sparsification_factor,
+    const sparse_mode_t& sparse_mode,
+    const uint64_t& sparse_window,
+    const bool& trust_cigar,
+    const paf_filter_t* filter,
+    paf_stats_t* stats,
+    const uint64_t& paf_rank);
 
-void unpack_paf_alignments(
+// returns the number of times the workers flushed their match buffers into aln_iitree
+uint64_t unpack_paf_alignments(
     const std::string& paf_file,
     mmmulti::iitree<uint64_t, pos_t>& aln_iitree,
     const seqindex_t& seqidx,
     const uint64_t& min_match_len,
     const float& sparsification_factor,
-    const uint64_t& num_threads);
+    const bool& trust_cigar,
+    const uint64_t& buffer_size,
+    const uint64_t& num_threads,
+    const paf_filter_t* filter = nullptr, // keep only the rows that pass it
+    paf_stats_t* stats = nullptr,
+    const sparse_mode_t& sparse_mode = sparse_mode_t::match,
+    const uint64_t& sparse_window = 10000,
+    const uint64_t& paf_rank = 0); // of paf_file among the PAFs, by which the filter orders rows that tie
+
+// count into stats what unpack_paf_alignments would give, keeping none of it
+void count_paf_alignments(
+    const std::string& paf_file,
+    const seqindex_t& seqidx,
+    const uint64_t& min_match_len,
+    const float& sparsification_factor,
+    const bool& trust_cigar,
+    const uint64_t& num_threads,
+    const paf_filter_t* filter,
+    paf_stats_t* stats,
+    const sparse_mode_t& sparse_mode = sparse_mode_t::match,
+    const uint64_t& sparse_window = 10000,
+    const uint64_t& paf_rank = 0);
 
 uint64_t match_hash(const pos_t& q, const pos_t& t, const uint64_t& l);
 
 bool keep_sparse(const pos_t& q, const pos_t& t, const uint64_t& l, const float f);
 
+// whether to keep the fraction f of the keys, by a well mixed hash of a, b and c
+bool keep_sampled(const uint64_t& a, const uint64_t& b, const uint64_t& c, const float f);
+
 
 /*
 void filter_alignments(mmmulti::map<pos_t, aln_pos_t>& aln_mm,
@@ -0,0 +1,82 @@
+#include "backoff.hpp"
+
+namespace seqwish {
+
+using namespace std::chrono_literals;
+
+// how long we stay in each state before trying the next, counted in calls to wait()
+static const uint64_t spin_rounds = 64;
+static const uint64_t yield_rounds = 64;
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+static backoff_stats_t global_backoff_stats = { {0}, {0}, {0}, {0} };
+
+backoff_stats_t& backoff_stats(void) {
+    return global_backoff_stats;
+}
+
+void log_backoff_stats(std::ostream& out) {
+    auto& stats = backoff_stats();
+    out << std::fixed << std::showpoint
+        << (double)stats.spin_ns.load() / 1e9 << "s spinning, "
+        << (double)stats.yield_ns.load() / 1e9 << "s yielding, "
+        << (double)stats.park_ns.load() / 1e9 << "s parked in "
+        << stats.parks.load() << " parks";
+}
+
+void waiter_t::park(const uint64_t& seen_epoch) {
+    std::unique_lock<std::mutex> lock(mutex);
+    parked.fetch_add(1);
+    // the timeout bounds the wait when no notification is coming, like at the end of a loop
+    cv.wait_for(lock, 1ms, [&](void) { return epoch.load() != seen_epoch; });
+    parked.fetch_sub(1);
+}
+
+void backoff_t::end_phase(void) {
+    auto now = std::chrono::steady_clock::now();
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - phase_start).count();
+    auto& stats = backoff_stats();
+    if (rounds <= spin_rounds) {
+        stats.spin_ns.fetch_add(ns);
+    } else if (rounds <= spin_rounds + yield_rounds) {
+        stats.yield_ns.fetch_add(ns);
+    } else {
+        stats.park_ns.fetch_add(ns);
+    }
+    phase_start = now;
+}
+
+void backoff_t::wait(void) {
+    if (rounds == 0) {
+        phase_start = std::chrono::steady_clock::now();
+    } else if (rounds == spin_rounds || rounds == spin_rounds + yield_rounds) {
+        end_phase();
+    }
+    ++rounds;
+    if (rounds <= spin_rounds) {
+        cpu_relax();
+    } else if (rounds <= spin_rounds + yield_rounds) {
+        std::this_thread::yield();
+    } else {
+        // anything made available since our last look will have moved the epoch on
+        ++backoff_stats().parks;
+        waiter.park(seen_epoch);
+    }
+    seen_epoch = waiter.current_epoch();
+}
+
+void backoff_t::reset(void) {
+    if (rounds) {
+        end_phase();
+        rounds = 0;
+    }
+}
+
+}
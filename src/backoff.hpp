@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <iostream>
+
+namespace seqwish {
+
+/*
+Idle waiting for our producer/consumer loops. A thread that finds nothing
+to do calls backoff_t::wait(), which spins with a CPU pause for a while,
+then yields, then parks on the waiter_t shared by the threads of the loop
+until someone calls notify() (or a short timeout passes). When the thread
+finds work again it calls reset(). The time spent in each of these states
+is added into a process-wide tally that we report with -P.
+*/
+
+// where idle threads park until there's new work
+class waiter_t {
+public:
+    waiter_t(void) { epoch.store(0); parked.store(0); }
+    // wake any parked threads, to be called after making work available
+    void notify(void) {
+        epoch.fetch_add(1);
+        if (parked.load()) {
+            std::lock_guard<std::mutex> guard(mutex);
+            cv.notify_all();
+        }
+    }
+    uint64_t current_epoch(void) const { return epoch.load(); }
+    // sleep until notify() has been called since we saw the given epoch
+    void park(const uint64_t& seen_epoch);
+
+private:
+    std::atomic<uint64_t> epoch;
+    std::atomic<uint64_t> parked;
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+struct backoff_stats_t {
+    std::atomic<uint64_t> spin_ns;
+    std::atomic<uint64_t> yield_ns;
+    std::atomic<uint64_t> park_ns;
+    std::atomic<uint64_t> parks;
+};
+
+backoff_stats_t& backoff_stats(void);
+void log_backoff_stats(std::ostream& out);
+
+class backoff_t {
+public:
+    backoff_t(waiter_t& w) : waiter(w) { }
+    ~backoff_t(void) { reset(); }
+    // we found nothing to do
+    void wait(void);
+    // we found something to do
+    void reset(void);
+
+private:
+    waiter_t& waiter;
+    uint64_t rounds = 0;
+    uint64_t seen_epoch = 0;
+    std::chrono::time_point<std::chrono::steady_clock> phase_start;
+    void end_phase(void);
+};
+
+}
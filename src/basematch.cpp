@@ -0,0 +1,174 @@
+#include "basematch.hpp"
+#include "dna.hpp"
+
+#if defined(__AVX512BW__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace seqwish {
+
+static inline bool bases_match_fwd(const char q, const char t) {
+    return q == t && q != 'N';
+}
+
+static inline bool bases_match_rev(const char q, const char t) {
+    char c = dna_reverse_complement(q);
+    return c == t && c != 'N';
+}
+
+// complements of A, C, G and T indexed by their low nibble, zero for anything else
+// a base is only taken to be in ACGT when complementing it twice gets it back
+#define COMPLEMENT_LUT_BYTES 0, 'T', 0, 'G', 'A', 0, 0, 'C', 0, 0, 0, 0, 0, 0, 0, 0
+
+#if defined(__AVX512BW__)
+
+static const uint64_t vector_width = 64;
+
+static inline uint64_t vector_match_fwd(const char* q, const char* t) {
+    __m512i vq = _mm512_loadu_si512((const void*)q);
+    __m512i vt = _mm512_loadu_si512((const void*)t);
+    __mmask64 eq = _mm512_cmpeq_epi8_mask(vq, vt);
+    __mmask64 n = _mm512_cmpeq_epi8_mask(vq, _mm512_set1_epi8('N'));
+    return eq & ~n;
+}
+
+static inline uint64_t vector_match_rev(const char* q, const char* t) {
+    // load the bytes ending at q and flip them around
+    __m512i vq = _mm512_loadu_si512((const void*)(q - (vector_width - 1)));
+    const __m512i flip = _mm512_set_epi8(
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    vq = _mm512_shuffle_epi8(vq, flip);
+    vq = _mm512_shuffle_i64x2(vq, vq, 0x1B);
+    __m512i vt = _mm512_loadu_si512((const void*)t);
+    const __m512i lut = _mm512_broadcast_i32x4(_mm_setr_epi8(COMPLEMENT_LUT_BYTES));
+    const __m512i low = _mm512_set1_epi8(0x0F);
+    __m512i ct = _mm512_shuffle_epi8(lut, _mm512_and_si512(vt, low));
+    __m512i back = _mm512_shuffle_epi8(lut, _mm512_and_si512(ct, low));
+    __mmask64 m = _mm512_cmpeq_epi8_mask(vq, ct)
+        & _mm512_cmpeq_epi8_mask(back, vt)
+        & ~_mm512_cmpeq_epi8_mask(ct, _mm512_setzero_si512());
+    return m;
+}
+
+static inline uint64_t first_miss(const uint64_t& mask) {
+    return ~mask ? __builtin_ctzll(~mask) : vector_width;
+}
+
+#elif defined(__AVX2__)
+
+static const uint64_t vector_width = 32;
+
+static inline uint64_t vector_match_fwd(const char* q, const char* t) {
+    __m256i vq = _mm256_loadu_si256((const __m256i*)q);
+    __m256i vt = _mm256_loadu_si256((const __m256i*)t);
+    __m256i eq = _mm256_cmpeq_epi8(vq, vt);
+    __m256i n = _mm256_cmpeq_epi8(vq, _mm256_set1_epi8('N'));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_andnot_si256(n, eq));
+}
+
+static inline uint64_t vector_match_rev(const char* q, const char* t) {
+    // load the bytes ending at q and flip them around
+    __m256i vq = _mm256_loadu_si256((const __m256i*)(q - (vector_width - 1)));
+    const __m256i flip = _mm256_setr_epi8(
+        15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+        15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    vq = _mm256_shuffle_epi8(vq, flip);
+    vq = _mm256_permute4x64_epi64(vq, 0x4E);
+    __m256i vt = _mm256_loadu_si256((const __m256i*)t);
+    const __m256i lut = _mm256_setr_epi8(COMPLEMENT_LUT_BYTES, COMPLEMENT_LUT_BYTES);
+    const __m256i low = _mm256_set1_epi8(0x0F);
+    __m256i ct = _mm256_shuffle_epi8(lut, _mm256_and_si256(vt, low));
+    __m256i back = _mm256_shuffle_epi8(lut, _mm256_and_si256(ct, low));
+    __m256i m = _mm256_and_si256(_mm256_cmpeq_epi8(vq, ct), _mm256_cmpeq_epi8(back, vt));
+    m = _mm256_andnot_si256(_mm256_cmpeq_epi8(ct, _mm256_setzero_si256()), m);
+    return (uint32_t)_mm256_movemask_epi8(m);
+}
+
+static inline uint64_t first_miss(const uint64_t& mask) {
+    uint32_t miss = ~(uint32_t)mask;
+    return miss ? __builtin_ctz(miss) : vector_width;
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+static const uint64_t vector_width = 16;
+
+// NEON has no movemask, so we narrow each byte of the comparison to a nibble
+static inline uint64_t nibble_mask(const uint8x16_t& m) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+}
+
+static inline uint64_t vector_match_fwd(const char* q, const char* t) {
+    uint8x16_t vq = vld1q_u8((const uint8_t*)q);
+    uint8x16_t vt = vld1q_u8((const uint8_t*)t);
+    uint8x16_t m = vbicq_u8(vceqq_u8(vq, vt), vceqq_u8(vq, vdupq_n_u8('N')));
+    return nibble_mask(m);
+}
+
+static inline uint64_t vector_match_rev(const char* q, const char* t) {
+    // load the bytes ending at q and flip them around
+    uint8x16_t vq = vld1q_u8((const uint8_t*)(q - (vector_width - 1)));
+    vq = vrev64q_u8(vq);
+    vq = vextq_u8(vq, vq, 8);
+    uint8x16_t vt = vld1q_u8((const uint8_t*)t);
+    static const uint8_t lut_bytes[16] = { COMPLEMENT_LUT_BYTES };
+    const uint8x16_t lut = vld1q_u8(lut_bytes);
+    const uint8x16_t low = vdupq_n_u8(0x0F);
+    uint8x16_t ct = vqtbl1q_u8(lut, vandq_u8(vt, low));
+    uint8x16_t back = vqtbl1q_u8(lut, vandq_u8(ct, low));
+    uint8x16_t m = vandq_u8(vceqq_u8(vq, ct), vceqq_u8(back, vt));
+    m = vbicq_u8(m, vceqzq_u8(ct));
+    return nibble_mask(m);
+}
+
+static inline uint64_t first_miss(const uint64_t& mask) {
+    return ~mask ? __builtin_ctzll(~mask) / 4 : vector_width;
+}
+
+#endif
+
+#if defined(__AVX512BW__) || defined(__AVX2__) || (defined(__ARM_NEON) && defined(__aarch64__))
+#define SEQWISH_VECTOR_MATCH
+#endif
+
+uint64_t match_prefix_fwd(const char* q, const char* t, uint64_t len) {
+    uint64_t i = 0;
+    while (i < len) {
+#ifdef SEQWISH_VECTOR_MATCH
+        while (i + vector_width <= len) {
+            uint64_t j = first_miss(vector_match_fwd(q + i, t + i));
+            i += j;
+            if (j < vector_width) break;
+        }
+#endif
+        // finish the tail, or settle the base the vector test stopped on
+        if (i == len || !bases_match_fwd(q[i], t[i])) break;
+        ++i;
+    }
+    return i;
+}
+
+uint64_t match_prefix_rev(const char* q, const char* t, uint64_t len) {
+    uint64_t i = 0;
+    while (i < len) {
+#ifdef SEQWISH_VECTOR_MATCH
+        while (i + vector_width <= len) {
+            uint64_t j = first_miss(vector_match_rev(q - i, t + i));
+            i += j;
+            if (j < vector_width) break;
+        }
+#endif
+        // finish the tail, or settle the base the vector test stopped on
+        // the vector test only accepts ACGT, so other complementary pairs end up here
+        if (i == len || !bases_match_rev(q[-(int64_t)i], t[i])) break;
+        ++i;
+    }
+    return i;
+}
+
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+namespace seqwish {
+
+/*
+Exact base comparison kernels used to find the matching stretches inside
+CIGAR match runs. Each returns the length of the longest prefix in which the
+query and target agree under the same rule as comparing seqindex_t::at_pos
+one base at a time: the bases are equal and the query base isn't 'N'.
+'match_prefix_fwd' reads both sequences forward. 'match_prefix_rev' reads
+the query backward from q and complements it, as we do for a query on the
+reverse strand. The bulk of the work is done with AVX-512BW, AVX2 or NEON,
+depending on what we're built for, and any lane that the vector test can't
+decide is settled by the scalar rule, so results never depend on the target.
+*/
+
+uint64_t match_prefix_fwd(const char* q, const char* t, uint64_t len);
+uint64_t match_prefix_rev(const char* q, const char* t, uint64_t len);
+
+}
@@ -0,0 +1,405 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <iomanip>
+#include <functional>
+#include "args.hxx"
+#include "mmmultimap.hpp"
+#include "mmiitree.hpp"
+#include "sdsl/bit_vectors.hpp"
+#include "seqindex.hpp"
+#include "paf.hpp"
+#include "cigar.hpp"
+#include "alignments.hpp"
+#include "transclosure.hpp"
+#include "dset64-gccAtomic.hpp"
+#include "links.hpp"
+#include "compact.hpp"
+#include "gfa.hpp"
+#include "pos.hpp"
+#include "time.hpp"
+#include "utils.hpp"
+#include "tempfile.hpp"
+
+/*
+seqwish-bench times the hot pieces of graph induction, one at a time and end
+to end. Both run over a synthetic pangenome: a random ancestor and haplotypes
+derived from it by SNPs and short indels, each aligned to the ancestor with
+an exact CIGAR. -l, -d and -x set the haplotype length, the number of
+haplotypes and the divergence.
+*/
+
+using namespace seqwish;
+
+// written to so that the compiler can't drop the work we are timing
+static volatile uint64_t sink = 0;
+
+struct synthetic_pangenome_t {
+    std::string fasta_file;
+    std::string paf_file;
+    std::vector<std::string> names;
+    std::vector<std::string> paf_lines;
+    uint64_t total_length = 0;
+};
+
+// append an operation to a CIGAR, merging it into the last one of the same kind
+void push_op(cigar_t& cigar, const char& op, const uint64_t& len) {
+    if (!cigar.empty() && cigar.back().op == op) {
+        cigar.back().len += len;
+    } else {
+        cigar.push_back({len, op});
+    }
+}
+
+synthetic_pangenome_t make_pangenome(const uint64_t& length,
+                                     const uint64_t& depth,
+                                     const double& divergence,
+                                     const uint64_t& seed) {
+    synthetic_pangenome_t pangenome;
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> coin(0, 1);
+    std::uniform_int_distribution<int> base(0, 3);
+    std::uniform_int_distribution<uint64_t> indel_len(1, 5);
+    const char* bases = "ACGT";
+    std::string ancestor(length, 'A');
+    for (auto& c : ancestor) c = bases[base(rng)];
+    pangenome.fasta_file = temp_file::create("seqwish-bench-", ".fa");
+    pangenome.paf_file = temp_file::create("seqwish-bench-", ".paf");
+    std::ofstream fasta(pangenome.fasta_file.c_str());
+    std::ofstream paf(pangenome.paf_file.c_str());
+    fasta << ">anc" << std::endl << ancestor << std::endl;
+    pangenome.names.push_back("anc");
+    pangenome.total_length += ancestor.size();
+    for (uint64_t h = 1; h < depth; ++h) {
+        std::string hap;
+        hap.reserve(length + length / 10);
+        cigar_t cigar;
+        uint64_t matches = 0;
+        for (uint64_t i = 0; i < length; ) {
+            if (coin(rng) >= divergence) {
+                hap.push_back(ancestor[i++]);
+                push_op(cigar, 'M', 1);
+                ++matches;
+                continue;
+            }
+            // mostly SNPs, with a fifth of the events split between insertions and deletions
+            double kind = coin(rng);
+            if (kind < 0.8) {
+                char c = ancestor[i++];
+                while (c == ancestor[i-1]) c = bases[base(rng)];
+                hap.push_back(c);
+                push_op(cigar, 'M', 1);
+            } else if (kind < 0.9 || i == 0) {
+                uint64_t n = indel_len(rng);
+                for (uint64_t j = 0; j < n; ++j) hap.push_back(bases[base(rng)]);
+                push_op(cigar, 'I', n);
+            } else {
+                uint64_t n = std::min(indel_len(rng), length - i);
+                i += n;
+                push_op(cigar, 'D', n);
+            }
+        }
+        std::string name = "hap" + std::to_string(h);
+        fasta << ">" << name << std::endl << hap << std::endl;
+        pangenome.names.push_back(name);
+        pangenome.total_length += hap.size();
+        std::stringstream line;
+        line << name << "\t" << hap.size() << "\t0\t" << hap.size() << "\t+\t"
+             << "anc\t" << length << "\t0\t" << length << "\t"
+             << matches << "\t" << std::max((uint64_t)hap.size(), length) << "\t60\t"
+             << "cg:Z:" << cigar_to_string(cigar);
+        pangenome.paf_lines.push_back(line.str());
+        paf << pangenome.paf_lines.back() << std::endl;
+    }
+    return pangenome;
+}
+
+void report(const std::string& name, const uint64_t& ops, const std::string& unit, const double& seconds) {
+    std::cout << std::left << std::setw(28) << name << std::right
+              << std::setw(14) << ops << " " << std::left << std::setw(6) << unit << std::right
+              << std::fixed << std::setprecision(3) << std::setw(10) << seconds << " s"
+              << std::setprecision(2) << std::setw(12) << (seconds > 0 ? ops / seconds / 1e6 : 0) << " M" << unit << "/s" << std::endl;
+}
+
+// time one microbenchmark, which returns how many operations it did
+void time_case(const std::string& name, const std::string& unit, const std::function<uint64_t(void)>& run) {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t ops = run();
+    report(name, ops, unit, seconds_since(start));
+}
+
+void run_microbenchmarks(const synthetic_pangenome_t& pangenome,
+                         const uint64_t& iterations,
+                         const uint64_t& seed,
+                         const uint64_t& num_threads) {
+    std::mt19937_64 rng(seed);
+    seqindex_t seqidx;
+    seqidx.build_index(pangenome.fasta_file, num_threads);
+    seqidx.save();
+    const uint64_t seq_length = seqidx.seq_length();
+    // there are few PAF rows, so we go through them enough times to parse a few hundred MB
+    const uint64_t passes = iterations * std::max((uint64_t)1, 200000000 / std::max((uint64_t)1, pangenome.total_length));
+
+    time_case("paf_row_t::parse", "row", [&](void) {
+            paf_row_t paf;
+            uint64_t rows = 0;
+            for (uint64_t i = 0; i < passes; ++i) {
+                for (auto& line : pangenome.paf_lines) {
+                    paf.parse(line.data(), line.data() + line.size());
+                    sink += paf.query_end;
+                    ++rows;
+                }
+            }
+            return rows;
+        });
+
+    std::vector<std::string> cigars;
+    for (auto& line : pangenome.paf_lines) {
+        cigars.push_back(line.substr(line.find("cg:Z:") + 5));
+    }
+    time_case("cigar_from_string", "op", [&](void) {
+            uint64_t ops = 0;
+            for (uint64_t i = 0; i < passes; ++i) {
+                for (auto& c : cigars) {
+                    ops += cigar_from_string(c).size();
+                }
+            }
+            return ops;
+        });
+
+    const uint64_t lookups = 1000000 * iterations;
+    std::vector<pos_t> positions(1000000);
+    {
+        std::uniform_int_distribution<uint64_t> pick(0, seq_length - 1);
+        for (auto& p : positions) p = make_pos_t(pick(rng), pick(rng) & 1);
+    }
+    time_case("seqindex_t::at_pos", "base", [&](void) {
+            uint64_t sum = 0;
+            for (uint64_t i = 0; i < lookups; ++i) {
+                sum += seqidx.at_pos(positions[i % positions.size()]);
+            }
+            sink += sum;
+            return lookups;
+        });
+
+    time_case("seqindex_t::rank_of_seq_named", "name", [&](void) {
+            uint64_t sum = 0;
+            uint64_t n = pangenome.names.size();
+            for (uint64_t i = 0; i < lookups / 10; ++i) {
+                sum += seqidx.rank_of_seq_named(pangenome.names[i % n]);
+            }
+            sink += sum;
+            return lookups / 10;
+        });
+
+    {
+        std::vector<DisjointSets::Aint> data(seq_length);
+        DisjointSets dsets(data.data(), data.size());
+        std::vector<std::pair<uint64_t, uint64_t>> pairs(seq_length);
+        std::uniform_int_distribution<uint64_t> pick(0, seq_length - 1);
+        for (auto& p : pairs) p = std::make_pair(pick(rng), pick(rng));
+        time_case("DisjointSets::unite", "op", [&](void) {
+                paryfor::parallel_for<uint64_t>(
+                    0, pairs.size(), num_threads, 10000,
+                    [&](uint64_t i, int tid) {
+                        dsets.unite(pairs[i].first, pairs[i].second);
+                    });
+                return (uint64_t)pairs.size();
+            });
+        // the same sets again, for the bulk readout
+        std::vector<DisjointSets::Aint> data_all(seq_length);
+        DisjointSets dsets_all(data_all.data(), data_all.size());
+        std::copy(data.begin(), data.end(), data_all.begin());
+        time_case("DisjointSets::find", "op", [&](void) {
+                std::atomic<uint64_t> sum; sum.store(0);
+                paryfor::parallel_for<uint64_t>(
+                    0, seq_length, num_threads, 10000,
+                    [&](uint64_t i, int tid) {
+                        sum += dsets.find(i);
+                    });
+                sink += sum.load();
+                return seq_length;
+            });
+        time_case("DisjointSets::find_all", "op", [&](void) {
+                const uint64_t block = 1 << 16;
+                paryfor::parallel_for<uint64_t>(
+                    0, (seq_length + block - 1) / block, num_threads, 1,
+                    [&](uint64_t b, int tid) {
+                        dsets_all.find_all(b * block, std::min(seq_length, (b + 1) * block));
+                    });
+                uint64_t sum = 0;
+                for (uint64_t i = 0; i < seq_length; ++i) {
+                    sum += dsets_all.parent(i);
+                }
+                sink += sum;
+                return seq_length;
+            });
+    }
+
+    {
+        // walk S as if every haplotype were closed with the ancestor base for base
+        const std::string node_idx = temp_file::create("seqwish-bench-", ".sqn");
+        const std::string path_idx = temp_file::create("seqwish-bench-", ".sqp");
+        mmmulti::iitree<uint64_t, pos_t> node_iitree(node_idx);
+        mmmulti::iitree<uint64_t, pos_t> path_iitree(path_idx);
+        node_iitree.open_writer();
+        path_iitree.open_writer();
+        std::vector<uint64_t> starts;
+        uint64_t shortest = seq_length;
+        for (uint64_t i = 1; i <= seqidx.n_seqs(); ++i) {
+            starts.push_back(seqidx.pos_in_all_seqs(i, 0, false));
+            shortest = std::min(shortest, (uint64_t)seqidx.nth_seq_length(i));
+        }
+        time_case("extend_range", "op", [&](void) {
+                range_buffer_t range_buffer;
+                for (uint64_t s = 0; s < shortest; ++s) {
+                    for (auto& q : starts) {
+                        extend_range(s, make_pos_t(q + s, false), range_buffer, seqidx, node_iitree, path_iitree);
+                    }
+                    flush_ranges(s, range_buffer, node_iitree, path_iitree);
+                }
+                flush_ranges(shortest + 1, range_buffer, node_iitree, path_iitree);
+                return shortest * starts.size();
+            });
+    }
+
+    {
+        const std::string aln_idx = temp_file::create("seqwish-bench-", ".sqa");
+        mmmulti::iitree<uint64_t, pos_t> aln_iitree(aln_idx);
+        aln_iitree.open_writer();
+        unpack_paf_alignments(pangenome.paf_file, aln_iitree, seqidx, 0, 0, false, 64000, num_threads);
+        aln_iitree.index(num_threads);
+        std::uniform_int_distribution<uint64_t> pick(0, seq_length - 1);
+        time_case("mmmulti::iitree::overlap", "query", [&](void) {
+                uint64_t found = 0;
+                for (uint64_t i = 0; i < lookups / 10; ++i) {
+                    uint64_t p = pick(rng);
+                    aln_iitree.overlap(
+                        p, p + 100,
+                        [&](const uint64_t& start, const uint64_t& end, const pos_t& pos) {
+                            ++found;
+                        });
+                }
+                sink += found;
+                return lookups / 10;
+            });
+    }
+}
+
+void run_end_to_end(const synthetic_pangenome_t& pangenome,
+                    const uint64_t& transclose_batch_size,
+                    const uint64_t& num_threads) {
+    std::chrono::time_point<std::chrono::steady_clock> start_time = std::chrono::steady_clock::now();
+    const uint64_t bp = pangenome.total_length;
+    auto step_start = std::chrono::steady_clock::now();
+    auto end_step =
+        [&](const std::string& step) {
+            report("pipeline " + step, bp, "bp", seconds_since(step_start));
+            step_start = std::chrono::steady_clock::now();
+        };
+
+    seqindex_t seqidx;
+    seqidx.build_index(pangenome.fasta_file, num_threads);
+    seqidx.save();
+    end_step("seqidx");
+
+    const std::string aln_idx = temp_file::create("seqwish-bench-", ".sqa");
+    mmmulti::iitree<uint64_t, pos_t> aln_iitree(aln_idx);
+    aln_iitree.open_writer();
+    unpack_paf_alignments(pangenome.paf_file, aln_iitree, seqidx, 0, 0, false, 64000, num_threads);
+    aln_iitree.index(num_threads);
+    end_step("alignments");
+
+    const std::string seq_v_file = temp_file::create("seqwish-bench-", ".sqs");
+    const std::string node_iitree_idx = temp_file::create("seqwish-bench-", ".sqn");
+    const std::string path_iitree_idx = temp_file::create("seqwish-bench-", ".sqp");
+    mmmulti::iitree<uint64_t, pos_t> node_iitree(node_iitree_idx);
+    mmmulti::iitree<uint64_t, pos_t> path_iitree(path_iitree_idx);
+    size_t graph_length = compute_transitive_closures(seqidx, aln_iitree, seq_v_file, node_iitree, path_iitree,
+                                                      0, 0, transclose_batch_size, false, 0, false, num_threads, start_time);
+    end_step("transclosure");
+
+    sdsl::sd_vector<> seq_id_cbv;
+    compact_nodes(seqidx, graph_length, node_iitree, path_iitree, seq_id_cbv, num_threads);
+    sdsl::sd_vector<>::rank_1_type seq_id_cbv_rank;
+    sdsl::sd_vector<>::select_1_type seq_id_cbv_select;
+    sdsl::util::assign(seq_id_cbv_rank, sdsl::sd_vector<>::rank_1_type(&seq_id_cbv));
+    sdsl::util::assign(seq_id_cbv_select, sdsl::sd_vector<>::select_1_type(&seq_id_cbv));
+    end_step("compact");
+
+    const std::string link_mm_idx = temp_file::create("seqwish-bench-", ".sql");
+    mmmulti::set<std::pair<pos_t, pos_t>> link_mmset(link_mm_idx);
+    derive_links(seqidx, path_iitree, seq_id_cbv, seq_id_cbv_rank, seq_id_cbv_select, link_mmset, num_threads);
+    end_step("links");
+
+    const std::string gfa_file = temp_file::create("seqwish-bench-", ".gfa");
+    {
+        buffered_writer_t out(gfa_file, false);
+        emit_gfa(out, graph_length, seq_v_file, node_iitree, path_iitree, seq_id_cbv, seq_id_cbv_rank, seq_id_cbv_select, seqidx, link_mmset, validate_mode_t::full, num_threads);
+    }
+    end_step("gfa");
+    report("pipeline total", bp, "bp", seconds_since(start_time));
+    std::cout << "graph length " << graph_length << " bp from " << bp << " bp in " << seqidx.n_seqs() << " sequences" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    args::ArgumentParser parser("seqwish-bench: time graph induction over synthetic pangenomes");
+    args::HelpFlag help(parser, "help", "display this help menu", {'h', "help"});
+    args::ValueFlag<std::string> length(parser, "N", "Length of each synthetic haplotype (1k = 1K = 1000, 1m = 1M = 10^6) [default 1m]", {'l', "length"});
+    args::ValueFlag<uint64_t> depth(parser, "N", "Number of haplotypes, counting the ancestor they are derived from [default 8]", {'d', "depth"});
+    args::ValueFlag<double> divergence(parser, "F", "Fraction of ancestral bases at which a haplotype carries a SNP or short indel [default 0.01]", {'x', "divergence"});
+    args::ValueFlag<uint64_t> seed(parser, "N", "Seed for the synthetic pangenome [default 42]", {"seed"});
+    args::ValueFlag<uint64_t> iterations(parser, "N", "Repeat each microbenchmark's workload N times [default 1]", {'n', "iterations"});
+    args::ValueFlag<std::string> transclose_batch(parser, "N", "Number of bp to use for transitive closure batch in the pipeline run [default 1M]", {'B', "transclose-batch"});
+    args::ValueFlag<int> thread_count(parser, "N", "Use this many threads during parallel steps", {'t', "threads"});
+    args::ValueFlag<std::string> tmp_base(parser, "PATH", "base name for temporary files [default: `pwd`]", {"temp-dir"});
+    args::Flag micro_only(parser, "", "Only run the microbenchmarks", {"micro"});
+    args::Flag pipeline_only(parser, "", "Only run the end-to-end pipeline", {"pipeline"});
+    try {
+        parser.ParseCLI(argc, argv);
+    } catch (args::Help) {
+        std::cout << parser;
+        return 0;
+    } catch (args::ParseError e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << parser;
+        return 1;
+    }
+
+    if (tmp_base) {
+        temp_file::set_dir(args::get(tmp_base));
+    } else {
+        char* cwd = get_current_dir_name();
+        temp_file::set_dir(std::string(cwd));
+        free(cwd);
+    }
+
+    uint64_t num_threads = args::get(thread_count) ? args::get(thread_count) : 1;
+    uint64_t hap_length = length ? (uint64_t)handy_parameter(args::get(length), 1000000) : 1000000;
+    uint64_t n_haps = depth ? std::max((uint64_t)1, args::get(depth)) : 8;
+    double div = divergence ? args::get(divergence) : 0.01;
+    uint64_t rng_seed = seed ? args::get(seed) : 42;
+    uint64_t n_iter = iterations ? std::max((uint64_t)1, args::get(iterations)) : 1;
+    uint64_t transclose_batch_size = transclose_batch ? (uint64_t)handy_parameter(args::get(transclose_batch), 1000000) : 1000000;
+    if (hap_length == 0) {
+        std::cerr << "[seqwish::bench] error: haplotypes must have a length" << std::endl;
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    synthetic_pangenome_t pangenome = make_pangenome(hap_length, n_haps, div, rng_seed);
+    std::cout << "synthetic pangenome of " << n_haps << " haplotypes of " << hap_length << " bp at divergence " << div
+              << ", " << pangenome.total_length << " bp, made in " << std::fixed << std::setprecision(3) << seconds_since(start) << " s" << std::endl;
+    if (!args::get(pipeline_only)) {
+        run_microbenchmarks(pangenome, n_iter, rng_seed, num_threads);
+    }
+    if (!args::get(micro_only)) {
+        run_end_to_end(pangenome, transclose_batch_size, num_threads);
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include "bingraph.hpp"
+#include "bufwriter.hpp"
+
+namespace seqwish {
+
+void emit_binary_graph(const std::string& filename,
+                       size_t graph_length,
+                       const std::string& seq_v_file,
+                       mmmulti::iitree<uint64_t, pos_t>& path_iitree,
+                       const sdsl::sd_vector<>& seq_id_cbv,
+                       const sdsl::sd_vector<>::rank_1_type& seq_id_cbv_rank,
+                       const sdsl::sd_vector<>::select_1_type& seq_id_cbv_select,
+                       seqindex_t& seqidx,
+                       mmmulti::set<std::pair<pos_t, pos_t>>& link_mmset,
+                       const validate_mode_t& validate,
+                       const uint64_t& num_threads,
+                       const path_steps_t* path_steps) {
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        std::cerr << "[seqwish::bingraph] error: could not open " << filename << " for writing" << std::endl;
+        exit(1);
+    }
+    int seq_v_fd = -1;
+    char* seq_v_buf = nullptr;
+    size_t seq_v_filesize = mmap_open(seq_v_file, seq_v_buf, seq_v_fd);
+
+    uint64_t n_nodes = seq_id_cbv_rank(seq_id_cbv.size()-1);
+    uint64_t n_paths = seqidx.n_seqs();
+    std::vector<uint64_t> header(14);
+    memcpy(&header[0], binary_graph_magic, 8);
+    header[1] = binary_graph_version;
+    header[2] = n_nodes;
+    header[3] = graph_length;
+    header[5] = n_paths;
+    const char zeros[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    uint64_t written = 0;
+    {
+        // the header is written again once we know the sizes of the later sections
+        buffered_writer_t out(fd);
+        auto put = [&](const void* data, const uint64_t& len) {
+            out.write((const char*)data, len);
+            written += len;
+        };
+        auto put_u64 = [&](const uint64_t& v) { put(&v, sizeof(v)); };
+        auto pad = [&](void) { if (written % 8) put(zeros, 8 - written % 8); };
+        put(header.data(), header.size() * sizeof(uint64_t));
+
+        header[7] = written;
+        for (uint64_t id = 1; id <= n_nodes + 1; ++id) {
+            put_u64(seq_id_cbv_select(id));
+        }
+        header[8] = written;
+        put(seq_v_buf, graph_length);
+        pad();
+
+        header[9] = written;
+        uint64_t n_edges = 0;
+        link_mmset.for_each_unique_value(
+            [&](const std::pair<pos_t, pos_t>& p) {
+                if (p.first && p.second) {
+                    put_u64(p.first);
+                    put_u64(p.second);
+                    ++n_edges;
+                }
+            });
+        header[4] = n_edges;
+
+        header[10] = written;
+        uint64_t name_start = 0;
+        put_u64(name_start);
+        for (uint64_t i = 1; i <= n_paths; ++i) {
+            name_start += seqidx.nth_name(i).size();
+            put_u64(name_start);
+        }
+        header[11] = written;
+        for (uint64_t i = 1; i <= n_paths; ++i) {
+            put(seqidx.nth_name(i).data(), seqidx.nth_name(i).size());
+        }
+        pad();
+
+        // the paths are walked in pieces in parallel as for the GFA, their steps going out in order
+        header[12] = written;
+        std::vector<path_piece_t> pieces = path_pieces(seqidx);
+        std::vector<uint64_t> step_starts;
+        step_starts.reserve(n_paths + 1);
+        uint64_t n_steps = 0;
+        format_in_order(
+            pieces.size(), num_threads,
+            [&](const uint64_t& i, std::string& buf) {
+                std::vector<pos_t> steps;
+                get_piece_steps(i, pieces, path_steps, path_iitree, seq_id_cbv, seq_id_cbv_rank, seq_id_cbv_select, seqidx, seq_v_buf, validate, steps);
+                buf.append((const char*)steps.data(), steps.size() * sizeof(pos_t));
+            },
+            [&](const uint64_t& i, const std::string& buf) {
+                if (pieces[i].first) step_starts.push_back(n_steps);
+                put(buf.data(), buf.size());
+                n_steps += buf.size() / sizeof(pos_t);
+            });
+        step_starts.push_back(n_steps);
+        header[6] = n_steps;
+        header[13] = written;
+        put(step_starts.data(), step_starts.size() * sizeof(uint64_t));
+    }
+    if (pwrite(fd, header.data(), header.size() * sizeof(uint64_t), 0) != (ssize_t)(header.size() * sizeof(uint64_t))) {
+        std::cerr << "[seqwish::bingraph] error: could not write the header of " << filename << std::endl;
+        exit(1);
+    }
+    close(fd);
+    mmap_close(seq_v_buf, seq_v_fd, seq_v_filesize);
+}
+
+}
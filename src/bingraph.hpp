@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "mmiitree.hpp"
+#include "mmmultiset.hpp"
+#include "seqindex.hpp"
+#include "pos.hpp"
+#include "mmap.hpp"
+#include "gfa.hpp"
+
+namespace seqwish {
+
+/*
+A binary form of the graph for smaller files and no text to parse, laid out
+so that it can be mmapped and used in place. All integers are unsigned 64-bit
+in the byte order of the machine that wrote the file (little-endian on x86-64
+and aarch64). Every section starts 8-byte aligned.
+
+The header holds 14 integers:
+  magic "SQWGRAPH", version (1), nodes, graph bp, edges, paths, path steps,
+  then the file offsets of the sections below, in this order
+  node starts:  nodes+1 offsets into the graph sequence, node i (from 1)
+                spans [start[i-1], start[i])
+  sequence:     the graph bp, zero padded to 8 bytes
+  edges:        pairs of handles (from, to), as in the GFA L-lines
+  name starts:  paths+1 offsets into the names
+  names:        the path names one after another, zero padded to 8 bytes
+  steps:        the handles of every path one after another
+  step starts:  paths+1 indexes into the steps, path p (from 0) is
+                steps[step_start[p], step_start[p+1])
+A handle is the node id shifted up by one, its low bit set for reverse.
+scripts/bingraph2gfa decodes the file back into the GFA of the same run.
+*/
+
+const char binary_graph_magic[8] = { 'S', 'Q', 'W', 'G', 'R', 'A', 'P', 'H' };
+const uint64_t binary_graph_version = 1;
+
+void emit_binary_graph(const std::string& filename,
+                       size_t graph_length,
+                       const std::string& seq_v_file,
+                       mmmulti::iitree<uint64_t, pos_t>& path_iitree,
+                       const sdsl::sd_vector<>& seq_id_cbv,
+                       const sdsl::sd_vector<>::rank_1_type& seq_id_cbv_rank,
+                       const sdsl::sd_vector<>::select_1_type& seq_id_cbv_select,
+                       seqindex_t& seqidx,
+                       mmmulti::set<std::pair<pos_t, pos_t>>& link_mmset,
+                       const validate_mode_t& validate,
+                       const uint64_t& num_threads,
+                       const path_steps_t* path_steps = nullptr);
+
+}
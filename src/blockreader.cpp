@@ -0,0 +1,193 @@
+#include <cstring>
+#include <zlib.h>
+#include <sys/stat.h>
+#include "blockreader.hpp"
+#include "paryfor.hpp"
+
+namespace seqwish {
+
+// BGZF members carry a gzip FEXTRA subfield 'BC' holding the member size
+static const uint64_t bgzf_header_size = 12;
+static const uint64_t bgzf_max_member_size = 1 << 16;
+
+static uint16_t read_le16(const unsigned char* p) {
+    return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+}
+
+static uint32_t read_le32(const unsigned char* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// find the BSIZE field in a gzip extra field, returning 0 if it's not a BGZF member
+static uint64_t bgzf_member_size(const unsigned char* extra, uint64_t xlen) {
+    uint64_t i = 0;
+    while (i + 4 <= xlen) {
+        uint16_t slen = read_le16(extra + i + 2);
+        if (extra[i] == 'B' && extra[i+1] == 'C' && slen == 2 && i + 6 <= xlen) {
+            return (uint64_t)read_le16(extra + i + 4) + 1;
+        }
+        i += 4 + slen;
+    }
+    return 0;
+}
+
+bool file_is_bgzf(const std::string& filename) {
+    // a pipe would lose the bytes we sniff, so only a regular file can be read as BGZF
+    struct stat stats;
+    if (stat(filename.c_str(), &stats) != 0 || !S_ISREG(stats.st_mode)) return false;
+    FILE* in = fopen(filename.c_str(), "rb");
+    if (in == nullptr) return false;
+    unsigned char header[bgzf_header_size];
+    bool is_bgzf = false;
+    if (fread(header, 1, bgzf_header_size, in) == bgzf_header_size
+        && header[0] == 31 && header[1] == 139 && header[2] == 8 && (header[3] & 4)) {
+        uint64_t xlen = read_le16(header + 10);
+        std::vector<unsigned char> extra(xlen);
+        if (fread(extra.data(), 1, xlen, in) == xlen) {
+            is_bgzf = bgzf_member_size(extra.data(), xlen) > 0;
+        }
+    }
+    fclose(in);
+    return is_bgzf;
+}
+
+block_reader_t::block_reader_t(const std::string& name,
+                               const uint64_t& threads,
+                               const uint64_t& size)
+    : filename(name), num_threads(std::max((uint64_t)1, threads)), block_size(size) {
+    bgzf = file_is_bgzf(filename);
+    if (bgzf) {
+        bgzf_in = fopen(filename.c_str(), "rb");
+        ok = bgzf_in != nullptr;
+    } else {
+        gz_in = std::make_unique<igzstream>(filename.c_str());
+        ok = gz_in->good();
+    }
+}
+
+block_reader_t::~block_reader_t(void) {
+    if (bgzf_in != nullptr) {
+        fclose(bgzf_in);
+        bgzf_in = nullptr;
+    }
+    if (gz_in) {
+        gz_in->close();
+    }
+}
+
+bool block_reader_t::good(void) const {
+    return ok;
+}
+
+bool block_reader_t::read_bgzf_member(std::string& member) {
+    unsigned char header[bgzf_header_size];
+    size_t got = fread(header, 1, bgzf_header_size, bgzf_in);
+    if (got == 0) {
+        return false;
+    }
+    if (got != bgzf_header_size || header[0] != 31 || header[1] != 139) {
+        std::cerr << "[seqwish::blockreader] error: truncated or corrupt BGZF header in " << filename << std::endl;
+        exit(1);
+    }
+    uint64_t xlen = read_le16(header + 10);
+    member.resize(bgzf_header_size + xlen);
+    memcpy(&member[0], header, bgzf_header_size);
+    if (fread(&member[bgzf_header_size], 1, xlen, bgzf_in) != xlen) {
+        std::cerr << "[seqwish::blockreader] error: truncated BGZF extra field in " << filename << std::endl;
+        exit(1);
+    }
+    uint64_t member_size = bgzf_member_size((const unsigned char*)&member[bgzf_header_size], xlen);
+    if (member_size == 0 || member_size > bgzf_max_member_size
+        || member_size < bgzf_header_size + xlen + 8) {
+        std::cerr << "[seqwish::blockreader] error: " << filename << " mixes BGZF and non-BGZF gzip members" << std::endl;
+        exit(1);
+    }
+    uint64_t rest = member_size - (bgzf_header_size + xlen);
+    member.resize(member_size);
+    if (fread(&member[bgzf_header_size + xlen], 1, rest, bgzf_in) != rest) {
+        std::cerr << "[seqwish::blockreader] error: truncated BGZF member in " << filename << std::endl;
+        exit(1);
+    }
+    return true;
+}
+
+void block_reader_t::read_raw(std::string& out) {
+    if (!bgzf) {
+        size_t have = out.size();
+        out.resize(have + block_size);
+        gz_in->read(&out[have], block_size);
+        uint64_t got = gz_in->gcount();
+        out.resize(have + got);
+        eof = !gz_in->good() || got == 0;
+        return;
+    }
+    // collect enough members to fill a block
+    uint64_t n_members = 0;
+    uint64_t inflated_size = 0;
+    while (inflated_size < block_size) {
+        if (members.size() <= n_members) {
+            members.emplace_back();
+        }
+        auto& member = members[n_members];
+        if (!read_bgzf_member(member)) {
+            eof = true;
+            break;
+        }
+        inflated_size += read_le32((const unsigned char*)&member[member.size() - 4]);
+        ++n_members;
+    }
+    // lay out the inflated members end to end after what we already have
+    std::vector<uint64_t> out_offsets(n_members + 1);
+    out_offsets[0] = out.size();
+    for (uint64_t i = 0; i < n_members; ++i) {
+        auto& member = members[i];
+        out_offsets[i+1] = out_offsets[i] + read_le32((const unsigned char*)&member[member.size() - 4]);
+    }
+    out.resize(out_offsets[n_members]);
+    paryfor::parallel_for<uint64_t>(
+        0, n_members, num_threads, 1,
+        [&](uint64_t i) {
+            auto& member = members[i];
+            const unsigned char* data = (const unsigned char*)member.data();
+            uint64_t xlen = read_le16(data + 10);
+            uint64_t cdata_offset = bgzf_header_size + xlen;
+            uint64_t cdata_length = member.size() - cdata_offset - 8;
+            uint32_t crc = read_le32(data + member.size() - 8);
+            uint64_t isize = out_offsets[i+1] - out_offsets[i];
+            Bytef* dest = (Bytef*)&out[out_offsets[i]];
+            z_stream zs;
+            memset(&zs, 0, sizeof(zs));
+            bool inflated = inflateInit2(&zs, -15) == Z_OK;
+            if (inflated) {
+                zs.next_in = (Bytef*)(data + cdata_offset);
+                zs.avail_in = cdata_length;
+                zs.next_out = dest;
+                zs.avail_out = isize;
+                inflated = inflate(&zs, Z_FINISH) == Z_STREAM_END && zs.total_out == isize;
+                inflateEnd(&zs);
+            }
+            if (!inflated || crc32(crc32(0L, Z_NULL, 0), dest, isize) != crc) {
+                std::cerr << "[seqwish::blockreader] error: could not inflate BGZF member in " << filename << std::endl;
+                exit(1);
+            }
+        });
+}
+
+bool block_reader_t::next(std::string& block) {
+    block.swap(carry);
+    carry.clear();
+    while (!eof) {
+        size_t scanned = block.size();
+        read_raw(block);
+        // cut the block on its last newline, keeping the partial line for next time
+        auto n = block.find_last_of('\n');
+        if (n != std::string::npos && n >= scanned) {
+            carry.assign(block, n + 1, std::string::npos);
+            block.resize(n + 1);
+            return true;
+        }
+    }
+    return !block.empty();
+}
+
+}
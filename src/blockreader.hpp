@@ -0,0 +1,56 @@
+#pragma once
+
+#include <iostream>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include "gzstream.h"
+
+namespace seqwish {
+
+/*
+'block_reader_t' reads a plain, gzipped, or BGZF-compressed text file in
+large blocks that always end on a line boundary, so that whole batches of
+lines can be handed to worker threads without further synchronization.
+BGZF input (as written by bgzip) is a series of independent gzip members
+of at most 64KB, which we inflate in parallel, one member per task. Any
+other input, including BGZF from a pipe, which we can't look into before
+reading it, falls back to a single inflate stream through igzstream.
+*/
+
+class block_reader_t {
+public:
+    block_reader_t(const std::string& filename,
+                   const uint64_t& num_threads,
+                   const uint64_t& block_size = 1 << 20);
+    ~block_reader_t(void);
+    bool good(void) const;
+    bool is_bgzf(void) const { return bgzf; }
+    // replace the contents of block with the next run of complete lines
+    // returns false once the input is exhausted
+    bool next(std::string& block);
+
+private:
+    std::string filename;
+    uint64_t num_threads = 1;
+    uint64_t block_size = 1 << 20;
+    bool bgzf = false;
+    bool eof = false;
+    bool ok = false;
+    FILE* bgzf_in = nullptr;
+    std::unique_ptr<igzstream> gz_in;
+    // the partial line left over at the end of the last block
+    std::string carry;
+    // compressed BGZF members waiting to be inflated
+    std::vector<std::string> members;
+    bool read_bgzf_member(std::string& member);
+    // append the next stretch of decompressed bytes to out
+    void read_raw(std::string& out);
+};
+
+// check if the file is a regular file that starts with a BGZF block header
+bool file_is_bgzf(const std::string& filename);
+
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include "pos.hpp"
+#include "compress.hpp"
+
+namespace seqwish {
+
+/*
+Text output without iostreams. Records are formatted into a large aligned
+buffer, which goes out with write(2) once it fills. With O_DIRECT the blocks
+skip the page cache, so writing a huge GFA doesn't push our mmapped indexes
+out of memory. A file named .gz or .zst is compressed as we go, the blocks
+going to a pool of compression threads instead.
+*/
+
+// the decimal digits of v from p on, returning the end of them
+inline char* format_uint(char* p, uint64_t v) {
+    static const char pairs[] =
+        "00010203040506070809101112131415161718192021222324"
+        "25262728293031323334353637383940414243444546474849"
+        "50515253545556575859606162636465666768697071727374"
+        "75767778798081828384858687888990919293949596979899";
+    uint64_t digits = 1;
+    for (uint64_t x = v; x >= 10; x /= 10) ++digits;
+    char* end = p + digits;
+    char* q = end;
+    while (v >= 100) {
+        const char* d = pairs + (v % 100) * 2;
+        v /= 100;
+        *--q = d[1];
+        *--q = d[0];
+    }
+    if (v >= 10) {
+        const char* d = pairs + v * 2;
+        *--q = d[1];
+        *--q = d[0];
+    } else {
+        *--q = '0' + v;
+    }
+    return end;
+}
+
+inline void append_uint(std::string& s, const uint64_t& v) {
+    char b[20];
+    s.append(b, format_uint(b, v) - b);
+}
+
+// the same text as pos_to_string, an id and its orientation
+inline void append_pos(std::string& s, const pos_t& pos) {
+    char b[21];
+    char* e = format_uint(b, offset(pos));
+    *e++ = is_rev(pos) ? '-' : '+';
+    s.append(b, e - b);
+}
+
+class buffered_writer_t {
+public:
+    // O_DIRECT needs its blocks aligned in memory, on disk and in length
+    static const uint64_t alignment = 4096;
+    static const uint64_t block_size = 1 << 22;
+
+    // write to an open file descriptor, which we don't close
+    buffered_writer_t(const int& out_fd) : fd(out_fd) { allocate(); }
+    // create or truncate filename, opening it with O_DIRECT if direct is set and the file system allows it
+    // compressed files use up to num_threads compression threads
+    buffered_writer_t(const std::string& filename, const bool& direct, const uint64_t& num_threads = 1) {
+        compression_t compression = compression_for(filename);
+        if (direct && compression == compression_t::none) {
+            fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+            if (fd == -1) {
+                std::cerr << "[seqwish::bufwriter] warning: could not open " << filename << " for direct I/O, writing it through the page cache" << std::endl;
+            } else {
+                is_direct = true;
+            }
+        }
+        if (fd == -1) {
+            fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+        if (fd == -1) {
+            std::cerr << "[seqwish::bufwriter] error: could not open " << filename << " for writing" << std::endl;
+            exit(1);
+        }
+        owns_fd = true;
+        if (compression != compression_t::none) {
+            compressor = std::make_unique<block_compressor_t>(fd, compression, num_threads);
+        }
+        allocate();
+    }
+    buffered_writer_t(const buffered_writer_t&) = delete;
+    buffered_writer_t& operator=(const buffered_writer_t&) = delete;
+    ~buffered_writer_t(void) {
+        close();
+        free(buf);
+    }
+
+    void write(const char* data, uint64_t len) {
+        while (len) {
+            uint64_t n = std::min(len, block_size - used);
+            memcpy(buf + used, data, n);
+            used += n;
+            data += n;
+            len -= n;
+            if (used == block_size) flush_block();
+        }
+    }
+    void write(const std::string& s) { write(s.data(), s.size()); }
+    void put(const char& c) {
+        buf[used++] = c;
+        if (used == block_size) flush_block();
+    }
+    void write_uint(const uint64_t& v) {
+        if (block_size - used < 20) flush_block();
+        used = format_uint(buf + used, v) - buf;
+    }
+    void write_pos(const pos_t& pos) {
+        write_uint(offset(pos));
+        put(is_rev(pos) ? '-' : '+');
+    }
+    // write out what we hold and the file, which takes no more writes
+    void close(void) {
+        if (fd == -1) return;
+        if (compressor) {
+            compressor->compress(buf, used);
+            used = 0;
+            compressor->finish();
+        } else if (used) {
+            if (is_direct && used % alignment) {
+                // the last block is short, which O_DIRECT won't take
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+                is_direct = false;
+            }
+            write_out(buf, used);
+            used = 0;
+        }
+        if (owns_fd) ::close(fd);
+        fd = -1;
+    }
+
+private:
+    int fd = -1;
+    bool owns_fd = false;
+    bool is_direct = false;
+    char* buf = nullptr;
+    uint64_t used = 0;
+    std::unique_ptr<block_compressor_t> compressor;
+
+    void allocate(void) {
+        if (posix_memalign((void**)&buf, alignment, block_size) != 0) {
+            std::cerr << "[seqwish::bufwriter] error: could not allocate the output buffer" << std::endl;
+            exit(1);
+        }
+    }
+    void flush_block(void) {
+        if (compressor) {
+            compressor->compress(buf, used);
+            used = 0;
+        } else if (is_direct && used % alignment) {
+            // keep the tail back for the next block, so that O_DIRECT writes stay aligned
+            uint64_t aligned = used - used % alignment;
+            write_out(buf, aligned);
+            memmove(buf, buf + aligned, used - aligned);
+            used -= aligned;
+        } else {
+            write_out(buf, used);
+            used = 0;
+        }
+    }
+    void write_out(const char* data, const uint64_t& len) {
+        write_fully(fd, data, len);
+    }
+};
+
+}
@@ -0,0 +1,171 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "checkpoint.hpp"
+#include "tempfile.hpp"
+#include "tokenize.hpp"
+
+namespace seqwish {
+
+static const std::string checkpoint_magic = "seqwish-checkpoint";
+
+// FNV-1a of the key so far and the step's parameters
+static uint64_t chain_key(const uint64_t& key, const std::string& step, const std::string& params) {
+    uint64_t h = 0xcbf29ce484222325ULL ^ key;
+    auto add = [&](const std::string& s) {
+        for (const char& c : s) {
+            h ^= (uint8_t)c;
+            h *= 0x100000001b3ULL;
+        }
+        h ^= 0xff;
+        h *= 0x100000001b3ULL;
+    };
+    add(step);
+    add(params);
+    return h;
+}
+
+struct manifest_step_t {
+    std::string step;
+    uint64_t key = 0;
+    uint64_t value = 0;
+};
+
+// read the steps of the manifest in dir, returning false if it's missing or of another version
+static bool read_manifest(const std::string& dir, std::vector<manifest_step_t>& steps, bool& other_version) {
+    std::ifstream in((dir + "/manifest").c_str());
+    std::string line;
+    other_version = false;
+    if (!std::getline(in, line)) {
+        return false;
+    }
+    std::vector<std::string> fields;
+    tokenize(line, fields, "\t");
+    if (fields.size() != 2 || fields[0] != checkpoint_magic || std::stoul(fields[1]) != checkpoint_version) {
+        other_version = true;
+        return false;
+    }
+    while (std::getline(in, line)) {
+        fields.clear();
+        tokenize(line, fields, "\t");
+        if (fields.size() != 3) break;
+        manifest_step_t r;
+        r.step = fields[0];
+        r.key = std::stoull(fields[1], nullptr, 16);
+        r.value = std::stoull(fields[2]);
+        steps.push_back(r);
+    }
+    return true;
+}
+
+std::string checkpoint_file(const std::string& dir, const std::string& step, const std::string& suffix) {
+    return dir + "/" + step + suffix;
+}
+
+bool checkpointed_step(const std::string& dir, const std::string& step, uint64_t& value) {
+    std::vector<manifest_step_t> steps;
+    bool other_version = false;
+    if (!read_manifest(dir, steps, other_version)) {
+        return false;
+    }
+    for (auto& s : steps) {
+        if (s.step == step) {
+            value = s.value;
+            return true;
+        }
+    }
+    return false;
+}
+
+void checkpoint_t::open(const std::string& checkpoint_dir, const bool& resume) {
+    dir = checkpoint_dir;
+    struct stat stats;
+    if (mkdir(dir.c_str(), 0755) == -1 && !(stat(dir.c_str(), &stats) == 0 && S_ISDIR(stats.st_mode))) {
+        std::cerr << "[seqwish::checkpoint] error: could not make the checkpoint directory " << dir << std::endl;
+        exit(1);
+    }
+    if (resume) {
+        std::vector<manifest_step_t> steps;
+        bool other_version = false;
+        if (read_manifest(dir, steps, other_version)) {
+            for (auto& s : steps) {
+                record_t r;
+                r.step = s.step;
+                r.key = s.key;
+                r.value = s.value;
+                found.push_back(r);
+            }
+        } else if (other_version) {
+            std::cerr << "[seqwish::checkpoint] warning: " << dir << " holds checkpoints of another version, starting over" << std::endl;
+        }
+        resuming = true;
+    }
+    // what we found is kept until we run a step
+    if (!resume) write_manifest();
+}
+
+std::string checkpoint_t::file(const std::string& step, const std::string& suffix) const {
+    if (!enabled()) {
+        return temp_file::create("seqwish-", suffix);
+    }
+    return checkpoint_file(dir, step, suffix);
+}
+
+bool checkpoint_t::done(const std::string& step, const std::string& params) {
+    key = chain_key(key, step, params);
+    step_keys[step] = key;
+    if (resuming) {
+        uint64_t i = completed.size();
+        if (i < found.size() && found[i].step == step && found[i].key == key) {
+            completed.push_back(found[i]);
+            return true;
+        }
+        // this and every later step will be run again, overwriting their files
+        resuming = false;
+    }
+    if (enabled()) write_manifest();
+    return false;
+}
+
+uint64_t checkpoint_t::value(const std::string& step) const {
+    for (auto& r : completed) {
+        if (r.step == step) return r.value;
+    }
+    return 0;
+}
+
+void checkpoint_t::complete(const std::string& step, const uint64_t& value) {
+    if (!enabled()) return;
+    record_t r;
+    r.step = step;
+    r.key = step_keys[step];
+    r.value = value;
+    completed.push_back(r);
+    write_manifest();
+}
+
+void checkpoint_t::write_manifest(void) const {
+    std::string manifest = dir + "/manifest";
+    std::string tmp = manifest + ".tmp." + std::to_string(getpid());
+    {
+        std::ofstream out(tmp.c_str());
+        out << checkpoint_magic << "\t" << checkpoint_version << "\n";
+        for (auto& r : completed) {
+            out << r.step << "\t" << std::hex << r.key << std::dec << "\t" << r.value << "\n";
+        }
+        out.close();
+        if (!out.good()) {
+            std::cerr << "[seqwish::checkpoint] error: could not write " << tmp << std::endl;
+            exit(1);
+        }
+    }
+    if (std::rename(tmp.c_str(), manifest.c_str()) != 0) {
+        std::cerr << "[seqwish::checkpoint] error: could not write " << manifest << std::endl;
+        exit(1);
+    }
+}
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+namespace seqwish {
+
+/*
+Checkpoints keep the outputs of the steps of graph induction in a directory,
+next to a manifest of the steps that completed there. Each step is keyed by a
+hash of its parameters chained onto the keys of the steps before it, so that
+a step is only found done when it and everything it was built from match the
+current run. With --resume the steps found done are loaded instead of run.
+The manifest is rewritten, under a new name and then renamed over the old,
+before a step starts writing its files, so it never lists a step whose files
+are being replaced.
+*/
+
+const uint32_t checkpoint_version = 1;
+
+// the file of a step with the given suffix in the checkpoint directory
+std::string checkpoint_file(const std::string& dir, const std::string& step, const std::string& suffix);
+
+// whether the run checkpointed in dir completed the step, and the value it kept with it
+bool checkpointed_step(const std::string& dir, const std::string& step, uint64_t& value);
+
+class checkpoint_t {
+public:
+    // without a directory the step files are temp files and nothing is resumed
+    void open(const std::string& dir, const bool& resume);
+    bool enabled(void) const { return !dir.empty(); }
+    // the file of the step with the given suffix
+    std::string file(const std::string& step, const std::string& suffix) const;
+    // chain the parameters of the step onto our key, saying whether an earlier run completed it
+    // the steps must be asked after in the order they run
+    bool done(const std::string& step, const std::string& params);
+    // the value kept with a completed step
+    uint64_t value(const std::string& step) const;
+    // note that the step completed, keeping a value with it
+    void complete(const std::string& step, const uint64_t& value = 0);
+
+private:
+    struct record_t {
+        std::string step;
+        uint64_t key = 0;
+        uint64_t value = 0;
+    };
+    std::string dir;
+    uint64_t key = 0; // of the steps so far
+    bool resuming = false; // while every step so far was found done
+    std::vector<record_t> found; // in the manifest of the earlier run
+    std::vector<record_t> completed; // in this run
+    std::map<std::string, uint64_t> step_keys;
+    void write_manifest(void) const;
+};
+
+}
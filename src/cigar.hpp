@@ -5,6 +5,7 @@
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <cstdint>
 
 namespace seqwish {
 
@@ -13,6 +14,46 @@ typedef std::vector<cigar_op_t> cigar_t;
 cigar_t cigar_from_string(const std::string& s);
 std::string cigar_to_string(const cigar_t& cigar);
 
+// a CIGAR string that is read in place, yielding its operations one at a time
+// the underlying characters must outlive the view
+class cigar_view_t {
+public:
+    class iterator {
+    public:
+        iterator(const char* b, const char* e) : curr(b), end(e) { read(); }
+        const cigar_op_t& operator*(void) const { return op; }
+        const cigar_op_t* operator->(void) const { return &op; }
+        iterator& operator++(void) { curr = next; read(); return *this; }
+        bool operator==(const iterator& other) const { return curr == other.curr; }
+        bool operator!=(const iterator& other) const { return curr != other.curr; }
+    private:
+        const char* curr;
+        const char* next;
+        const char* end;
+        cigar_op_t op = { 0, 0 };
+        void read(void) {
+            next = curr;
+            uint64_t len = 0;
+            while (next != end && *next >= '0' && *next <= '9') {
+                len = len * 10 + (*next++ - '0');
+            }
+            if (next == end) {
+                // a trailing length without an operation isn't an operation
+                curr = next = end;
+            } else {
+                op = { len, *next++ };
+            }
+        }
+    };
+    const char* data = nullptr;
+    size_t length = 0;
+    cigar_view_t(void) { }
+    cigar_view_t(const char* b, const char* e) : data(b), length(e - b) { }
+    iterator begin(void) const { return iterator(data, data + length); }
+    iterator end(void) const { return iterator(data + length, data + length); }
+    bool empty(void) const { return length == 0; }
+};
+
 }
 
 #endif
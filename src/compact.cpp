@@ -8,78 +8,93 @@ void compact_nodes(
     size_t graph_size,
     mmmulti::iitree<uint64_t, pos_t>& node_iitree,
     mmmulti::iitree<uint64_t, pos_t>& path_iitree,
-    sdsl::bit_vector& seq_id_bv,
+    sdsl::sd_vector<>& seq_id_cbv,
     uint64_t num_threads) {
-    // for each pair of positions in the graph base seq
-    // do we have any links from the first that don't go to the second?
-    // do we have any links to the second that don't come from the first?
-    //seq_id_bv[0] = 1; // set first node start
-    atomicbitvector::atomic_bv_t seq_id_abv(seq_id_bv.size());
-    seq_id_abv.set(0);
-    size_t num_seqs = seqidx.n_seqs();
-    auto handle_seq =
-        [&](size_t i) {
-        size_t j = seqidx.nth_seq_offset(i);
-        size_t seq_len = seqidx.nth_seq_length(i);
-        size_t k = j + seq_len;
-        //std::cerr << "compact " << seqidx.nth_name(i) << " " << seqidx.nth_seq_length(i) << " " << j << " " << k << std::endl;
-        while (j < k) {
-            uint64_t overlap_count = 0;
-            uint64_t ovlp_start_in_q;
-            uint64_t ovlp_end_in_q;
-            pos_t pos_start_in_s;
-            path_iitree.overlap(
-                j, j+1,
-                [&](const uint64_t& start,
-                    const uint64_t& end,
-                    const pos_t& pos) {
-                    ++overlap_count;
-                    ovlp_start_in_q = start;
-                    ovlp_end_in_q = end;
-                    pos_start_in_s = pos;
-                });
+    // the ranges of path_iitree are sorted by their start in the input sequences, and each input base lies in one
+    uint64_t n_ranges = path_iitree.size();
+    paryfor::parallel_for<uint64_t>(
+        0, n_ranges, num_threads, 10000,
+        [&](uint64_t k) {
+            uint64_t ovlp_start_in_q = path_iitree.start(k);
+            uint64_t ovlp_end_in_q = path_iitree.end(k);
             // each input base should only map one place in the graph
-            if (overlap_count != 1) {
-                std::cerr << "[seqwish::compact] error: found " << overlap_count << " overlaps for seq " << seqidx.nth_name(i) << " idx " << i << " at j=" << j << " of " << k << std::endl;
-                path_iitree.overlap(
-                    j, j+1,
-                    [&](const uint64_t& start,
-                    const uint64_t& end,
-                    const pos_t& pos) {
-                        std::cerr << "ovlp_start_in_q = " << start << " "
-                                  << "ovlp_end_in_q = " << end << " "
-                                  << "pos_start_in_s = " << pos_to_string(pos) << std::endl;
-                    });
+            uint64_t expected_start = (k == 0 ? 0 : path_iitree.end(k-1));
+            if (ovlp_start_in_q != expected_start
+                || (k+1 == n_ranges && ovlp_end_in_q != seqidx.seq_length())) {
+                size_t i = seqidx.seq_id_at(std::min(ovlp_start_in_q, seqidx.seq_length()-1));
+                std::cerr << "[seqwish::compact] error: the graph ranges of seq " << seqidx.nth_name(i) << " idx " << i
+                          << " do not cover it once, found " << ovlp_start_in_q << "-" << ovlp_end_in_q
+                          << " where we expected a range from " << expected_start << std::endl;
                 assert(false);
                 exit(1);
             }
-
-            bool match_is_rev = is_rev(pos_start_in_s);
-            // mark a node start and end
-            pos_t pos_end_in_s = pos_start_in_s;
-            if (!match_is_rev) {
-                incr_pos(pos_end_in_s, ovlp_end_in_q - ovlp_start_in_q);
-                //std::cerr << "marking node+ start " << offset(pos_start_in_s) << " of " << seq_id_bv.size() << std::endl;
-                seq_id_abv.set(offset(pos_start_in_s));
-                //std::cerr << "marking node+ end " << offset(pos_end_in_s) << " of " << seq_id_bv.size() << std::endl;
-                seq_id_abv.set(offset(pos_end_in_s));
-            } else {
-                incr_pos(pos_end_in_s, ovlp_end_in_q - ovlp_start_in_q - 1);
-                //std::cerr << "marking node- start " << offset(pos_end_in_s) << " of " << seq_id_bv.size() << std::endl;
-                seq_id_abv.set(offset(pos_end_in_s));
-                //std::cerr << "marking node- end " << offset(pos_start_in_s) << " of " << seq_id_bv.size() << std::endl;
-                seq_id_abv.set(offset(pos_start_in_s)+1);
+        });
+    // each path range has a node range over the same bases of the graph, starting and ending a node
+    // cut the node ranges into blocks that start at different positions, each owning the graph from its first start to the next block's
+    uint64_t n_records = node_iitree.size();
+    std::vector<uint64_t> blocks = { 0 };
+    for (uint64_t k = compact_block_records; k < n_records; k += compact_block_records) {
+        k = std::max(k, blocks.back() + 1);
+        while (k < n_records && node_iitree.start(k) == node_iitree.start(k-1)) ++k;
+        if (k < n_records) blocks.push_back(k);
+    }
+    blocks.push_back(n_records);
+    uint64_t n_blocks = blocks.size() - 1;
+    auto block_begin = [&](const uint64_t& b) {
+        return b == 0 ? 0 : node_iitree.start(blocks[b]);
+    };
+    auto block_end = [&](const uint64_t& b) {
+        return b + 1 == n_blocks ? graph_size + 1 : node_iitree.start(blocks[b+1]);
+    };
+    // the sorted boundaries of a block, from its own ranges and the earlier ones that end in it
+    auto block_boundaries =
+        [&](const uint64_t& b, std::vector<uint64_t>& bounds) {
+            bounds.clear();
+            uint64_t begin = block_begin(b);
+            uint64_t end = block_end(b);
+            if (b == 0) bounds.push_back(0);
+            if (b + 1 == n_blocks) bounds.push_back(graph_size);
+            for (uint64_t k = blocks[b]; k < blocks[b+1]; ++k) {
+                bounds.push_back(node_iitree.start(k));
+                if (node_iitree.end(k) < end) bounds.push_back(node_iitree.end(k));
+            }
+            if (begin > 0) {
+                node_iitree.overlap(
+                    begin, begin + 1,
+                    [&](const uint64_t& start, const uint64_t& stop, const pos_t& pos) {
+                        if (start < begin && stop < end) bounds.push_back(stop);
+                    });
+            }
+            std::sort(bounds.begin(), bounds.end());
+            bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+        };
+    // count them first, as the sparse vector is built knowing how many bits it holds
+    std::vector<uint64_t> counts(n_blocks);
+    std::vector<std::vector<uint64_t>> lists(num_threads);
+    paryfor::parallel_for<uint64_t>(
+        0, n_blocks, num_threads, 1,
+        [&](uint64_t b, int tid) {
+            block_boundaries(b, lists[tid]);
+            counts[b] = lists[tid].size();
+        });
+    uint64_t n_bounds = 0;
+    for (auto& c : counts) n_bounds += c;
+    // then find them again a round of blocks at a time, writing each round in order
+    sdsl::sd_vector_builder builder(graph_size + 1, n_bounds);
+    for (uint64_t first = 0; first < n_blocks; first += num_threads) {
+        uint64_t last = std::min(n_blocks, first + num_threads);
+        paryfor::parallel_for<uint64_t>(
+            first, last, num_threads, 1,
+            [&](uint64_t b) {
+                block_boundaries(b, lists[b - first]);
+            });
+        for (uint64_t b = first; b < last; ++b) {
+            for (auto& p : lists[b - first]) {
+                builder.set(p);
             }
-            j = ovlp_end_in_q;
         }
-    };
-    paryfor::parallel_for<size_t>(1, num_seqs+1, num_threads, 10000, handle_seq);
-    //std::cerr << graph_size << " " << seq_id_bv.size() << std::endl;
-    seq_id_abv.set(graph_size);
-    // save our bitvector
-    for (auto p : seq_id_abv) {
-        seq_id_bv[p] = 1;
     }
+    sdsl::util::assign(seq_id_cbv, sdsl::sd_vector<>(builder));
 }
 
 }
@@ -2,7 +2,6 @@
 
 #include <vector>
 #include "sdsl/bit_vectors.hpp"
-#include "atomic_bitvector.hpp"
 #include "seqindex.hpp"
 #include "mmiitree.hpp"
 #include "pos.hpp"
@@ -10,13 +9,19 @@
 
 namespace seqwish {
 
+// the node records we read at once to find the node boundaries in their part of the graph
+const uint64_t compact_block_records = 1 << 20;
 
+// mark the start of every node in seq_id_cbv, which is graph_size+1 long with the end of the graph set
+// every range of the node and path trees starts and ends a node
+// the boundaries are found block by block along node_iitree, which is sorted by position in the graph,
+// and go straight into the sparse vector without a dense bitvector over the graph
 void compact_nodes(
     seqindex_t& seqidx,
     size_t graph_size,
     mmmulti::iitree<uint64_t, pos_t>& node_iitree,
     mmmulti::iitree<uint64_t, pos_t>& path_iitree,
-    sdsl::bit_vector& seq_id_bv,
+    sdsl::sd_vector<>& seq_id_cbv,
     uint64_t num_threads);
 
 }
@@ -0,0 +1,220 @@
+#include "compress.hpp"
+#include <zlib.h>
+#ifdef SEQWISH_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace seqwish {
+
+// the most that goes into one BGZF block, which must fit in 64KiB compressed
+const uint64_t bgzf_block_input = 0xff00;
+const uint64_t bgzf_block_max = 0x10000;
+const uint64_t bgzf_header_size = 18;
+const uint64_t bgzf_footer_size = 8;
+// the empty block that ends a BGZF file
+const char bgzf_eof[28] = {
+    '\x1f', '\x8b', '\x08', '\x04', '\x00', '\x00', '\x00', '\x00', '\x00', '\xff', '\x06', '\x00', '\x42', '\x43',
+    '\x02', '\x00', '\x1b', '\x00', '\x03', '\x00', '\x00', '\x00', '\x00', '\x00', '\x00', '\x00', '\x00', '\x00' };
+
+bool has_suffix(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+compression_t compression_for(const std::string& filename) {
+    if (has_suffix(filename, ".gz") || has_suffix(filename, ".bgz")) {
+        return compression_t::bgzf;
+    } else if (has_suffix(filename, ".zst")) {
+        return compression_t::zstd;
+    }
+    return compression_t::none;
+}
+
+bool compression_available(const compression_t& compression) {
+#ifdef SEQWISH_HAVE_ZSTD
+    return true;
+#else
+    return compression != compression_t::zstd;
+#endif
+}
+
+void write_fully(const int& fd, const char* data, uint64_t len) {
+    while (len) {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "[seqwish::compress] error: could not write output: " << strerror(errno) << std::endl;
+            exit(1);
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+void put_le(std::string& s, uint64_t v, const uint64_t& bytes) {
+    for (uint64_t i = 0; i < bytes; ++i) {
+        s.push_back((char)(v & 0xff));
+        v >>= 8;
+    }
+}
+
+block_compressor_t::block_compressor_t(const int& out_fd, const compression_t& compression, const uint64_t& num_threads)
+    : fd(out_fd), format(compression) {
+    if (!compression_available(format)) {
+        std::cerr << "[seqwish::compress] error: this build of seqwish can't write zstd, it was built without libzstd" << std::endl;
+        exit(1);
+    }
+    in_flight.store(0);
+    max_in_flight = std::min((uint64_t)32, 2 * std::max((uint64_t)1, num_threads) + 2);
+    todo = std::make_unique<job_queue_t>();
+    ordered = std::make_unique<job_queue_t>();
+    for (uint64_t t = 0; t < std::max((uint64_t)1, num_threads); ++t) {
+        workers.emplace_back(
+            [this](void) {
+                job_t* job;
+                while ((job = pop(*todo)) != nullptr) {
+                    compress_job(*job);
+                    job->done.store(true);
+                    waiter.notify();
+                }
+            });
+    }
+    writer = std::thread([this](void) { write_jobs(); });
+}
+
+block_compressor_t::~block_compressor_t(void) {
+    finish();
+}
+
+void block_compressor_t::push(job_queue_t& queue, job_t* job) {
+    backoff_t idle(waiter);
+    while (!queue.try_push(job)) {
+        idle.wait();
+    }
+    waiter.notify();
+}
+
+block_compressor_t::job_t* block_compressor_t::pop(job_queue_t& queue) {
+    backoff_t idle(waiter);
+    job_t* job;
+    while (!queue.try_pop(job)) {
+        idle.wait();
+    }
+    waiter.notify();
+    return job;
+}
+
+void block_compressor_t::compress(const char* data, const uint64_t& len) {
+    if (len == 0) return;
+    {
+        backoff_t idle(waiter);
+        while (in_flight.load() >= max_in_flight) {
+            idle.wait();
+        }
+    }
+    ++in_flight;
+    job_t* job = new job_t;
+    job->in.assign(data, len);
+    job->done.store(false);
+    // the writer must see the job first, so that it never waits on one that a full queue keeps from the workers
+    push(*ordered, job);
+    push(*todo, job);
+}
+
+void block_compressor_t::compress_job(job_t& job) const {
+    if (format == compression_t::bgzf) {
+        // one BGZF block for each piece of the input that fits in one
+        job.out.reserve(job.in.size() + job.in.size() / 64 + bgzf_block_max);
+        for (uint64_t b = 0; b < job.in.size(); b += bgzf_block_input) {
+            uint64_t len = std::min(bgzf_block_input, job.in.size() - b);
+            uint64_t start = job.out.size();
+            job.out.resize(start + bgzf_block_max);
+            char* block = &job.out[start];
+            z_stream zs;
+            memset(&zs, 0, sizeof(zs));
+            if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                std::cerr << "[seqwish::compress] error: could not start a deflate stream" << std::endl;
+                exit(1);
+            }
+            zs.next_in = (Bytef*)&job.in[b];
+            zs.avail_in = len;
+            zs.next_out = (Bytef*)block + bgzf_header_size;
+            zs.avail_out = bgzf_block_max - bgzf_header_size - bgzf_footer_size;
+            if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+                std::cerr << "[seqwish::compress] error: a BGZF block did not fit in 64KiB" << std::endl;
+                exit(1);
+            }
+            uint64_t compressed = zs.total_out;
+            deflateEnd(&zs);
+            uint64_t block_size = bgzf_header_size + compressed + bgzf_footer_size;
+            std::string header;
+            header.append("\x1f\x8b\x08\x04\x00\x00\x00\x00\x00\xff\x06\x00\x42\x43\x02\x00", 16);
+            put_le(header, block_size - 1, 2);
+            memcpy(block, header.data(), bgzf_header_size);
+            std::string footer;
+            put_le(footer, crc32(crc32(0L, Z_NULL, 0), (const Bytef*)&job.in[b], len), 4);
+            put_le(footer, len, 4);
+            memcpy(block + bgzf_header_size + compressed, footer.data(), bgzf_footer_size);
+            job.out.resize(start + block_size);
+        }
+    } else if (format == compression_t::zstd) {
+#ifdef SEQWISH_HAVE_ZSTD
+        job.out.resize(ZSTD_compressBound(job.in.size()));
+        size_t n = ZSTD_compress(&job.out[0], job.out.size(), job.in.data(), job.in.size(), ZSTD_CLEVEL_DEFAULT);
+        if (ZSTD_isError(n)) {
+            std::cerr << "[seqwish::compress] error: zstd failed: " << ZSTD_getErrorName(n) << std::endl;
+            exit(1);
+        }
+        job.out.resize(n);
+#endif
+    } else {
+        job.out = job.in;
+    }
+}
+
+void block_compressor_t::write_jobs(void) {
+    job_t* job;
+    while ((job = pop(*ordered)) != nullptr) {
+        backoff_t idle(waiter);
+        while (!job->done.load()) {
+            idle.wait();
+        }
+        write_fully(fd, job->out.data(), job->out.size());
+        if (format == compression_t::zstd) {
+            frames.push_back(std::make_pair((uint32_t)job->out.size(), (uint32_t)job->in.size()));
+        }
+        delete job;
+        --in_flight;
+        waiter.notify();
+    }
+}
+
+void block_compressor_t::finish(void) {
+    if (finished) return;
+    finished = true;
+    push(*ordered, nullptr);
+    writer.join();
+    for (uint64_t t = 0; t < workers.size(); ++t) {
+        push(*todo, nullptr);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    if (format == compression_t::bgzf) {
+        write_fully(fd, bgzf_eof, sizeof(bgzf_eof));
+    } else if (format == compression_t::zstd) {
+        // a skippable frame that other readers pass over
+        std::string table;
+        put_le(table, 0x184D2A5E, 4);
+        put_le(table, frames.size() * 8 + 9, 4);
+        for (auto& f : frames) {
+            put_le(table, f.first, 4);
+            put_le(table, f.second, 4);
+        }
+        put_le(table, frames.size(), 4);
+        table.push_back('\0'); // no checksums
+        put_le(table, 0x8F92EAB1, 4);
+        write_fully(fd, table.data(), table.size());
+    }
+}
+
+}
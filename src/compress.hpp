@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <unistd.h>
+#include "atomic_queue.h"
+#include "backoff.hpp"
+
+namespace seqwish {
+
+/*
+Compressed output. Blocks of text are compressed by a pool of threads while
+we keep producing more, and a writer thread puts them out in order. Every
+block becomes independent members, so readers can seek. For .gz that means
+BGZF, as written by bgzip. For .zst we write one frame per block and close
+with the seek table of the zstd seekable format. zstd needs the library at
+build time (SEQWISH_HAVE_ZSTD).
+*/
+
+enum class compression_t { none, bgzf, zstd };
+
+// the compression implied by a file name's suffix
+compression_t compression_for(const std::string& filename);
+
+// whether this build can write the given compression
+bool compression_available(const compression_t& compression);
+
+// write all of len bytes from data, exiting on failure
+void write_fully(const int& fd, const char* data, uint64_t len);
+
+class block_compressor_t {
+public:
+    block_compressor_t(const int& out_fd, const compression_t& compression, const uint64_t& num_threads);
+    ~block_compressor_t(void);
+    // queue a copy of the data as the next block, to be called from one thread
+    void compress(const char* data, const uint64_t& len);
+    // write out all the blocks and the end of the file
+    void finish(void);
+
+private:
+    struct job_t {
+        std::string in;
+        std::string out;
+        std::atomic<bool> done;
+    };
+    typedef atomic_queue::AtomicQueue2<job_t*, 64> job_queue_t;
+    int fd;
+    compression_t format;
+    bool finished = false;
+    // blocks queued but not yet written, which we keep to a few per thread
+    std::atomic<uint64_t> in_flight;
+    uint64_t max_in_flight;
+    std::unique_ptr<job_queue_t> todo;
+    std::unique_ptr<job_queue_t> ordered; // the jobs in the order in which we write them
+    waiter_t waiter;
+    std::vector<std::thread> workers;
+    std::thread writer;
+    // the compressed and uncompressed size of each zstd frame, for the seek table
+    std::vector<std::pair<uint32_t, uint32_t>> frames;
+
+    void push(job_queue_t& queue, job_t* job);
+    job_t* pop(job_queue_t& queue);
+    void compress_job(job_t& job) const;
+    void write_jobs(void);
+};
+
+}
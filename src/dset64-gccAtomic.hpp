@@ -99,6 +99,69 @@ public:
         return id;
     }
 
+    // Point every element in [begin, end) straight at its root, so that parent()
+    // then gives its set. Meant for reading out the sets once no unite() is
+    // running, from many threads over disjoint ranges. A group of paths is walked
+    // in lockstep, prefetching the next parent of each, so that their cache
+    // misses overlap rather than following one another. Each step points the
+    // element it leaves at its grandparent (path splitting).
+    void find_all(uint64_t begin, uint64_t end) {
+        const uint64_t lanes = 16;
+        uint64_t elem[lanes];
+        uint64_t cur[lanes];
+        Aint value[lanes];
+        uint64_t next = begin;
+        // start the lane on the next element that isn't a root
+        auto start = [&](uint64_t l) {
+            while (next < end) {
+                uint64_t id = next++;
+                Aint v = mData[id];
+                if ((uint64_t) v != id) {
+                    elem[l] = id;
+                    cur[l] = id;
+                    value[l] = v;
+                    __builtin_prefetch(&mData[(uint64_t) v]);
+                    return true;
+                }
+            }
+            return false;
+        };
+        uint64_t active = 0;
+        while (active < lanes && start(active))
+            ++active;
+        while (active) {
+            for (uint64_t l = 0; l < active; ) {
+                uint64_t p = (uint64_t) value[l];
+                Aint parent_value = mData[p];
+                uint64_t grandparent = (uint64_t) parent_value;
+                if (grandparent != p) {
+                    __sync_bool_compare_and_swap(&mData[cur[l]], value[l],
+                                                 (value[l] & rankMask) | grandparent);
+                    cur[l] = p;
+                    value[l] = parent_value;
+                    __builtin_prefetch(&mData[grandparent]);
+                    ++l;
+                    continue;
+                }
+                // p is the root, other threads only ever move our parent up towards it
+                for (;;) {
+                    Aint v = mData[elem[l]];
+                    if ((uint64_t) v == p ||
+                        __sync_bool_compare_and_swap(&mData[elem[l]], v, (v & rankMask) | p))
+                        break;
+                }
+                if (start(l)) {
+                    ++l;
+                } else {
+                    --active;
+                    elem[l] = elem[active];
+                    cur[l] = cur[active];
+                    value[l] = value[active];
+                }
+            }
+        }
+    }
+
     bool same(uint64_t id1, uint64_t id2) const {
         for (;;) {
             id1 = find(id1);
@@ -1,4 +1,7 @@
 #include "exists.hpp"
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
 
 namespace seqwish {
 
@@ -7,4 +10,25 @@ bool file_exists(const std::string& name) {
     return (stat (name.c_str(), &buffer) == 0); 
 }
 
+bool is_regular_file(const std::string& name) {
+    struct stat buffer;
+    return stat(name.c_str(), &buffer) == 0 && S_ISREG(buffer.st_mode);
+}
+
+std::string file_identity(const std::vector<std::string>& filenames) {
+    std::stringstream key;
+    for (auto& filename : filenames) {
+        struct stat stats;
+        char* path = realpath(filename.c_str(), nullptr);
+        if (path == nullptr || stat(path, &stats) == -1 || !S_ISREG(stats.st_mode)) {
+            key << filename << "\n";
+            free(path);
+            continue;
+        }
+        key << path << "\t" << stats.st_size << "\t" << stats.st_mtim.tv_sec << "." << stats.st_mtim.tv_nsec << "\n";
+        free(path);
+    }
+    return key.str();
+}
+
 }
@@ -2,12 +2,20 @@
 #define EXISTS_HPP_INCLUDED
 
 #include <string>
+#include <vector>
 #include <sys/stat.h>
 
 namespace seqwish {
 
 bool file_exists(const std::string& name);
 
+// if the name is that of a regular file, unlike a pipe, which we can read only once
+bool is_regular_file(const std::string& name);
+
+// the full paths, sizes and modification times of the files, by which we know they haven't changed
+// what isn't a regular file can't be known again, and is given by its name alone
+std::string file_identity(const std::vector<std::string>& filenames);
+
 }
 
 #endif
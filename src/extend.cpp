@@ -0,0 +1,198 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include "extend.hpp"
+#include "iitree_index.hpp"
+#include "checkpoint.hpp"
+#include "flat_hash_map.hpp"
+#include "sdsl/bit_vectors.hpp"
+#include "time.hpp"
+
+namespace seqwish {
+
+void base_graph_t::open(const std::string& base_dir, const seqindex_t& seqidx) {
+    dir = base_dir;
+    uint64_t length = 0;
+    if (!checkpointed_step(dir, "transclosure", length)) {
+        std::cerr << "[seqwish::extend] error: " << dir << " does not hold the checkpoint of a run that completed its transitive closure" << std::endl;
+        exit(1);
+    }
+    graph_length = length;
+    seq_v_file = checkpoint_file(dir, "transclosure", ".sqs");
+    node_iitree_file = checkpoint_file(dir, "transclosure", ".sqn");
+    path_iitree_file = checkpoint_file(dir, "transclosure", ".sqp");
+    // its sequences must be the first of ours, in the same order
+    seqindex_t base_seqidx;
+    base_seqidx.load(checkpoint_file(dir, "seqidx", ".sqq"), checkpoint_file(dir, "seqidx", ".sqi"));
+    n_seqs = base_seqidx.n_seqs();
+    q_length = base_seqidx.seq_length();
+    if (n_seqs > seqidx.n_seqs()) {
+        std::cerr << "[seqwish::extend] error: the graph in " << dir << " has " << n_seqs << " sequences, more than the " << seqidx.n_seqs() << " we were given" << std::endl;
+        exit(1);
+    }
+    for (uint64_t i = 1; i <= n_seqs; ++i) {
+        if (base_seqidx.nth_name(i) != seqidx.nth_name(i) || base_seqidx.nth_seq_length(i) != seqidx.nth_seq_length(i)) {
+            std::cerr << "[seqwish::extend] error: sequence " << i << " of the graph in " << dir << " is " << base_seqidx.nth_name(i)
+                      << ", not " << seqidx.nth_name(i) << ", the input must start with the sequences of the graph" << std::endl;
+            exit(1);
+        }
+    }
+}
+
+size_t extend_transitive_closures(
+    const seqindex_t& seqidx,
+    const base_graph_t& base,
+    mmmulti::iitree<uint64_t, pos_t>& aln_iitree,
+    const std::string& seq_v_file,
+    mmmulti::iitree<uint64_t, pos_t>& node_iitree,
+    mmmulti::iitree<uint64_t, pos_t>& path_iitree,
+    bool show_progress,
+    uint64_t num_threads,
+    const std::chrono::time_point<std::chrono::steady_clock>& start_time) {
+    auto base_nodes = std::make_unique<mmmulti::iitree<uint64_t, pos_t>>(base.node_iitree_file);
+    auto base_paths = std::make_unique<mmmulti::iitree<uint64_t, pos_t>>(base.path_iitree_file);
+    index_together(*base_nodes, *base_paths, num_threads);
+
+    // the old graph comes first, as it was
+    std::ofstream seq_v_out(seq_v_file.c_str(), std::ios::binary);
+    if (base.graph_length) {
+        std::ifstream seq_in(base.seq_v_file.c_str(), std::ios::binary);
+        seq_v_out << seq_in.rdbuf();
+    }
+    if ((uint64_t)seq_v_out.tellp() != base.graph_length) {
+        std::cerr << "[seqwish::extend] error: the graph sequence in " << base.dir << " is not " << base.graph_length << "bp long" << std::endl;
+        exit(1);
+    }
+    node_iitree.open_writer();
+    path_iitree.open_writer();
+    for (uint64_t k = 0; k < base_nodes->size(); ++k) {
+        node_iitree.add(base_nodes->start(k), base_nodes->end(k), base_nodes->data(k));
+    }
+    for (uint64_t k = 0; k < base_paths->size(); ++k) {
+        path_iitree.add(base_paths->start(k), base_paths->end(k), base_paths->data(k));
+    }
+    if (show_progress) std::cerr << "[seqwish::extend] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " copied the graph of " << base.graph_length << "bp in " << base.dir << std::endl;
+
+    // the new bases are closed one set at a time, walking out from the first base of each that we haven't closed
+    // the orientation of every base we reach is kept relative to that first base
+    const uint64_t q_begin = base.q_length;
+    const uint64_t q_end = seqidx.seq_length();
+    std::vector<pos_t> q_to_s(q_end - q_begin); // where each new base goes in S
+    sdsl::bit_vector seen(q_end - q_begin);
+    size_t graph_length = base.graph_length;
+    std::string seq_out;
+    std::vector<pos_t> todo;
+    std::vector<pos_t> closed; // the new bases of the current set
+    ska::flat_hash_map<uint64_t, bool> old_seen; // the old bases of the current set
+    ska::flat_hash_map<uint64_t, bool> old_s; // and the positions of S they were closed into
+    uint64_t n_joined = 0;
+    uint64_t n_unmerged = 0;
+    auto reach = [&](const pos_t& p) {
+        uint64_t q = offset(p);
+        if (q >= q_begin) {
+            if (!seen[q - q_begin]) {
+                seen[q - q_begin] = 1;
+                todo.push_back(p);
+            }
+        } else if (old_seen.find(q) == old_seen.end()) {
+            old_seen[q] = is_rev(p);
+            todo.push_back(p);
+        }
+    };
+    for (uint64_t seed = q_begin; seed < q_end; ++seed) {
+        if (seen[seed - q_begin]) continue;
+        reach(make_pos_t(seed, false));
+        while (!todo.empty()) {
+            pos_t p = todo.back();
+            todo.pop_back();
+            uint64_t q = offset(p);
+            aln_iitree.overlap(
+                q, q + 1,
+                [&](const uint64_t& start, const uint64_t& end, const pos_t& pos) {
+                    pos_t t = pos;
+                    incr_pos(t, q - start);
+                    reach(make_pos_t(offset(t), is_rev(t) != is_rev(p)));
+                });
+            if (q >= q_begin) {
+                closed.push_back(p);
+                continue;
+            }
+            // an old base brings in everything closed with it
+            base_paths->overlap(
+                q, q + 1,
+                [&](const uint64_t& start, const uint64_t& end, const pos_t& pos) {
+                    pos_t s = pos;
+                    incr_pos(s, q - start);
+                    bool s_rev = is_rev(s) != is_rev(p);
+                    if (old_s.find(offset(s)) != old_s.end()) return;
+                    old_s[offset(s)] = s_rev;
+                    base_nodes->overlap(
+                        offset(s), offset(s) + 1,
+                        [&](const uint64_t& n_start, const uint64_t& n_end, const pos_t& n_pos) {
+                            pos_t m = n_pos;
+                            incr_pos(m, offset(s) - n_start);
+                            reach(make_pos_t(offset(m), is_rev(m) != s_rev));
+                        });
+                });
+        }
+        uint64_t s_pos;
+        bool s_rev = false;
+        if (old_s.empty()) {
+            s_pos = graph_length++;
+            seq_out.push_back(seqidx.at(seed));
+        } else {
+            // join the first of the old positions
+            auto first = old_s.begin();
+            for (auto it = old_s.begin(); it != old_s.end(); ++it) {
+                if (it->first < first->first) first = it;
+            }
+            s_pos = first->first;
+            s_rev = first->second;
+            ++n_joined;
+            n_unmerged += old_s.size() - 1;
+        }
+        for (auto& p : closed) {
+            q_to_s[offset(p) - q_begin] = make_pos_t(s_pos, is_rev(p) != s_rev);
+        }
+        closed.clear();
+        old_seen.clear();
+        old_s.clear();
+    }
+    seq_v_out << seq_out;
+    seq_v_out.close();
+
+    // runs of new bases that step through S together become the ranges of the node and path trees
+    uint64_t i = q_begin;
+    while (i < q_end) {
+        pos_t first = q_to_s[i - q_begin];
+        pos_t next = first;
+        incr_pos(next);
+        uint64_t j = i + 1;
+        while (j < q_end && !seqidx.seq_start(j) && q_to_s[j - q_begin] == next) {
+            incr_pos(next);
+            ++j;
+        }
+        path_iitree.add(i, j, first);
+        if (!is_rev(first)) {
+            node_iitree.add(offset(first), offset(first) + (j - i), make_pos_t(i, false));
+        } else {
+            node_iitree.add(offset(first) + 1 - (j - i), offset(first) + 1, make_pos_t(j - 1, true));
+        }
+        i = j;
+    }
+    node_iitree.close_writer();
+    path_iitree.close_writer();
+    index_together(node_iitree, path_iitree, num_threads);
+    if (show_progress) {
+        std::cerr << "[seqwish::extend] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " closed " << q_end - q_begin << " new bases, "
+                  << n_joined << " sets joining the old graph and " << graph_length - base.graph_length << " adding to it" << std::endl;
+    }
+    if (n_unmerged) {
+        std::cerr << "[seqwish::extend] warning: the new alignments close together " << n_unmerged
+                  << " positions of the old graph with others, which stay apart, run the whole input again to merge them" << std::endl;
+    }
+    return graph_length;
+}
+
+}
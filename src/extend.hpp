@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include "seqindex.hpp"
+#include "mmiitree.hpp"
+#include "pos.hpp"
+
+namespace seqwish {
+
+/*
+A graph can be extended with new sequences without closing the old ones
+again. The earlier run's checkpoint directory keeps its sequence index and its
+closure, S with the node and path interval trees. Our Q is the earlier Q with
+the new sequences after it, and our alignments are those of the new sequences.
+Each closed set of new bases reaches the old bases that they align to, and
+through the nodes of S every other old base closed with those, and so can be
+closed without touching the rest of the old graph. A set that holds old bases
+joins the S position they were closed into, one that doesn't is added to the
+end of S, in the order of its first base in Q.
+
+The old graph is kept as it is, so where the new alignments would close
+together old bases of two positions of S the new bases join only the first of
+these, and the old positions stay apart.
+*/
+
+// the graph of an earlier run that we extend, as checkpointed in its directory
+struct base_graph_t {
+    std::string dir;
+    uint64_t n_seqs = 0;
+    uint64_t q_length = 0; // of its Q, the start of the new sequences in ours
+    size_t graph_length = 0;
+    std::string seq_v_file;
+    std::string node_iitree_file;
+    std::string path_iitree_file;
+    // check that the earlier run completed its closure, over the first sequences of ours
+    void open(const std::string& dir, const seqindex_t& seqidx);
+};
+
+// copy the earlier closure and add the new bases of Q to it, returning the graph length
+size_t extend_transitive_closures(
+    const seqindex_t& seqidx,
+    const base_graph_t& base,
+    mmmulti::iitree<uint64_t, pos_t>& aln_iitree, // the alignments of the new sequences
+    const std::string& seq_v_file,
+    mmmulti::iitree<uint64_t, pos_t>& node_iitree,
+    mmmulti::iitree<uint64_t, pos_t>& path_iitree,
+    bool show_progress,
+    uint64_t num_threads,
+    const std::chrono::time_point<std::chrono::steady_clock>& start_time);
+
+}
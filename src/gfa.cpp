@@ -1,10 +1,172 @@
 #include "gfa.hpp"
+#include "steps.hpp"
 
 namespace seqwish {
 
-using namespace std::chrono_literals;
+validate_mode_t parse_validate_mode(const std::string& mode) {
+    if (mode == "none") {
+        return validate_mode_t::none;
+    } else if (mode == "sampled") {
+        return validate_mode_t::sampled;
+    } else if (mode == "full") {
+        return validate_mode_t::full;
+    }
+    std::cerr << "[seqwish::gfa] error: unknown validation mode " << mode << ", expected none, sampled or full" << std::endl;
+    exit(1);
+}
 
-void emit_gfa(std::ostream& out,
+void format_in_order(const uint64_t& n_items,
+                     const uint64_t& num_threads,
+                     const std::function<void(const uint64_t&, std::string&)>& format,
+                     const std::function<void(const uint64_t&, const std::string&)>& write) {
+    // a window of items is formatted by the workers while a writer thread writes out the last one
+    const uint64_t window = std::max((uint64_t)1, num_threads) * 4;
+    std::vector<std::string> bufs[2] = { std::vector<std::string>(window), std::vector<std::string>(window) };
+    std::thread writer;
+    for (uint64_t b = 0, w = 0; b < n_items; b += window, ++w) {
+        uint64_t e = std::min(n_items, b + window);
+        auto& curr = bufs[w % 2];
+        paryfor::parallel_for<uint64_t>(
+            b, e, num_threads, 1,
+            [&](uint64_t i, int tid) {
+                curr[i-b].clear();
+                format(i, curr[i-b]);
+            });
+        if (writer.joinable()) writer.join();
+        writer = std::thread(
+            [&, b, e]() {
+                for (uint64_t i = b; i < e; ++i) {
+                    write(i, curr[i-b]);
+                }
+            });
+    }
+    if (writer.joinable()) writer.join();
+}
+
+std::vector<path_piece_t> path_pieces(const seqindex_t& seqidx) {
+    std::vector<path_piece_t> pieces;
+    for (size_t i = 1; i <= seqidx.n_seqs(); ++i) {
+        size_t j = seqidx.nth_seq_offset(i);
+        size_t k = j + seqidx.nth_seq_length(i);
+        do {
+            size_t e = std::min(k, j + path_piece_length);
+            pieces.push_back({i, j, e, j == seqidx.nth_seq_offset(i), e == k});
+            j = e;
+        } while (j < k);
+    }
+    return pieces;
+}
+
+void walk_path_piece(const path_piece_t& piece,
+                     mmmulti::iitree<uint64_t, pos_t>& path_iitree,
+                     const sdsl::sd_vector<>& seq_id_cbv,
+                     const sdsl::sd_vector<>::rank_1_type& seq_id_cbv_rank,
+                     const sdsl::sd_vector<>::select_1_type& seq_id_cbv_select,
+                     const seqindex_t& seqidx,
+                     const char* seq_v_buf,
+                     const validate_mode_t& validate,
+                     std::vector<pos_t>& steps) {
+    size_t i = piece.seq;
+    size_t j = piece.start;
+    size_t k = piece.end;
+    // the ranges of the path follow one another in path_iitree, so we find the first and step through the rest
+    iitree_cursor_t cursor(path_iitree);
+    cursor.seek(j);
+    while (j < k) {
+        // each input base should only map one place in the graph
+        if (!cursor.contains(j) || (cursor.index() && path_iitree.end(cursor.index()-1) > j)) {
+            std::cerr << "[seqwish::gfa] error: found no single range for seq " << seqidx.nth_name(i) << " idx " << i << " at j=" << j << " of " << k << std::endl;
+            path_iitree.overlap(
+                j, j+1,
+                [&](const uint64_t& start,
+                const uint64_t& end,
+                const pos_t& pos) {
+                    std::cerr << "ovlp_start_in_q = " << start << " "
+                              << "ovlp_end_in_q = " << end << " "
+                              << "pos_start_in_s = " << pos_to_string(pos) << std::endl;
+                });
+            assert(false);
+            exit(1);
+        }
+        uint64_t ovlp_start_in_q = cursor.start();
+        uint64_t ovlp_end_in_q = cursor.end();
+        pos_t pos_start_in_s = cursor.pos();
+        cursor.next();
+        if (piece.last && ovlp_end_in_q > k) {
+            size_t seq_offset = seqidx.nth_seq_offset(i);
+            std::cerr << "length for " << seqidx.nth_name(i) << ", expected " << seqidx.nth_seq_length(i) << " but got " << ovlp_end_in_q - seq_offset << std::endl;
+            assert(false);
+            exit(1); // for release builds
+        }
+        bool match_is_rev = is_rev(pos_start_in_s);
+        // the part of this range that lies in our piece
+        uint64_t length = std::min((uint64_t)k, ovlp_end_in_q) - j;
+        pos_t p = pos_start_in_s;
+        incr_pos(p, j - ovlp_start_in_q);
+        // step from node start to node start through the bases of the range in the graph
+        uint64_t s_pos = offset(p);
+        if (!match_is_rev) {
+            // we walk forward through [s_pos, s_pos+length)
+            uint64_t r = seq_id_cbv_rank(s_pos);
+            while (seq_id_cbv_select(r+1) < s_pos + length) {
+                steps.push_back(make_pos_t(++r, false));
+            }
+        } else {
+            // we walk backward from s_pos to s_pos-length+1
+            uint64_t r = seq_id_cbv_rank(s_pos+1);
+            while (r && seq_id_cbv_select(r) + length > s_pos) {
+                steps.push_back(make_pos_t(r--, true));
+            }
+        }
+        // check that the input sequence we're processing matches the graph
+        // either for each base in the range, or for one base in it picked by a hash of where we are
+        uint64_t check_begin = 0;
+        uint64_t check_end = 0;
+        if (validate == validate_mode_t::full) {
+            check_end = length;
+        } else if (validate == validate_mode_t::sampled) {
+            check_begin = wang_hash_64(j) % length;
+            check_end = check_begin + 1;
+        }
+        pos_t q = make_pos_t(j + check_begin, false);
+        incr_pos(p, check_begin);
+        for (uint64_t x = check_begin; x < check_end; ++x) {
+            char c = seq_v_buf[offset(p)];
+            if (is_rev(p)) c = dna_reverse_complement(c);
+            if (seqidx.at_pos(q) != c) {
+                std::cerr << "GRAPH BROKEN @ "
+                    << seqidx.nth_name(i) << " " << pos_to_string(q) << " -> "
+                    << pos_to_string(q) << std::endl;
+                assert(false);
+                exit(1); // for release builds
+            }
+            incr_pos(p, 1);
+            incr_pos(q, 1);
+        }
+        j += length;
+    }
+}
+
+void get_piece_steps(const uint64_t& i,
+                     const std::vector<path_piece_t>& pieces,
+                     const path_steps_t* path_steps,
+                     mmmulti::iitree<uint64_t, pos_t>& path_iitree,
+                     const sdsl::sd_vector<>& seq_id_cbv,
+                     const sdsl::sd_vector<>::rank_1_type& seq_id_cbv_rank,
+                     const sdsl::sd_vector<>::select_1_type& seq_id_cbv_select,
+                     const seqindex_t& seqidx,
+                     const char* seq_v_buf,
+                     const validate_mode_t& validate,
+                     std::vector<pos_t>& steps) {
+    if (path_steps) {
+        // these were checked as they were built
+        path_steps->piece_steps(i, steps);
+    } else {
+        walk_path_piece(pieces[i], path_iitree, seq_id_cbv, seq_id_cbv_rank, seq_id_cbv_select, seqidx, seq_v_buf, validate, steps);
+    }
+}
+
+void emit_gfa(buffered_writer_t& out,
               size_t graph_length,
               const std::string& seq_v_file,
               mmmulti::iitree<uint64_t, pos_t>& node_iitree,
@@ -14,9 +176,11 @@ void emit_gfa(std::ostream& out,
               const sdsl::sd_vector<>::select_1_type& seq_id_cbv_select,
               seqindex_t& seqidx,
               mmmulti::set<std::pair<pos_t, pos_t>>& link_mmset,
-              const uint64_t& num_threads) {
+              const validate_mode_t& validate,
+              const uint64_t& num_threads,
+              const path_steps_t* path_steps) {
 
-    out << "H" << "\t" << "VN:Z:1.0" << std::endl;
+    out.write("H\tVN:Z:1.0\n");
     int seq_v_fd = -1;
     char* seq_v_buf = nullptr;
     size_t seq_v_filesize = mmap_open(seq_v_file, seq_v_buf, seq_v_fd);
@@ -25,180 +189,86 @@ void emit_gfa(std::ostream& out,
 
     // write the nodes
     // these are delimited in the seq_v_file by the markers in seq_id_civ
-
+    // each chunk of the graph sequence has its nodes formatted straight out of the mmapped file
     uint64_t n_nodes = seq_id_cbv_rank(seq_id_cbv.size()-1);
-
-    // producer/consumer queues
-    auto seq_todo_q_ptr = std::make_unique<atomic_queue::AtomicQueue2<uint64_t, 2 << 16>>();
-    auto& seq_todo_q = *seq_todo_q_ptr;
-    auto seq_done_q_ptr = std::make_unique<atomic_queue::AtomicQueue2<std::pair<uint64_t, std::string*>, 2 << 16>>();
-    auto& seq_done_q = *seq_done_q_ptr;
-    std::atomic<bool> work_todo;
-    std::map<uint64_t, std::string*> node_records;
-
-    auto worker_lambda =
-        [&](void) {
-            uint64_t id = 0;
-            while (work_todo.load()) {
-                if (seq_todo_q.try_pop(id)) {
-                    //std::stringstream s;
-                    size_t node_start = seq_id_cbv_select(id);
-                    //size_t node_length = (id==n_nodes ? seq_id_cbv.size() : seq_id_cbv_select(id+1)) - node_start;
-                    size_t node_length = seq_id_cbv_select(id+1) - node_start;
-                    //std::cerr << id << " "  << node_start << " " << node_length << std::endl;
-                    std::string* seq = new std::string;
-                    seq->resize(node_length);
-                    memcpy((void*)seq->c_str(), &seq_v_buf[node_start], node_length);
-                    seq_done_q.push(std::make_pair(id, seq));
-                } else {
-                    std::this_thread::sleep_for(0.00001ns);
-                }
+    uint64_t n_node_chunks = graph_length / node_chunk_length + 1;
+    format_in_order(
+        n_node_chunks, num_threads,
+        [&](const uint64_t& c, std::string& buf) {
+            // the nodes that start in this chunk
+            uint64_t first_id = seq_id_cbv_rank(std::min(graph_length, c * node_chunk_length)) + 1;
+            uint64_t last_id = std::min(n_nodes, (uint64_t)seq_id_cbv_rank(std::min(graph_length, (c + 1) * node_chunk_length)));
+            if (first_id > last_id) return;
+            uint64_t node_start = seq_id_cbv_select(first_id);
+            uint64_t chunk_end = seq_id_cbv_select(last_id + 1);
+            buf.reserve((chunk_end - node_start) + (last_id - first_id + 1) * 24);
+            for (uint64_t id = first_id; id <= last_id; ++id) {
+                uint64_t node_end = seq_id_cbv_select(id + 1);
+                buf.append("S\t", 2);
+                append_uint(buf, id);
+                buf.push_back('\t');
+                buf.append(&seq_v_buf[node_start], node_end - node_start);
+                buf.push_back('\n');
+                node_start = node_end;
             }
-        };
-
-    std::vector<std::thread> workers; workers.reserve(num_threads);
-    work_todo.store(true);
-    for (uint64_t t = 0; t < num_threads; ++t) {
-        workers.emplace_back(worker_lambda);
-    }
-    uint64_t todo_id = 1;
-    uint64_t done_id = 0;
-    while (done_id < n_nodes) {
-        // put ids in todo
-        while (todo_id <= n_nodes && seq_todo_q.try_push(todo_id)) {
-            ++todo_id;
-        }
-        // read from done queue
-        std::pair<uint64_t, std::string*> item;
-        while (seq_done_q.try_pop(item)) {
-            node_records[item.first] = item.second;
-        }
-        if (node_records.size()) {
-            auto b = node_records.begin();
-            if (b->first == done_id+1) {
-                //out << node_records.begin()->second << std::endl;
-                out << "S" << "\t" << b->first << "\t" << *b->second << "\n";
-                ++done_id;
-                delete b->second;
-                node_records.erase(b);
-            }
-        }
-    }
-    work_todo.store(false);
-    for (uint64_t t = 0; t < num_threads; ++t) {
-        workers[t].join();
-    }
+        },
+        [&](const uint64_t& c, const std::string& buf) {
+            out.write(buf);
+        });
 
     auto print_link = [&out](const std::pair<pos_t, pos_t>& p) {
         auto& from = p.first;
         auto& to = p.second;
         if (from && to) {
-            out << "L" << "\t"
-                << offset(from) << "\t" << (is_rev(from)?"-":"+") << "\t"
-                << offset(to) << "\t" << (is_rev(to)?"-":"+") << "\t"
-                << "0M" << "\n";
+            out.write("L\t", 2);
+            out.write_uint(offset(from));
+            out.write(is_rev(from) ? "\t-\t" : "\t+\t", 3);
+            out.write_uint(offset(to));
+            out.write(is_rev(to) ? "\t-\t0M\n" : "\t+\t0M\n", 6);
         }
     };
     link_mmset.for_each_unique_value(print_link);
 
     // write the paths
-    size_t num_seqs = seqidx.n_seqs();
-    // should be made to run in parallel
-    for (size_t i = 1; i <= num_seqs; ++i) {
-        size_t j = seqidx.nth_seq_offset(i);
-        size_t seq_len = seqidx.nth_seq_length(i);
-        size_t k = j + seq_len;
-        //std::cerr << seqidx.nth_name(i) << " " << seqidx.nth_seq_length(i) << " " << j << " " << k << std::endl;
-        std::vector<pos_t> path_v;
-        uint64_t seen_bp = 0;
-        while (j < k) {
-            uint64_t overlap_count = 0;
-            uint64_t ovlp_start_in_q;
-            uint64_t ovlp_end_in_q;
-            pos_t pos_start_in_s;
-            path_iitree.overlap(
-                j, j+1,
-                [&](const uint64_t& start,
-                    const uint64_t& end,
-                    const pos_t& pos) {
-                    ++overlap_count;
-                    ovlp_start_in_q = start;
-                    ovlp_end_in_q = end;
-                    pos_start_in_s = pos;
-                });
-            // each input base should only map one place in the graph
-            if (overlap_count != 1) {
-                std::cerr << "[seqwish::gfa] error: found " << overlap_count << " overlaps for seq " << seqidx.nth_name(i) << " idx " << i << " at j=" << j << " of " << k << std::endl;
-                path_iitree.overlap(
-                    j, j+1,
-                    [&](const uint64_t& start,
-                    const uint64_t& end,
-                    const pos_t& pos) {
-                        std::cerr << "ovlp_start_in_q = " << start << " "
-                                  << "ovlp_end_in_q = " << end << " "
-                                  << "pos_start_in_s = " << pos_to_string(pos) << std::endl;
-                    });
-                assert(false);
-                exit(1);
+    // each is cut into pieces, which the workers walk through the graph in parallel
+    // the steps of a piece go into its own buffer, with each step led by a ","
+    std::vector<path_piece_t> pieces = path_pieces(seqidx);
+    auto format_piece =
+        [&](const uint64_t& i, std::string& buf) {
+            std::vector<pos_t> steps;
+            get_piece_steps(i, pieces, path_steps, path_iitree, seq_id_cbv, seq_id_cbv_rank, seq_id_cbv_select, seqidx, seq_v_buf, validate, steps);
+            for (auto& step : steps) {
+                buf.push_back(',');
+                append_pos(buf, step);
             }
-            bool match_is_rev = is_rev(pos_start_in_s);
-            // iterate through the nodes in this range
-            uint64_t length = ovlp_end_in_q - ovlp_start_in_q;
-            //std::cerr << "overlap in path_iitree " << ovlp_start_in_q << ".." << ovlp_end_in_q << " " << pos_to_string(pos_start_in_s) << std::endl;
-            pos_t q = make_pos_t(ovlp_start_in_q, false);
-            pos_t p = pos_start_in_s;
-            // validate the path
-            // for each base in the range pointed to by the match, check that the input sequence we're processing matches the graph
-            for (uint64_t k = 0; k < length; ++k) {
-                if (seq_id_cbv[offset(p)]) {
-                    uint64_t node_id = seq_id_cbv_rank(offset(p)+1);
-                    //std::cerr << "got to node " << node_id << (match_is_rev ? "-" : "+") << std::endl;
-                    path_v.push_back(make_pos_t(node_id, match_is_rev));
-                }
-                /*else if (match_is_rev && seq_id_cbv[offset(p)]) {
-                    uint64_t node_id = seq_id_cbv_rank(offset(p)-1);
-                    std::cerr << "got to node " << node_id << "-" << std::endl;
-                    path_v.push_back(make_pos_t(node_id, match_is_rev));
-                }
-                */
-                char c = seq_v_buf[offset(p)];
-                if (is_rev(p)) c = dna_reverse_complement(c);
-                //std::cerr << pos_to_string(q) << " -> " << pos_to_string(p) << " " << seqidx.at_pos(q) << " vs " << c << " " << seq_id_cbv[offset(p)] << std::endl;
-                if (seqidx.at_pos(q) != c) {
-                    std::cerr << "GRAPH BROKEN @ "
-                        << seqidx.nth_name(i) << " " << pos_to_string(q) << " -> "
-                        << pos_to_string(q) << std::endl;
-                    assert(false);
-                    exit(1); // for release builds
+        };
+    // only the writer knows which step comes first in its path, so it drops that step's ","
+    bool path_has_steps = false;
+    auto write_piece =
+        [&](const path_piece_t& piece, const std::string& buf) {
+            if (piece.first) {
+                out.write("P\t", 2);
+                out.write(seqidx.nth_name(piece.seq));
+                out.put('\t');
+                path_has_steps = false;
+            }
+            if (!buf.empty()) {
+                if (path_has_steps) {
+                    out.write(buf.data(), buf.size());
+                } else {
+                    out.write(buf.data() + 1, buf.size() - 1);
+                    path_has_steps = true;
                 }
-                incr_pos(p, 1);
-                incr_pos(q, 1);
             }
-            seen_bp += length;
-            j = ovlp_end_in_q;
-        }
-        if (seen_bp != seq_len) {
-            std::cerr << "length for " << seqidx.nth_name(i) << ", expected " << seqidx.nth_seq_length(i) << " but got " << seen_bp << std::endl;
-            assert(false);
-            exit(1); // for release builds
-        }
-        std::stringstream cigarss;
-        std::stringstream pathss;
-
-        for (auto& p : path_v) {
-            pathss << pos_to_string(p) << ",";
-        }
-        pathss.seekp(-1, pathss.cur); // trim the last ","
-        cigarss << "*";
-        pathss << '\t';
-        //cigarss.seekp(-1, cigarss.cur);
-        cigarss << "\n";
-//#pragma omp critical (out)
-        out << "P" << "\t"
-            << seqidx.nth_name(i) << "\t"
-            << pathss.str()
-            << cigarss.str();
-    }
+            if (piece.last) {
+                if (path_has_steps) out.put('\t');
+                out.write("*\n", 2);
+            }
+        };
+    format_in_order(
+        pieces.size(), num_threads,
+        [&](const uint64_t& i, std::string& buf) { format_piece(i, buf); },
+        [&](const uint64_t& i, const std::string& buf) { write_piece(pieces[i], buf); });
 
     mmap_close(seq_v_buf, seq_v_fd, seq_v_filesize);
 
@@ -2,17 +2,80 @@
 
 #include <iostream>
 #include <sstream>
+#include <vector>
+#include <thread>
+#include <functional>
 #include "atomic_queue.h"
 #include "mmiitree.hpp"
 #include "mmmultiset.hpp"
 #include "seqindex.hpp"
 #include "pos.hpp"
 #include "mmap.hpp"
+#include "backoff.hpp"
+#include "paryfor.hpp"
+#include "bufwriter.hpp"
+#include "wang.hpp"
+#include "iitree_cursor.hpp"
 
 namespace seqwish {
 
+class path_steps_t;
 
-void emit_gfa(std::ostream& out,
+// how much of each path we check against the input sequences as we write it
+// sampled checks one base of every range of a path in the graph
+enum class validate_mode_t { none, sampled, full };
+
+validate_mode_t parse_validate_mode(const std::string& mode);
+
+// the bp of the graph sequence whose nodes one worker formats at a time
+const uint64_t node_chunk_length = 1000000;
+
+// the bp of a path that one worker walks at a time, so that long sequences are split across threads
+const uint64_t path_piece_length = 1000000;
+
+// a range of one input sequence whose path steps are formatted together
+struct path_piece_t {
+    size_t seq;
+    uint64_t start;
+    uint64_t end;
+    bool first; // the piece starts its sequence
+    bool last; // the piece ends it
+};
+
+// the pieces of all the paths, in the order of the sequences
+std::vector<path_piece_t> path_pieces(const seqindex_t& seqidx);
+
+// append the steps of the piece's path through the graph to steps, checking the path against its sequence as asked
+void walk_path_piece(const path_piece_t& piece,
+                     mmmulti::iitree<uint64_t, pos_t>& path_iitree,
+                     const sdsl::sd_vector<>& seq_id_cbv,
+                     const sdsl::sd_vector<>::rank_1_type& seq_id_cbv_rank,
+                     const sdsl::sd_vector<>::select_1_type& seq_id_cbv_select,
+                     const seqindex_t& seqidx,
+                     const char* seq_v_buf,
+                     const validate_mode_t& validate,
+                     std::vector<pos_t>& steps);
+
+// the steps of piece i of pieces, read from path_steps if we built them or found by walking path_iitree
+void get_piece_steps(const uint64_t& i,
+                     const std::vector<path_piece_t>& pieces,
+                     const path_steps_t* path_steps,
+                     mmmulti::iitree<uint64_t, pos_t>& path_iitree,
+                     const sdsl::sd_vector<>& seq_id_cbv,
+                     const sdsl::sd_vector<>::rank_1_type& seq_id_cbv_rank,
+                     const sdsl::sd_vector<>::select_1_type& seq_id_cbv_select,
+                     const seqindex_t& seqidx,
+                     const char* seq_v_buf,
+                     const validate_mode_t& validate,
+                     std::vector<pos_t>& steps);
+
+// format items 0..n_items-1 in parallel, writing them one after another in their order
+void format_in_order(const uint64_t& n_items,
+                     const uint64_t& num_threads,
+                     const std::function<void(const uint64_t&, std::string&)>& format,
+                     const std::function<void(const uint64_t&, const std::string&)>& write);
+
+void emit_gfa(buffered_writer_t& out,
               size_t graph_length,
               const std::string& seq_v_file,
               mmmulti::iitree<uint64_t, pos_t>& node_iitree,
@@ -22,6 +85,8 @@ void emit_gfa(std::ostream& out,
               const sdsl::sd_vector<>::select_1_type& seq_id_cbv_select,
               seqindex_t& seqidx,
               mmmulti::set<std::pair<pos_t, pos_t>>& link_mmset,
-              const uint64_t& num_threads);
+              const validate_mode_t& validate,
+              const uint64_t& num_threads,
+              const path_steps_t* path_steps = nullptr);
 
 }
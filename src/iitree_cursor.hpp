@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include "mmiitree.hpp"
+#include "pos.hpp"
+
+namespace seqwish {
+
+// walks the ranges of an indexed iitree in the order of their starts
+// where the ranges tile the coordinates, as those of path_iitree do, one seek
+// replaces an overlap query per range and the walk reads the file front to back
+class iitree_cursor_t {
+public:
+    iitree_cursor_t(mmmulti::iitree<uint64_t, pos_t>& tree) : iitree(tree), n_ranges(tree.size()) { }
+    // go to the last range that starts at or before pos, or the first if there is none
+    void seek(const uint64_t& pos) {
+        uint64_t lo = 0;
+        uint64_t hi = n_ranges;
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            if (iitree.start(mid) <= pos) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        idx = (lo ? lo - 1 : 0);
+    }
+    void next(void) { ++idx; }
+    bool done(void) const { return idx >= n_ranges; }
+    // whether the current range holds pos
+    bool contains(const uint64_t& pos) const { return !done() && start() <= pos && pos < end(); }
+    uint64_t index(void) const { return idx; }
+    uint64_t start(void) const { return iitree.start(idx); }
+    uint64_t end(void) const { return iitree.end(idx); }
+    pos_t pos(void) const { return iitree.data(idx); }
+
+private:
+    mmmulti::iitree<uint64_t, pos_t>& iitree;
+    uint64_t n_ranges;
+    uint64_t idx = 0;
+};
+
+}
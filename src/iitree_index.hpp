@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <thread>
+#include <algorithm>
+
+namespace seqwish {
+
+// index two interval trees at once, splitting the threads between them
+// the builds are independent and each spends much of its time on I/O, so they overlap well
+// a tree whose records were added in order sorts in one pass, as ips4o checks for sorted input first
+template<class A, class B>
+void index_together(A& a, B& b, const uint64_t& num_threads) {
+    uint64_t a_threads = std::max((uint64_t)1, num_threads / 2);
+    uint64_t b_threads = std::max((uint64_t)1, num_threads - a_threads);
+    std::thread a_indexer([&](void) { a.index(a_threads); });
+    b.index(b_threads);
+    a_indexer.join();
+}
+
+}
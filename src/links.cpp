@@ -2,69 +2,112 @@
 
 namespace seqwish {
 
+link_buffer_t::link_buffer_t(mmmulti::set<link_t>& set, const uint64_t& size)
+    : link_mmset(set), max_size(std::max((uint64_t)1, size)) {
+    links.reserve(max_size);
+}
+
+link_buffer_t::~link_buffer_t(void) {
+    flush();
+}
+
+void link_buffer_t::flush(void) {
+    // sorted runs make for less work when the set is indexed
+    std::sort(links.begin(), links.end());
+    for (auto& link : links) {
+        link_mmset.append(link);
+    }
+    links.clear();
+    recent_links.clear();
+}
+
 void derive_links(seqindex_t& seqidx,
-                  mmmulti::iitree<uint64_t, pos_t>& node_iitree,
                   mmmulti::iitree<uint64_t, pos_t>& path_iitree,
                   const sdsl::sd_vector<>& seq_id_cbv,
                   const sdsl::sd_vector<>::rank_1_type& seq_id_cbv_rank,
                   const sdsl::sd_vector<>::select_1_type& seq_id_cbv_select,
                   mmmulti::set<std::pair<pos_t, pos_t>>& link_mmset,
                   const uint64_t& num_threads) {
-    // for each marked node
-    // determine our edge context using the node_iitree and path_iitree
-    // and write it into the mmset
+    // stream through the ranges of path_iitree in the order of the input sequences, as compact_nodes does
+    // a path takes a link where a node ends inside one of its ranges, or where one range gives way to the next
+    // the first kind only ever joins neighbors in the graph sequence, so we mark them in bitvectors by node
+    // the second go through per-thread buffers, which drop the repeats from every path taking the same link
     link_mmset.open_writer();
     size_t n_nodes = seq_id_cbv_rank(seq_id_cbv.size()-1);
-    paryfor::parallel_for<size_t>(
-        1, n_nodes+1, num_threads, 10000,
-        [&](size_t id) {
-        uint64_t node_start_in_s = seq_id_cbv_select(id); // select is 1-based
-        uint64_t node_end_in_s = seq_id_cbv_select(id+1);
-        //std::cerr << "links for node " << id << " start " << node_start_in_s << " end " << node_end_in_s << std::endl;
-        // find the things on both sides of our node by looking in the node_iitree, finding what bits of the paths (in Q)
-        // are there, and seeing what's on either side of them to decide what links we need
-        node_iitree.overlap(
-            node_start_in_s, node_end_in_s,
-            [&](const uint64_t& ovlp_start_in_s,
-                const uint64_t& ovlp_end_in_s,
-                const pos_t& base_pos_start_in_q) {
-                uint64_t ovlp_length = ovlp_end_in_s - ovlp_start_in_s;
-                pos_t pos_start_in_q = base_pos_start_in_q;
-                pos_t pos_end_in_q = pos_start_in_q;
-                incr_pos(pos_end_in_q, ovlp_length - (ovlp_end_in_s - node_end_in_s));
-                incr_pos(pos_start_in_q, node_start_in_s - ovlp_start_in_s);
-                // get the positions in s on either side of this range in Q
-                // note the need to handle orientation
-                // determine which sequence we're in
-                // find its boundaries
-                bool curr_step_is_rev = is_rev(pos_start_in_q);
-                uint64_t start_in_q = (curr_step_is_rev ? offset(pos_end_in_q)+1 : offset(pos_start_in_q));
-                uint64_t end_in_q = (curr_step_is_rev ? offset(pos_start_in_q)+1 : offset(pos_end_in_q));
-                uint64_t seq_id = seqidx.seq_id_at(start_in_q);
-                uint64_t id_end = seqidx.seq_id_at(end_in_q-1);
-                assert(seq_id == id_end);
-                uint64_t seq_start = seqidx.nth_seq_offset(seq_id);
-                uint64_t seq_end = seq_start + seqidx.nth_seq_length(seq_id);
-                // and only consider cases where we'd be within the boundaries
-                if (end_in_q+1 <= seq_end) {
-                    path_iitree.overlap(
-                        end_in_q, end_in_q+1,
-                        [&](const uint64_t& ovlp_start_in_q,
-                            const uint64_t& ovlp_end_in_q,
-                            const pos_t& base_pos_start_in_s) {
-                            pos_t pos_start_in_s = base_pos_start_in_s;
-                            if (ovlp_start_in_q < end_in_q) {
-                                //std::cerr << "contained in previous range on q" << std::endl;
-                                incr_pos(pos_start_in_s, end_in_q - ovlp_start_in_q);
-                            }
-                            // find which node we're in here, and record a link
-                            uint64_t next_id = seq_id_cbv_rank(offset(pos_start_in_s)+1);
-                            bool next_step_is_rev = is_rev(pos_start_in_s);
-                            link_mmset.append(std::make_pair(make_pos_t(id, curr_step_is_rev), make_pos_t(next_id, next_step_is_rev)));
-                        });
+    atomicbitvector::atomic_bv_t fwd_next(n_nodes+1); // node id+ -> id+1+
+    atomicbitvector::atomic_bv_t rev_next(n_nodes+1); // node id+1- -> id-
+    std::vector<std::unique_ptr<link_buffer_t>> buffers;
+    for (uint64_t t = 0; t < num_threads; ++t) {
+        buffers.emplace_back(std::make_unique<link_buffer_t>(link_mmset, link_buffer_size));
+    }
+    auto node_at = [&](const uint64_t& pos_in_s) { return seq_id_cbv_rank(pos_in_s+1); };
+    uint64_t n_ranges = path_iitree.size();
+    paryfor::parallel_for<uint64_t>(
+        0, n_ranges, num_threads, 10000,
+        [&](uint64_t k, int tid) {
+            uint64_t length = path_iitree.end(k) - path_iitree.start(k);
+            pos_t pos_start_in_s = path_iitree.data(k);
+            bool curr_step_is_rev = is_rev(pos_start_in_s);
+            uint64_t first_id = node_at(offset(pos_start_in_s));
+            uint64_t last_id;
+            if (!curr_step_is_rev) {
+                // we walk forward through [start, start+length)
+                last_id = node_at(offset(pos_start_in_s) + length - 1);
+                for (uint64_t id = first_id; id < last_id; ++id) {
+                    fwd_next.set(id);
+                }
+            } else {
+                // we walk backward from start to start-length+1
+                last_id = node_at(offset(pos_start_in_s) + 1 - length);
+                for (uint64_t id = last_id; id < first_id; ++id) {
+                    rev_next.set(id);
                 }
-            });
+            }
+            // and only consider cases where the next range continues our sequence
+            if (k+1 < n_ranges && !seqidx.seq_start(path_iitree.start(k+1))) {
+                pos_t next_pos_start_in_s = path_iitree.data(k+1);
+                buffers[tid]->add(std::make_pair(make_pos_t(last_id, curr_step_is_rev),
+                                                 make_pos_t(node_at(offset(next_pos_start_in_s)), is_rev(next_pos_start_in_s))));
+            }
+        });
+    buffers.clear();
+    for (auto id : fwd_next) {
+        link_mmset.append(std::make_pair(make_pos_t(id, false), make_pos_t(id+1, false)));
+    }
+    for (auto id : rev_next) {
+        link_mmset.append(std::make_pair(make_pos_t(id+1, true), make_pos_t(id, true)));
+    }
+    link_mmset.index(num_threads);
+}
+
+void derive_links(const path_steps_t& path_steps,
+                  mmmulti::set<std::pair<pos_t, pos_t>>& link_mmset,
+                  const uint64_t& num_threads) {
+    link_mmset.open_writer();
+    const std::vector<path_piece_t>& pieces = path_steps.pieces();
+    // the first step of the sequence of each piece, so that a piece can take the link from the step before it
+    std::vector<uint64_t> seq_first_step(pieces.size());
+    for (uint64_t i = 0; i < pieces.size(); ++i) {
+        seq_first_step[i] = (pieces[i].first ? path_steps.piece_start(i) : seq_first_step[i-1]);
+    }
+    std::vector<std::unique_ptr<link_buffer_t>> buffers;
+    for (uint64_t t = 0; t < num_threads; ++t) {
+        buffers.emplace_back(std::make_unique<link_buffer_t>(link_mmset, link_buffer_size));
+    }
+    paryfor::parallel_for<uint64_t>(
+        0, pieces.size(), num_threads, 1,
+        [&](uint64_t i, int tid) {
+            uint64_t begin = path_steps.piece_start(i);
+            uint64_t end = path_steps.piece_start(i+1);
+            if (begin == end) return;
+            if (begin > seq_first_step[i]) --begin;
+            std::vector<pos_t> steps;
+            path_steps.read(begin, end, steps);
+            for (uint64_t x = 1; x < steps.size(); ++x) {
+                buffers[tid]->add(std::make_pair(steps[x-1], steps[x]));
+            }
         });
+    buffers.clear();
     link_mmset.index(num_threads);
 }
 
@@ -2,18 +2,52 @@
 #define LINKS_HPP_INCLUDED
 
 #include <vector>
+#include <memory>
+#include <algorithm>
 #include <iostream>
 #include "paryfor.hpp"
 #include "seqindex.hpp"
 #include "mmmultiset.hpp"
 #include "mmiitree.hpp"
+#include "atomic_bitvector.hpp"
 #include "pos.hpp"
+#include "steps.hpp"
+#include "flat_hash_map.hpp"
+#include "wang.hpp"
 
 namespace seqwish {
 
+typedef std::pair<pos_t, pos_t> link_t;
+
+// the links a thread holds before writing them out
+const uint64_t link_buffer_size = 1 << 16;
+
+// the links found by one thread, written to the link set a run at a time
+// a set of the links in the current run drops the repeats that come close together
+// the set is indexed before we read it, so the few left across runs don't matter
+class link_buffer_t {
+public:
+    link_buffer_t(mmmulti::set<link_t>& link_mmset, const uint64_t& max_size);
+    ~link_buffer_t(void);
+    void add(const link_t& link) {
+        if (recent_links.insert(link).second) {
+            links.push_back(link);
+            if (links.size() >= max_size) {
+                flush();
+            }
+        }
+    }
+    void flush(void);
+
+private:
+    ska::flat_hash_set<link_t, wang_hash<link_t>> recent_links;
+    std::vector<link_t> links;
+    mmmulti::set<link_t>& link_mmset;
+    uint64_t max_size;
+};
+
 
 void derive_links(seqindex_t& seqidx,
-                  mmmulti::iitree<uint64_t, pos_t>& node_iitree,
                   mmmulti::iitree<uint64_t, pos_t>& path_iitree,
                   const sdsl::sd_vector<>& seq_id_cbv,
                   const sdsl::sd_vector<>::rank_1_type& seq_id_cbv_rank,
@@ -21,6 +55,11 @@ void derive_links(seqindex_t& seqidx,
                   mmmulti::set<std::pair<pos_t, pos_t>>& link_mmset,
                   const uint64_t& num_threads);
 
+// the same links, read off the consecutive steps of the paths in the step index
+void derive_links(const path_steps_t& path_steps,
+                  mmmulti::set<std::pair<pos_t, pos_t>>& link_mmset,
+                  const uint64_t& num_threads);
+
 }
 
 #endif
@@ -4,6 +4,7 @@
 #include <string>
 #include <chrono>
 #include <iomanip>
+#include <sstream>
 #include "args.hxx"
 #include "mmmultimap.hpp"
 #include "mmiitree.hpp"
@@ -15,14 +16,25 @@
 #include "links.hpp"
 #include "compact.hpp"
 #include "gfa.hpp"
+#include "bingraph.hpp"
 #include "vgp.hpp"
+#include "steps.hpp"
 #include "pos.hpp"
 #include "match.hpp"
 #include "exists.hpp"
 #include "time.hpp"
 #include "utils.hpp"
+#include "tokenize.hpp"
 #include "version.hpp"
 #include "tempfile.hpp"
+#include "backoff.hpp"
+#include "memplan.hpp"
+#include "profile.hpp"
+#include "checkpoint.hpp"
+#include "shard.hpp"
+#include "extend.hpp"
+#include "matchfile.hpp"
+#include "iitree_index.hpp"
 
 using namespace seqwish;
 
@@ -30,17 +42,46 @@ int main(int argc, char** argv) {
     args::ArgumentParser parser("seqwish: a variation graph inducer\n" + seqwish::Version::get_version() + ": " + seqwish::Version::get_codename());
     args::HelpFlag help(parser, "help", "display this help menu", {'h', "help"});
     args::ValueFlag<std::string> paf_alns(parser, "FILE", "Induce the graph from these PAF formatted alignments. Optionally, a list of filenames and minimum match lengths: [file_1][:min_match_length_1],... This allows the differential filtering of short matches from some but not all inputs, in effect allowing `-k` to be specified differently for each input.", {'p', "paf-alns"});
-    args::ValueFlag<std::string> seqs(parser, "FILE", "The sequences used to generate the alignments (FASTA, FASTQ, .seq)", {'s', "seqs"});
+    args::ValueFlag<std::string> read_matches(parser, "FILE", "Read the exact matches kept by --write-matches in an earlier run on the same sequences, or a comma-separated list of such files, instead of or as well as the PAFs, keeping those that pass -k. The filters of alignment rows and -f apply only to the PAFs, and match files bypass them", {"read-matches"});
+    args::ValueFlag<std::string> write_matches(parser, "FILE", "Keep the exact matches found in the alignments in FILE, in a compact binary form that later runs on the same sequences can read with --read-matches", {"write-matches"});
+    args::ValueFlag<std::string> seqs(parser, "FILE", "The sequences used to generate the alignments (FASTA, FASTQ, .seq), or a comma-separated list of such files, which are read as if concatenated. A plain FASTA with a .fai is read through its index.", {'s', "seqs"});
+    args::Flag pack_seqs(parser, "", "Keep the input sequences 2-bit packed, with the runs of N and other IUPAC codes on the side, for a quarter of the memory at some cost in speed", {"pack-seqs"});
+    args::ValueFlag<std::string> index_cache(parser, "DIR", "Keep the index of the input sequences in DIR and reuse it in later runs on the same file, as known by its path, size and modification time", {"index-cache"});
+    args::ValueFlag<uint64_t> closure_shards(parser, "N", "Split the transitive closure into N shards, runs of input sequences that no alignment joins, each closed by a run given --closure-shard, then merged by a run without it", {"closure-shards"});
+    args::ValueFlag<uint64_t> closure_shard(parser, "I", "Close only shard I (from 0) of the --closure-shards, writing it to --shard-dir, and stop", {"closure-shard"});
+    args::ValueFlag<std::string> shard_dir(parser, "DIR", "The directory shared by the runs of a sharded closure", {"shard-dir"});
+    args::ValueFlag<std::string> extend_dir(parser, "DIR", "Extend the graph of the earlier run checkpointed in DIR, whose sequences must come first in the input, closing only the new sequences over the alignments given, which need be only those of the new sequences", {"extend"});
+    args::ValueFlag<std::string> checkpoint_dir(parser, "DIR", "Keep the outputs of each step in DIR, with a manifest of the steps that completed", {"checkpoint"});
+    args::Flag resume(parser, "", "Load the steps that an earlier run with the same inputs and parameters completed in the --checkpoint directory, and run only the rest", {"resume"});
     args::ValueFlag<std::string> tmp_base(parser, "PATH", "directory for temporary files [default: `pwd`]", {'b', "temp-dir"});
-    args::ValueFlag<std::string> gfa_out(parser, "FILE", "Write the graph in GFA to FILE", {'g', "gfa"});
-    args::ValueFlag<std::string> sml_in(parser, "FILE", "Use the sequence match list in FILE to subset the input alignments", {'m', "match-list"});
-    //args::ValueFlag<std::string> vgp_base(parser, "BASE", "Write the graph in VGP format with basename FILE", {'o', "vgp-out"});
+    args::ValueFlag<std::string> gfa_out(parser, "FILE", "Write the graph in GFA to FILE, compressed in parallel to BGZF if it ends in .gz or to seekable zstd if it ends in .zst", {'g', "gfa"});
+    args::ValueFlag<std::string> validate(parser, "MODE", "Check the paths against the input sequences as they are written: none, sampled (one base per range of a path in the graph) or full (every base) [default: sampled]", {"validate"});
+    args::Flag direct_io(parser, "", "Write the GFA given by -g with O_DIRECT, keeping it out of the page cache", {"direct-io"});
+    args::ValueFlag<std::string> binary_out(parser, "FILE", "Write the graph to FILE in seqwish's mmap-able binary format (described in src/bingraph.hpp)", {"binary-graph"});
+    args::Flag step_index(parser, "", "Find the steps of every path once after compaction, keeping them bit-packed in the temp dir, and derive the links and write every output from them", {"step-index"});
+    args::ValueFlag<std::string> sml_in(parser, "FILE", "Use the sequence match list in FILE to subset the input alignments, keeping only the rows between the pairs of sequences it names, one whitespace-separated pair per line, in either order", {'m', "match-list"});
+    args::ValueFlag<std::string> vgp_base(parser, "BASE", "Write the graph in VGP format to BASE.seq, BASE.scf and BASE.sxs", {'o', "vgp-out"});
     args::ValueFlag<int> thread_count(parser, "N", "Use this many threads during parallel steps", {'t', "threads"});
     args::ValueFlag<uint64_t> repeat_max(parser, "N", "Limit transitive closure to include no more than N copies of a given input base", {'r', "repeat-max"});
     args::ValueFlag<uint64_t> min_repeat_dist(parser, "N", "Prevent transitive closure for bases at least this far apart in input sequences", {'l', "min-repeat-distance"});
     args::ValueFlag<uint64_t> min_match_len(parser, "N", "Filter exact matches below this length. This can smooth the graph locally and prevent the formation of complex local graph topologies from forming due to differential alignments.", {'k', "min-match-len"});
     args::ValueFlag<float> match_sparsification(parser, "N", "Sparsify input matches, keeping the fraction that minimize a hash function.", {'f', "sparse-factor"});
+    args::ValueFlag<uint64_t> min_block_length(parser, "N", "Skip the PAF rows whose alignment block is shorter than N", {"min-block-length"});
+    args::ValueFlag<float> min_identity(parser, "F", "Skip the PAF rows whose identity, the residue matches over the alignment block length, is below F", {"min-identity"});
+    args::ValueFlag<uint64_t> max_pair_mappings(parser, "N", "Keep only the N longest mappings between each pair of sequences, found in a first pass over the PAFs, ranking by alignment block length, then residue matches and coordinates, and of rows equal in all of these keeping the first in the input", {"max-pair-mappings"});
+    args::Flag dry_run(parser, "", "Only read the alignments, reporting how many rows pass the filters and how many matches and bases would go into the graph, and stop", {"dry-run"});
+    args::ValueFlag<std::string> sparse_mode(parser, "MODE", "How -f samples the matches: each match on its own (match), all the matches between a pair of windows of the input together (window) or all the matches of an alignment together (alignment) [default: match]", {"sparse-mode"});
+    args::ValueFlag<std::string> sparse_window(parser, "N", "The size of the windows of --sparse-mode window (1k = 1K = 1000, 1m = 1M = 10^6) [default 10k]", {"sparse-window"});
+    args::Flag trust_cigar(parser, "", "Trust the = and X operations of extended CIGARs, taking = runs as matches (split only at Ns) and skipping X runs, without checking the sequences", {"trust-cigar"});
+    args::ValueFlag<std::string> match_buffer(parser, "N", "Number of matches each thread buffers before writing them to the alignment index (1k = 1K = 1000, 1m = 1M = 10^6) [default 64k]", {"match-buffer"});
     args::ValueFlag<std::string> transclose_batch(parser, "N", "Number of bp to use for transitive closure batch (1k = 1K = 1000, 1m = 1M = 10^6, 1g = 1G = 10^9) [default 1M]", {'B', "transclose-batch"});
+    args::ValueFlag<std::string> max_memory(parser, "N", "Pick the transitive closure batch size so that the estimated peak memory stays below N bytes, spilling closure batches to disk past it (1k = 1K = 1000, 1m = 1M = 10^6, 1g = 1G = 10^9)", {"max-memory"});
+    args::ValueFlag<std::string> transclose_mem(parser, "N", "Hold at most about N bytes of transitive closure batch arrays in memory, keeping the rest in files in the temp dir (1k = 1K = 1000, 1m = 1M = 10^6, 1g = 1G = 10^9) [default: no limit]", {"transclose-mem"});
+    args::Flag adaptive_batch(parser, "", "Adapt the transitive closure batch size to the time and memory the batches before it took, starting from -B", {"adaptive-batch"});
+    args::ValueFlag<std::string> madvise_policy(parser, "POLICY", "Advise the kernel of how we read our large mappings: willneed, to read ahead all of each, access, random for the input sequences and sequential for the graph sequence, or random or sequential for all [default: willneed]", {"madvise"});
+    args::Flag huge_pages(parser, "", "Ask for transparent huge pages for our large mappings, where the kernel and file system support them for files", {"huge-pages"});
+    args::Flag numa_interleave(parser, "", "Interleave our memory, and the page cache of the files we read, across the NUMA nodes", {"numa-interleave"});
+    args::ValueFlag<std::string> profile_out(parser, "FILE", "Write a JSON report of time, memory, I/O and counters per step and per transitive closure batch to FILE", {"profile"});
     //args::ValueFlag<uint64_t> num_domains(parser, "N", "number of domains for iitii interpolation", {'D', "domains"});
     args::Flag keep_temp_files(parser, "", "keep intermediate files generated during graph induction", {'T', "keep-temp"});
     args::Flag show_progress(parser, "show-progress", "log algorithm progress", {'P', "show-progress"});
@@ -77,9 +118,20 @@ int main(int argc, char** argv) {
     }
     */
 
-    if (!args::get(seqs).empty() && !file_exists(args::get(seqs))) {
-        std::cerr << "[seqwish] ERROR: input sequence file " << args::get(seqs) << " does not exist" << std::endl;
-        return 2;
+    if (!args::get(gfa_out).empty() && !compression_available(compression_for(args::get(gfa_out)))) {
+        std::cerr << "[seqwish] ERROR: this build of seqwish can't write zstd, so it can't write " << args::get(gfa_out) << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> seq_files;
+    if (!args::get(seqs).empty()) {
+        tokenize(args::get(seqs), seq_files, ",", true);
+        for (auto& file : seq_files) {
+            if (!file_exists(file)) {
+                std::cerr << "[seqwish] ERROR: input sequence file " << file << " does not exist" << std::endl;
+                return 2;
+            }
+        }
     }
 
     // parse paf args
@@ -113,6 +165,22 @@ int main(int argc, char** argv) {
         }
     }
 
+    std::vector<std::string> match_files;
+    if (read_matches) {
+        tokenize(args::get(read_matches), match_files, ",", true);
+        for (auto& file : match_files) {
+            if (!file_exists(file)) {
+                std::cerr << "[seqwish] ERROR: input match file " << file << " does not exist" << std::endl;
+                return 4;
+            }
+        }
+        if (pafs_and_min_lengths.empty() && (match_sparsification || sml_in || min_block_length || min_identity || max_pair_mappings)) {
+            std::cerr << "[seqwish] ERROR: -f, -m, --min-block-length, --min-identity and --max-pair-mappings apply only to the alignments of -p, "
+                      << "as a match file no longer holds the alignments they choose from" << std::endl;
+            return 1;
+        }
+    }
+
     if (tmp_base) {
         temp_file::set_dir(args::get(tmp_base));
     } else {
@@ -122,62 +190,348 @@ int main(int argc, char** argv) {
     }
 
     temp_file::set_keep_temp(args::get(keep_temp_files));
+    validate_mode_t validate_mode = validate ? parse_validate_mode(args::get(validate)) : validate_mode_t::sampled;
+
+    if (profile_out) {
+        profile().enable(num_threads);
+    }
+
+    set_map_policy(madvise_policy ? parse_map_policy(args::get(madvise_policy)) : map_policy_t::willneed, args::get(huge_pages));
+    if (numa_interleave && !interleave_numa_nodes() && args::get(show_progress)) {
+        std::cerr << "[seqwish] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " found one NUMA node, or no NUMA support, so memory is not interleaved" << std::endl;
+    }
+
+    if ((closure_shards || closure_shard) && (!closure_shards || !shard_dir || args::get(closure_shards) == 0)) {
+        std::cerr << "[seqwish] ERROR: a sharded closure needs the number of --closure-shards and the --shard-dir they share" << std::endl;
+        return 1;
+    }
+    if (closure_shard && args::get(closure_shard) >= args::get(closure_shards)) {
+        std::cerr << "[seqwish] ERROR: --closure-shard counts from 0 and must be less than --closure-shards" << std::endl;
+        return 1;
+    }
+    // without a shard of our own, we lay the shards' graphs end to end
+    bool merge_shards = closure_shards && !closure_shard;
+    // a checkpoint or a cached index is matched to its inputs by their identity, which a pipe doesn't have
+    std::vector<std::string> keyed_inputs;
+    if (checkpoint_dir || index_cache) keyed_inputs = seq_files;
+    if (checkpoint_dir) {
+        for (auto& p : pafs_and_min_lengths) keyed_inputs.push_back(p.first);
+        keyed_inputs.insert(keyed_inputs.end(), match_files.begin(), match_files.end());
+        if (sml_in) keyed_inputs.push_back(args::get(sml_in));
+    }
+    for (auto& file : keyed_inputs) {
+        if (!is_regular_file(file)) {
+            std::cerr << "[seqwish] ERROR: --checkpoint and --index-cache need their inputs in regular files, and " << file << " is not one" << std::endl;
+            return 1;
+        }
+    }
+    if (resume && !checkpoint_dir) {
+        std::cerr << "[seqwish] ERROR: --resume needs the --checkpoint directory to resume from" << std::endl;
+        return 1;
+    }
+    if (extend_dir && (closure_shards || (checkpoint_dir && args::get(checkpoint_dir) == args::get(extend_dir)))) {
+        std::cerr << "[seqwish] ERROR: --extend can't shard its closure, or keep its checkpoints in the directory of the graph it extends" << std::endl;
+        return 1;
+    }
+    if (extend_dir && (args::get(repeat_max) || args::get(min_repeat_dist))) {
+        std::cerr << "[seqwish] WARNING: --extend closes the new sequences without the limits of -r and -l" << std::endl;
+    }
+    checkpoint_t checkpoint;
+    if (checkpoint_dir) {
+        checkpoint.open(args::get(checkpoint_dir), args::get(resume));
+    }
 
     // 1) index the queries (Q) to provide sequence name to position and position to sequence name mapping, generating a CSA and a sequence file
     if (args::get(show_progress)) std::cerr << "[seqwish::seqidx] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " indexing sequences" << std::endl;
+    uint64_t base_rss = current_rss_bytes();
     auto seqidx_ptr = std::make_unique<seqindex_t>();
     auto& seqidx = *seqidx_ptr;
-    seqidx.build_index(args::get(seqs));
-    seqidx.save();
-    if (args::get(show_progress)) std::cerr << "[seqwish::seqidx] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " index built" << std::endl;
+    seqidx.set_packed(args::get(pack_seqs));
+    std::string seqidx_cache;
+    bool seqidx_loaded = false;
+    if (checkpoint.enabled() && checkpoint.done("seqidx", file_identity(seq_files) + (seqidx.is_packed() ? "packed" : ""))) {
+        seqidx_cache = checkpoint.file("seqidx", "");
+        seqidx_loaded = seqidx.load_cache(seqidx_cache, seq_files);
+        if (!seqidx_loaded) {
+            std::cerr << "[seqwish] ERROR: the sequence index checkpointed in " << args::get(checkpoint_dir) << " could not be loaded, run again without --resume" << std::endl;
+            return 1;
+        }
+    } else if (!args::get(index_cache).empty()) {
+        seqidx_cache = seq_index_cache_base(args::get(index_cache), seq_files, seqidx.is_packed());
+        seqidx_loaded = seqidx.load_cache(seqidx_cache, seq_files);
+    }
+    if (seqidx_loaded) {
+        if (args::get(show_progress)) std::cerr << "[seqwish::seqidx] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " index loaded from " << seqidx_cache << std::endl;
+    } else {
+        seqidx.build_index(seq_files, num_threads);
+        seqidx.save();
+        if (!seqidx_cache.empty()) {
+            seqidx.save_cache(seqidx_cache, seq_files);
+        }
+        if (args::get(show_progress)) std::cerr << "[seqwish::seqidx] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " index built" << std::endl;
+    }
+    if (checkpoint.enabled() && seqidx_cache != checkpoint.file("seqidx", "")) {
+        seqidx.save_cache(checkpoint.file("seqidx", ""), seq_files);
+        checkpoint.complete("seqidx");
+    }
+
+    // estimate the memory each step will need, fitting the closure batches to any limit we were given
+    uint64_t match_buffer_size = match_buffer ? (uint64_t)seqwish::handy_parameter(args::get(match_buffer), 64000) : 64000;
+    uint64_t transclose_batch_size = transclose_batch ? (uint64_t)seqwish::handy_parameter(args::get(transclose_batch), 1000000) : 1000000;
+    uint64_t transclose_mem_limit = transclose_mem ? (uint64_t)seqwish::handy_parameter(args::get(transclose_mem), 0) : 0;
+    memory_plan_t memory_plan;
+    {
+        std::vector<std::string> paf_files;
+        for (auto& p : pafs_and_min_lengths) {
+            paf_files.push_back(p.first);
+        }
+        paf_sample_t paf_sample = sample_pafs(paf_files);
+        memory_plan.estimate(seqidx.seq_length(), seqidx.n_seqs(), paf_sample, transclose_batch_size, match_buffer_size, num_threads, base_rss, seqidx.is_packed());
+        uint64_t max_memory_bytes = max_memory ? (uint64_t)seqwish::handy_parameter(args::get(max_memory), 0) : 0;
+        if (max_memory_bytes) {
+            transclose_batch_size = memory_plan.fit_batch(max_memory_bytes, transclose_batch_size);
+            memory_plan.estimate(seqidx.seq_length(), seqidx.n_seqs(), paf_sample, transclose_batch_size, match_buffer_size, num_threads, base_rss, seqidx.is_packed());
+            if (!transclose_mem_limit) {
+                // whatever the closure's fixed structures leave us, so that it spills if our estimate was low
+                transclose_mem_limit = std::max((uint64_t)1, max_memory_bytes - std::min(max_memory_bytes, memory_plan.closure_fixed));
+            }
+            if (memory_plan.peak() > max_memory_bytes) {
+                std::cerr << "[seqwish] WARNING: the estimated peak memory of " << format_bytes(memory_plan.peak())
+                          << " exceeds the " << format_bytes(max_memory_bytes) << " we were given, only the transitive closure can shrink its batches and spill them to disk" << std::endl;
+            }
+        }
+    }
+    // each step reports the peak of its resident set next to our estimate
+    auto log_step_memory =
+        [&](const std::string& step, const uint64_t& estimate) {
+            uint64_t peak = peak_rss_bytes();
+            if (profile().enabled()) {
+                profile().end_step(step, peak, estimate);
+            }
+            if (args::get(show_progress)) {
+                std::cerr << "[seqwish::memory] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " " << step << " peak RSS " << format_bytes(peak) << " estimated " << format_bytes(estimate) << std::endl;
+            }
+            if (args::get(show_progress) || profile().enabled()) {
+                reset_peak_rss();
+            }
+        };
+    if (args::get(show_progress)) {
+        std::cerr << "[seqwish::memory] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " estimated peaks: ";
+        memory_plan.print(std::cerr);
+        std::cerr << std::endl;
+    }
+    log_step_memory("seqidx", memory_plan.seqidx);
 
-    // 2) parse the alignments into position pairs and index (A)
-    if (args::get(show_progress)) std::cerr << "[seqwish::alignments] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " processing alignments" << std::endl;
-    const std::string aln_idx = temp_file::create("seqwish-", ".sqa");
-    auto aln_iitree_ptr = std::make_unique<mmmulti::iitree<uint64_t, pos_t>>(aln_idx);
-    auto& aln_iitree = *aln_iitree_ptr;
-    aln_iitree.open_writer();
     float sparse_match = match_sparsification ? args::get(match_sparsification) : 0;
-    if (!pafs_and_min_lengths.empty()) {
+    sparse_mode_t sparse_match_mode = sparse_mode ? parse_sparse_mode(args::get(sparse_mode)) : sparse_mode_t::match;
+    uint64_t sparse_match_window = std::max((uint64_t)1, sparse_window ? (uint64_t)seqwish::handy_parameter(args::get(sparse_window), 10000) : 10000);
+    base_graph_t base_graph;
+    if (extend_dir) {
+        base_graph.open(args::get(extend_dir), seqidx);
+    }
+    // the parameters that each step's results depend on, by which checkpoints are matched to this run
+    std::stringstream aln_params;
+    std::stringstream closure_params;
+    if (checkpoint.enabled()) {
         for (auto& p : pafs_and_min_lengths) {
-            auto& file = p.first;
-            uint64_t min_length = p.second;
-            if (!min_length && args::get(min_match_len)) {
-                min_length = args::get(min_match_len);
+            aln_params << file_identity({ p.first }) << (p.second ? p.second : args::get(min_match_len)) << "\n";
+        }
+        aln_params << sparse_match << "\t" << args::get(trust_cigar);
+        if (sparse_match && sparse_match_mode != sparse_mode_t::match) {
+            aln_params << "\t" << (int)sparse_match_mode << "\t" << sparse_match_window;
+        }
+        if (sml_in) {
+            aln_params << "\t" << file_identity({ args::get(sml_in) });
+        }
+        aln_params << "\t" << file_identity(match_files);
+        if (!match_files.empty()) {
+            aln_params << "\t" << args::get(min_match_len);
+        }
+        aln_params << "\t" << args::get(min_block_length) << "\t" << args::get(min_identity) << "\t" << args::get(max_pair_mappings);
+        closure_params << args::get(repeat_max) << "\t" << args::get(min_repeat_dist) << "\t" << transclose_batch_size;
+        if (extend_dir) {
+            closure_params << "\t" << file_identity({ base_graph.seq_v_file, base_graph.node_iitree_file, base_graph.path_iitree_file });
+        }
+    }
+    bool alignments_done = checkpoint.done("alignments", aln_params.str());
+
+    // the filters of whole alignment rows, applied as we read them
+    paf_filter_t paf_filter;
+    std::unique_ptr<match_list_t> match_list;
+    if (!alignments_done || dry_run) {
+        if (sml_in) {
+            match_list = std::make_unique<match_list_t>();
+            match_list->load(args::get(sml_in), seqidx);
+            paf_filter.match_list = match_list.get();
+            if (args::get(show_progress)) std::cerr << "[seqwish::alignments] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " keeping the alignments of " << match_list->size() << " pairs of sequences" << std::endl;
+        }
+        paf_filter.min_block_length = args::get(min_block_length);
+        paf_filter.min_identity = args::get(min_identity);
+        paf_filter.max_pair_mappings = args::get(max_pair_mappings);
+        if (paf_filter.max_pair_mappings) {
+            std::vector<std::string> paf_files;
+            for (auto& p : pafs_and_min_lengths) {
+                paf_files.push_back(p.first);
+            }
+            paf_filter.rank_pair_mappings(paf_files, seqidx, num_threads);
+            if (args::get(show_progress)) std::cerr << "[seqwish::alignments] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " ranked the mappings of each pair of sequences" << std::endl;
+        }
+    }
+    auto min_length_of = [&](const std::pair<std::string, uint64_t>& p) {
+        return p.second ? p.second : args::get(min_match_len);
+    };
+
+    if (dry_run) {
+        // count what each file would give, with the filters, -k and -f as they are, without keeping any of it
+        paf_stats_t total;
+        for (uint64_t i = 0; i < pafs_and_min_lengths.size(); ++i) {
+            auto& p = pafs_and_min_lengths[i];
+            paf_stats_t stats;
+            count_paf_alignments(p.first, seqidx, min_length_of(p), sparse_match, args::get(trust_cigar), num_threads,
+                                 paf_filter.active() ? &paf_filter : nullptr, &stats, sparse_match_mode, sparse_match_window, i);
+            std::cerr << "[seqwish::alignments] " << p.first << ": " << stats.kept_rows << " of " << stats.rows << " rows kept, giving "
+                      << stats.matches << " matches of " << stats.match_bp << "bp at -k " << min_length_of(p) << std::endl;
+            total.rows += stats.rows;
+            total.kept_rows += stats.kept_rows;
+            total.matches += stats.matches;
+            total.match_bp += stats.match_bp;
+        }
+        for (auto& file : match_files) {
+            match_file_stats_t stats = read_match_file(file, nullptr, seqidx, args::get(min_match_len));
+            std::cerr << "[seqwish::alignments] " << file << ": " << stats.kept << " of " << stats.records << " match records kept, giving "
+                      << stats.kept / 2 << " matches of " << stats.kept_bp / 2 << "bp at -k " << args::get(min_match_len) << std::endl;
+            total.matches += stats.kept / 2;
+            total.match_bp += stats.kept_bp / 2;
+        }
+        std::cerr << "[seqwish::alignments] in all: " << total.kept_rows << " of " << total.rows << " rows kept, giving "
+                  << total.matches << " matches of " << total.match_bp << "bp over " << seqidx.seq_length() << "bp of input sequence" << std::endl;
+        return 0;
+    }
+    bool closure_done = checkpoint.done("transclosure", closure_params.str());
+
+    // 2) parse the alignments into position pairs and index (A)
+    // the closure is all that reads them, so we skip them if it's done
+    std::unique_ptr<mmmulti::iitree<uint64_t, pos_t>> aln_iitree_ptr;
+    if (!closure_done && !merge_shards) {
+        const std::string aln_idx = checkpoint.file("alignments", ".sqa");
+        aln_iitree_ptr = std::make_unique<mmmulti::iitree<uint64_t, pos_t>>(aln_idx);
+        auto& aln_iitree = *aln_iitree_ptr;
+        if (alignments_done) {
+            // the checkpoint holds the records in order, so indexing them again is one pass
+            aln_iitree.index(num_threads);
+            if (args::get(show_progress)) std::cerr << "[seqwish::alignments] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " alignments loaded from " << aln_idx << std::endl;
+        } else {
+            if (args::get(show_progress)) std::cerr << "[seqwish::alignments] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " processing alignments" << std::endl;
+            aln_iitree.open_writer();
+            uint64_t match_buffer_flushes = 0;
+            paf_stats_t paf_stats;
+            if (!pafs_and_min_lengths.empty()) {
+                for (uint64_t i = 0; i < pafs_and_min_lengths.size(); ++i) {
+                    auto& p = pafs_and_min_lengths[i];
+                    match_buffer_flushes += unpack_paf_alignments(p.first, aln_iitree, seqidx, min_length_of(p), sparse_match, args::get(trust_cigar), match_buffer_size, num_threads,
+                                                                  paf_filter.active() ? &paf_filter : nullptr, &paf_stats, sparse_match_mode, sparse_match_window, i);
+                }
+            }
+            if (args::get(show_progress)) std::cerr << "[seqwish::alignments] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " " << paf_stats.kept_rows << " of " << paf_stats.rows << " rows kept, giving " << paf_stats.matches << " matches of " << paf_stats.match_bp << "bp" << std::endl;
+            if (args::get(show_progress)) std::cerr << "[seqwish::alignments] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " " << match_buffer_flushes << " match buffer flushes" << std::endl;
+            for (auto& file : match_files) {
+                match_file_stats_t stats = read_match_file(file, &aln_iitree, seqidx, args::get(min_match_len));
+                if (args::get(show_progress)) std::cerr << "[seqwish::alignments] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " read " << stats.kept << " of " << stats.records << " match records from " << file << std::endl;
             }
-            unpack_paf_alignments(file, aln_iitree, seqidx, min_length, sparse_match, num_threads);
+            if (args::get(show_progress)) std::cerr << "[seqwish::alignments] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " indexing" << std::endl;
+            aln_iitree.index(num_threads);
+            if (args::get(show_progress)) std::cerr << "[seqwish::alignments] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " index built" << std::endl;
+            checkpoint.complete("alignments");
+        }
+        if (write_matches) {
+            write_match_file(args::get(write_matches), aln_iitree, seqidx);
+            if (args::get(show_progress)) std::cerr << "[seqwish::alignments] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " wrote " << aln_iitree.size() << " match records to " << args::get(write_matches) << std::endl;
         }
     }
-    if (args::get(show_progress)) std::cerr << "[seqwish::alignments] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " indexing" << std::endl;
-    aln_iitree.index(num_threads);
-    if (args::get(show_progress)) std::cerr << "[seqwish::alignments] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " index built" << std::endl;
+    log_step_memory("alignments", memory_plan.alignments);
     //if (args::get(debug)) dump_paf_alignments(args::get(paf_alns));
     //uint64_t n_domains = std::max((uint64_t)1, (uint64_t)args::get(num_domains));
     //range_pos_iitii aln_iitree = aln_iitree_builder.build(n_domains);
 
-    if (args::get(verbose_debug)) {
-        for (auto& interval : aln_iitree) {
+    if (args::get(verbose_debug) && aln_iitree_ptr) {
+        for (auto& interval : *aln_iitree_ptr) {
             std::cerr << "aln_iitree " << interval.st << "-" << interval.en << " " << pos_to_string(interval.data) << std::endl;
         }
     }
 
     // 3) find the transitive closures via the alignments and construct the graph sequence S, and the N and P interval sets
-    const std::string seq_v_file = temp_file::create("seqwish-", ".sqs");
-    const std::string node_iitree_idx = temp_file::create("seqwish-", ".sqn");
-    const std::string path_iitree_idx = temp_file::create("seqwish-", ".sqp");
+    if (closure_shard && !closure_done) {
+        // close our shard into the shared directory, leaving the rest to the run that merges them
+        uint64_t i = args::get(closure_shard);
+        auto shards = plan_closure_shards(seqidx, *aln_iitree_ptr, args::get(closure_shards), num_threads);
+        auto& shard = shards[i];
+        if (args::get(show_progress)) std::cerr << "[seqwish::shard] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " closing shard " << i << " of " << shards.size() << " over " << shard.begin << "-" << shard.end << std::endl;
+        make_closure_shard_dir(args::get(shard_dir));
+        mmmulti::iitree<uint64_t, pos_t> shard_nodes(closure_shard_file(args::get(shard_dir), i, ".sqn"));
+        mmmulti::iitree<uint64_t, pos_t> shard_paths(closure_shard_file(args::get(shard_dir), i, ".sqp"));
+        size_t shard_length = 0;
+        if (shard.begin < shard.end) {
+            shard_length = compute_transitive_closures(seqidx, *aln_iitree_ptr, closure_shard_file(args::get(shard_dir), i, ".sqs"),
+                                                       shard_nodes, shard_paths,
+                                                       args::get(repeat_max),
+                                                       args::get(min_repeat_dist),
+                                                       transclose_batch_size,
+                                                       args::get(adaptive_batch),
+                                                       transclose_mem_limit,
+                                                       args::get(show_progress),
+                                                       num_threads,
+                                                       start_time,
+                                                       shard.begin,
+                                                       shard.end);
+        } else if (args::get(show_progress)) {
+            std::cerr << "[seqwish::shard] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " shard " << i << " is empty, the alignments join the input into fewer shards" << std::endl;
+        }
+        finish_closure_shard(args::get(shard_dir), i, shard_length);
+        if (args::get(show_progress)) std::cerr << "[seqwish::shard] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " closed shard " << i << " into " << shard_length << "bp" << std::endl;
+        log_step_memory("transclosure", memory_plan.transclosure);
+        if (profile_out) {
+            profile().write(args::get(profile_out));
+        }
+        return 0;
+    }
+    const std::string seq_v_file = checkpoint.file("transclosure", ".sqs");
+    const std::string node_iitree_idx = checkpoint.file("transclosure", ".sqn");
+    const std::string path_iitree_idx = checkpoint.file("transclosure", ".sqp");
     auto node_iitree_ptr = std::make_unique<mmmulti::iitree<uint64_t, pos_t>>(node_iitree_idx); // maps graph seq to input seq
     auto& node_iitree = *node_iitree_ptr;
     auto path_iitree_ptr = std::make_unique<mmmulti::iitree<uint64_t, pos_t>>(path_iitree_idx); // maps input seq to graph seq
     auto& path_iitree = *path_iitree_ptr;
-    if (args::get(show_progress)) std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " computing transitive closures" << std::endl;
-    size_t graph_length = compute_transitive_closures(seqidx, aln_iitree, seq_v_file, node_iitree, path_iitree,
-                                                      args::get(repeat_max),
-                                                      args::get(min_repeat_dist),
-                                                      transclose_batch ? (uint64_t)seqwish::handy_parameter(args::get(transclose_batch), 1000000) : 1000000,
-                                                      args::get(show_progress),
-                                                      num_threads,
-                                                      start_time);
-    if (args::get(show_progress)) std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " done with transitive closures" << std::endl;
+    size_t graph_length = 0;
+    if (closure_done) {
+        graph_length = checkpoint.value("transclosure");
+        index_together(node_iitree, path_iitree, num_threads);
+        if (args::get(show_progress)) std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " graph of " << graph_length << "bp loaded from " << seq_v_file << std::endl;
+    } else if (merge_shards) {
+        graph_length = merge_closure_shards(args::get(shard_dir), args::get(closure_shards), seq_v_file, node_iitree, path_iitree, num_threads);
+        if (args::get(show_progress)) std::cerr << "[seqwish::shard] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " merged " << args::get(closure_shards) << " shards into a graph of " << graph_length << "bp" << std::endl;
+        checkpoint.complete("transclosure", graph_length);
+    } else if (extend_dir) {
+        if (args::get(show_progress)) std::cerr << "[seqwish::extend] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " extending the graph in " << base_graph.dir << " with " << seqidx.n_seqs() - base_graph.n_seqs << " sequences" << std::endl;
+        graph_length = extend_transitive_closures(seqidx, base_graph, *aln_iitree_ptr, seq_v_file, node_iitree, path_iitree,
+                                                  args::get(show_progress),
+                                                  num_threads,
+                                                  start_time);
+        checkpoint.complete("transclosure", graph_length);
+    } else {
+        if (args::get(show_progress)) std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " computing transitive closures" << std::endl;
+        graph_length = compute_transitive_closures(seqidx, *aln_iitree_ptr, seq_v_file, node_iitree, path_iitree,
+                                                   args::get(repeat_max),
+                                                   args::get(min_repeat_dist),
+                                                   transclose_batch_size,
+                                                   args::get(adaptive_batch),
+                                                   transclose_mem_limit,
+                                                   args::get(show_progress),
+                                                   num_threads,
+                                                   start_time);
+        if (args::get(show_progress)) std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " done with transitive closures" << std::endl;
+        checkpoint.complete("transclosure", graph_length);
+    }
+    log_step_memory("transclosure", memory_plan.transclosure);
 
     if (args::get(verbose_debug)) {
         for (auto& interval : node_iitree) {
@@ -189,40 +543,82 @@ int main(int argc, char** argv) {
     }
 
     // 4) generate the node id index (I) by compressing non-bifurcating regions of the graph into nodes
-    if (args::get(show_progress)) std::cerr << "[seqwish::compact] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " compacting nodes" << std::endl;
-    sdsl::bit_vector seq_id_bv(graph_length+1);
-    compact_nodes(seqidx, graph_length, node_iitree, path_iitree, seq_id_bv, num_threads);
-    if (args::get(show_progress)) std::cerr << "[seqwish::compact] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " done compacting" << std::endl;
-    if (args::get(verbose_debug)) std::cerr << seq_id_bv << std::endl;
     sdsl::sd_vector<> seq_id_cbv;
     sdsl::sd_vector<>::rank_1_type seq_id_cbv_rank;
     sdsl::sd_vector<>::select_1_type seq_id_cbv_select;
-    sdsl::util::assign(seq_id_cbv, sdsl::sd_vector<>(seq_id_bv));
-    seq_id_bv = sdsl::bit_vector(); // clear bitvector
+    if (checkpoint.done("compact", "")) {
+        sdsl::load_from_file(seq_id_cbv, checkpoint.file("compact", ".sqc"));
+        if (args::get(show_progress)) std::cerr << "[seqwish::compact] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " node index loaded from " << checkpoint.file("compact", ".sqc") << std::endl;
+    } else {
+        if (args::get(show_progress)) std::cerr << "[seqwish::compact] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " compacting nodes" << std::endl;
+        compact_nodes(seqidx, graph_length, node_iitree, path_iitree, seq_id_cbv, num_threads);
+        if (args::get(show_progress)) std::cerr << "[seqwish::compact] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " done compacting" << std::endl;
+        if (args::get(verbose_debug)) {
+            for (uint64_t i = 0; i < seq_id_cbv.size(); ++i) std::cerr << seq_id_cbv[i];
+            std::cerr << std::endl;
+        }
+        if (checkpoint.enabled()) {
+            sdsl::store_to_file(seq_id_cbv, checkpoint.file("compact", ".sqc"));
+            checkpoint.complete("compact");
+        }
+    }
     sdsl::util::assign(seq_id_cbv_rank, sdsl::sd_vector<>::rank_1_type(&seq_id_cbv));
     sdsl::util::assign(seq_id_cbv_select, sdsl::sd_vector<>::select_1_type(&seq_id_cbv));
     if (args::get(show_progress)) std::cerr << "[seqwish::compact] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " built node index" << std::endl;
+    log_step_memory("compact", memory_plan.compact);
+
+    // optionally, find the steps of the paths once for the links and all the outputs
+    std::unique_ptr<path_steps_t> path_steps;
+    if (args::get(step_index)) {
+        if (args::get(show_progress)) std::cerr << "[seqwish::steps] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " indexing path steps" << std::endl;
+        path_steps = std::make_unique<path_steps_t>(temp_file::create("seqwish-", ".sqt"));
+        path_steps->build(path_iitree, seq_v_file, seq_id_cbv, seq_id_cbv_rank, seq_id_cbv_select, seqidx, validate_mode, num_threads);
+        if (args::get(show_progress)) std::cerr << "[seqwish::steps] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " indexed " << path_steps->size() << " path steps" << std::endl;
+    }
 
     // 5) determine links between nodes
     if (args::get(show_progress)) std::cerr << "[seqwish::links] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " finding graph links" << std::endl;
-    const std::string link_mm_idx =  temp_file::create("seqwish-", ".sql");
+    const std::string link_mm_idx = checkpoint.file("links", ".sql");
     auto link_mmset_ptr = std::make_unique<mmmulti::set<std::pair<pos_t, pos_t>>>(link_mm_idx);
     auto& link_mmset = *link_mmset_ptr;
-    derive_links(seqidx, node_iitree, path_iitree, seq_id_cbv, seq_id_cbv_rank, seq_id_cbv_select, link_mmset, num_threads);
+    if (checkpoint.done("links", "")) {
+        link_mmset.index(num_threads);
+        if (args::get(show_progress)) std::cerr << "[seqwish::links] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " links loaded from " << link_mm_idx << std::endl;
+    } else if (path_steps) {
+        derive_links(*path_steps, link_mmset, num_threads);
+        checkpoint.complete("links");
+    } else {
+        derive_links(seqidx, path_iitree, seq_id_cbv, seq_id_cbv_rank, seq_id_cbv_select, link_mmset, num_threads);
+        checkpoint.complete("links");
+    }
     if (args::get(show_progress)) std::cerr << "[seqwish::links] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " links derived" << std::endl;
+    log_step_memory("links", memory_plan.links);
 
-    // 6) emit the graph in GFA or VGP format
+    // 6) emit the graph in GFA, VGP or our binary format
     if (args::get(show_progress)) std::cerr << "[seqwish::gfa] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " writing graph" << std::endl;
     if (!args::get(gfa_out).empty()) {
-        std::ofstream out(args::get(gfa_out).c_str());
-        emit_gfa(out, graph_length, seq_v_file, node_iitree, path_iitree, seq_id_cbv, seq_id_cbv_rank, seq_id_cbv_select, seqidx, link_mmset, num_threads);
-    /*} else if (!args::get(vgp_base).empty()) {
-        assert(false);
-        //emit_vgp(args::get(vgp_base), graph_length, seq_v_file, path_mm, link_fwd_mm, link_rev_mm, seq_id_cbv, seq_id_cbv_rank, seq_id_cbv_select, seqidx);
-    */} else {
-        emit_gfa(std::cout, graph_length, seq_v_file, node_iitree, path_iitree, seq_id_cbv, seq_id_cbv_rank, seq_id_cbv_select, seqidx, link_mmset, num_threads);
+        buffered_writer_t out(args::get(gfa_out), args::get(direct_io), num_threads);
+        emit_gfa(out, graph_length, seq_v_file, node_iitree, path_iitree, seq_id_cbv, seq_id_cbv_rank, seq_id_cbv_select, seqidx, link_mmset, validate_mode, num_threads, path_steps.get());
+    } else if (args::get(binary_out).empty() && args::get(vgp_base).empty()) {
+        buffered_writer_t out(STDOUT_FILENO);
+        emit_gfa(out, graph_length, seq_v_file, node_iitree, path_iitree, seq_id_cbv, seq_id_cbv_rank, seq_id_cbv_select, seqidx, link_mmset, validate_mode, num_threads, path_steps.get());
+    }
+    if (!args::get(binary_out).empty()) {
+        emit_binary_graph(args::get(binary_out), graph_length, seq_v_file, path_iitree, seq_id_cbv, seq_id_cbv_rank, seq_id_cbv_select, seqidx, link_mmset, validate_mode, num_threads, path_steps.get());
+    }
+    if (!args::get(vgp_base).empty()) {
+        emit_vgp(args::get(vgp_base), graph_length, seq_v_file, path_iitree, seq_id_cbv, seq_id_cbv_rank, seq_id_cbv_select, seqidx, link_mmset, validate_mode, num_threads, path_steps.get());
     }
     if (args::get(show_progress)) std::cerr << "[seqwish::gfa] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " done" << std::endl;
+    log_step_memory("gfa", memory_plan.gfa);
+    if (args::get(show_progress)) {
+        std::cerr << "[seqwish::backoff] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " idle threads: ";
+        log_backoff_stats(std::cerr);
+        std::cerr << std::endl;
+    }
+    if (profile_out) {
+        profile().write(args::get(profile_out));
+    }
 
     return(0);
 }
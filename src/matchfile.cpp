@@ -0,0 +1,124 @@
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include "matchfile.hpp"
+#include "bufwriter.hpp"
+#include "mmap.hpp"
+
+namespace seqwish {
+
+// FNV-1a of the names and lengths of the input sequences, which fix every position in Q
+static uint64_t seq_fingerprint(const seqindex_t& seqidx) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    auto add = [&](const char* data, const size_t& len) {
+        for (size_t i = 0; i < len; ++i) {
+            h ^= (uint8_t)data[i];
+            h *= 0x100000001b3ULL;
+        }
+    };
+    for (uint64_t i = 1; i <= seqidx.n_seqs(); ++i) {
+        std::string name = seqidx.nth_name(i);
+        uint64_t length = seqidx.nth_seq_length(i);
+        add(name.data(), name.size() + 1);
+        add((const char*)&length, sizeof(length));
+    }
+    return h;
+}
+
+static inline char* put_varint(char* p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (char)v;
+    return p;
+}
+
+static inline bool get_varint(const char*& p, const char* end, uint64_t& v) {
+    v = 0;
+    for (uint64_t shift = 0; p != end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+void write_match_file(const std::string& filename,
+                      mmmulti::iitree<uint64_t, pos_t>& aln_iitree,
+                      const seqindex_t& seqidx) {
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        std::cerr << "[seqwish::matchfile] error: could not open " << filename << " for writing" << std::endl;
+        exit(1);
+    }
+    std::vector<uint64_t> header(6);
+    memcpy(&header[0], match_file_magic, 8);
+    header[1] = match_file_version;
+    header[2] = seq_fingerprint(seqidx);
+    header[3] = seqidx.n_seqs();
+    header[4] = seqidx.seq_length();
+    header[5] = aln_iitree.size();
+    {
+        buffered_writer_t out(fd);
+        out.write((const char*)header.data(), header.size() * sizeof(uint64_t));
+        char record[30];
+        uint64_t last_start = 0;
+        for (uint64_t k = 0; k < aln_iitree.size(); ++k) {
+            uint64_t start = aln_iitree.start(k);
+            char* p = put_varint(record, start - last_start);
+            p = put_varint(p, aln_iitree.end(k) - start);
+            p = put_varint(p, aln_iitree.data(k));
+            out.write(record, p - record);
+            last_start = start;
+        }
+    }
+    close(fd);
+}
+
+match_file_stats_t read_match_file(const std::string& filename,
+                                   mmmulti::iitree<uint64_t, pos_t>* aln_iitree,
+                                   const seqindex_t& seqidx,
+                                   const uint64_t& min_match_len) {
+    int fd = -1;
+    char* buf = nullptr;
+    size_t size = mmap_open(filename, buf, fd);
+    uint64_t header[6];
+    if (size < sizeof(header)) {
+        std::cerr << "[seqwish::matchfile] error: " << filename << " is not a match file" << std::endl;
+        exit(1);
+    }
+    memcpy(header, buf, sizeof(header));
+    if (memcmp(&header[0], match_file_magic, 8) != 0 || header[1] != match_file_version) {
+        std::cerr << "[seqwish::matchfile] error: " << filename << " is not a match file of version " << match_file_version << std::endl;
+        exit(1);
+    }
+    if (header[2] != seq_fingerprint(seqidx) || header[3] != seqidx.n_seqs() || header[4] != seqidx.seq_length()) {
+        std::cerr << "[seqwish::matchfile] error: " << filename << " was written against other input sequences" << std::endl;
+        exit(1);
+    }
+    const char* p = buf + sizeof(header);
+    const char* end = buf + size;
+    match_file_stats_t stats;
+    stats.records = header[5];
+    uint64_t start = 0;
+    for (uint64_t k = 0; k < header[5]; ++k) {
+        uint64_t delta, length, pos;
+        if (!get_varint(p, end, delta) || !get_varint(p, end, length) || !get_varint(p, end, pos)) {
+            std::cerr << "[seqwish::matchfile] error: " << filename << " ends after " << k << " of its " << header[5] << " records" << std::endl;
+            exit(1);
+        }
+        start += delta;
+        // each record is a whole match, as -k saw it in the run that wrote the file
+        if (length < min_match_len) continue;
+        ++stats.kept;
+        stats.kept_bp += length;
+        if (aln_iitree) aln_iitree->add(start, start + length, pos);
+    }
+    mmap_close(buf, fd, size);
+    return stats;
+}
+
+}
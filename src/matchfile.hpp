@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include "mmiitree.hpp"
+#include "seqindex.hpp"
+#include "pos.hpp"
+
+namespace seqwish {
+
+/*
+The exact matches of the alignment index, kept in a file so that later runs
+on the same sequences can read them instead of the PAFs. The header holds 6
+unsigned 64-bit integers, in the byte order of the machine that wrote it:
+  magic "SQWMATCH", version (1), a hash of the names and lengths of the input
+  sequences, their number, their total length, and the number of records
+The records follow in order of their start in Q, each as three LEB128
+varints: the start less that of the record before, the length, and the
+pos_t in Q that the start matches. A match is recorded once in each of its
+directions, as in the alignment index.
+*/
+
+const char match_file_magic[8] = { 'S', 'Q', 'W', 'M', 'A', 'T', 'C', 'H' };
+const uint64_t match_file_version = 1;
+
+// write the records of the indexed aln_iitree to filename
+void write_match_file(const std::string& filename,
+                      mmmulti::iitree<uint64_t, pos_t>& aln_iitree,
+                      const seqindex_t& seqidx);
+
+// what we read from a match file
+struct match_file_stats_t {
+    uint64_t records = 0; // in the file
+    uint64_t kept = 0;    // at least min_match_len long
+    uint64_t kept_bp = 0;
+};
+
+// add the records of filename at least min_match_len long to aln_iitree, or only count them if it's null
+// the file must have been written against the same input sequences
+match_file_stats_t read_match_file(const std::string& filename,
+                                   mmmulti::iitree<uint64_t, pos_t>* aln_iitree,
+                                   const seqindex_t& seqidx,
+                                   const uint64_t& min_match_len = 0);
+
+}
@@ -0,0 +1,172 @@
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include "memplan.hpp"
+#include "gzstream.h"
+#include "paf.hpp"
+
+namespace seqwish {
+
+// how much we expect gzip to have shrunk a PAF
+static const uint64_t paf_gzip_ratio = 4;
+// the PAF reader queues up to this many blocks
+static const uint64_t paf_queued_blocks = 512;
+static const uint64_t paf_block_bytes = 1 << 20;
+// what an interval takes in an iitree
+static const uint64_t iitree_interval_bytes = 32;
+
+static uint64_t read_status_kb(const std::string& field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, field.size(), field) == 0 && line[field.size()] == ':') {
+            return std::stoull(line.substr(field.size() + 1));
+        }
+    }
+    return 0;
+}
+
+uint64_t current_rss_bytes(void) {
+    return read_status_kb("VmRSS") * 1024;
+}
+
+uint64_t peak_rss_bytes(void) {
+    uint64_t kb = read_status_kb("VmHWM");
+    if (kb == 0) {
+        // no procfs, so take the peak over the whole run
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        kb = usage.ru_maxrss;
+    }
+    return kb * 1024;
+}
+
+void reset_peak_rss(void) {
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    if (clear_refs.good()) clear_refs << "5" << std::endl;
+}
+
+std::string format_bytes(const uint64_t& bytes) {
+    const char* units[] = { "B", "kB", "MB", "GB", "TB" };
+    double v = bytes;
+    int u = 0;
+    while (v >= 1000 && u < 4) {
+        v /= 1000;
+        ++u;
+    }
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(u ? 2 : 0) << v << units[u];
+    return ss.str();
+}
+
+static bool file_is_gzip(const std::string& filename) {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    unsigned char magic[2] = { 0, 0 };
+    in.read((char*)magic, 2);
+    return in.gcount() == 2 && magic[0] == 31 && magic[1] == 139;
+}
+
+paf_sample_t sample_pafs(const std::vector<std::string>& paf_files, const uint64_t& max_rows) {
+    paf_sample_t sample;
+    uint64_t rows = 0, bytes = 0, aligned = 0, ops = 0;
+    for (auto& file : paf_files) {
+        struct stat st;
+        if (stat(file.c_str(), &st) == 0) {
+            sample.text_bytes += (uint64_t)st.st_size * (file_is_gzip(file) ? paf_gzip_ratio : 1);
+        }
+        igzstream in(file.c_str());
+        std::string line;
+        paf_row_t paf;
+        uint64_t file_rows = 0;
+        while (file_rows < max_rows && std::getline(in, line)) {
+            if (line.empty()) continue;
+            paf.parse(line.data(), line.data() + line.size());
+            bytes += line.size() + 1;
+            aligned += paf.query_end - paf.query_start;
+            for (auto& c : paf.cigar) {
+                if (c.op == 'M' || c.op == '=') ++ops;
+            }
+            ++file_rows;
+        }
+        rows += file_rows;
+    }
+    if (rows) {
+        sample.row_bytes = (double)bytes / rows;
+        sample.aligned_bp = (double)aligned / rows;
+        sample.match_ops = (double)ops / rows;
+    }
+    return sample;
+}
+
+void memory_plan_t::estimate(const uint64_t& seq_length,
+                             const uint64_t& seq_count,
+                             const paf_sample_t& paf,
+                             const uint64_t& batch_size,
+                             const uint64_t& match_buffer_size,
+                             const uint64_t& num_threads,
+                             const uint64_t& base_bytes,
+                             const bool& packed_seqs) {
+    double L = std::max((uint64_t)1, seq_length);
+    double rows = paf.row_bytes > 0 ? paf.text_bytes / paf.row_bytes : 0;
+    // each match lands in the alignment tree once from each side
+    double intervals = 2 * rows * std::max(1.0, paf.match_ops);
+    double aln_tree = intervals * iitree_interval_bytes;
+    // how many copies of each base we expect a closure to gather
+    double depth = 1 + 2 * rows * paf.aligned_bp / L;
+    // the names, their index and the mapped sequences
+    seqidx = base_bytes + (packed_seqs ? L / 4 : L) + seq_count * 64;
+    uint64_t queued_text = std::min(paf_queued_blocks, paf.text_bytes / paf_block_bytes + 1) * paf_block_bytes;
+    alignments = seqidx + num_threads * match_buffer_size * 24 + queued_text + aln_tree;
+    // the tree and the seen and current bitvectors over Q
+    closure_fixed = seqidx + aln_tree + L / 4;
+    // each touched base has a dset entry and a disjoint set entry (32 bytes),
+    // and each overlap an entry and a touched range (48 bytes)
+    closure_depth = depth;
+    closure_per_touched_bp = 32 + 48 * intervals / L;
+    closure_length = L;
+    transclose_batch_size = batch_size;
+    transclosure = closure_bytes(batch_size);
+    // the graph is at most as long as Q, and its node and path trees at most as large as the alignment tree
+    // compaction holds a block of node boundaries per thread, two for each of its 1M node ranges
+    compact = seqidx + aln_tree + num_threads * (1 << 20) * 16;
+    links = seqidx + L / 8 + aln_tree + intervals * 16;
+    gfa = links + L;
+}
+
+uint64_t memory_plan_t::closure_bytes(const uint64_t& batch_size) const {
+    // a batch touches the closures of its bases, but no more than all of Q,
+    // and we can't have more batches in flight than there are batches
+    double touched = std::min(closure_length, batch_size * closure_depth);
+    double in_flight = std::min((double)closure_batches_in_flight, std::ceil(closure_length / std::max(1.0, touched)));
+    return closure_fixed + in_flight * touched * closure_per_touched_bp;
+}
+
+uint64_t memory_plan_t::fit_batch(const uint64_t& max_bytes, const uint64_t& batch_size) const {
+    uint64_t fit = batch_size;
+    if (max_bytes <= closure_fixed) {
+        fit = min_fit_batch_size;
+    } else if (closure_bytes(batch_size) > max_bytes) {
+        double touched = (max_bytes - closure_fixed) / (closure_batches_in_flight * closure_per_touched_bp);
+        fit = std::max(min_fit_batch_size, (uint64_t)(touched / closure_depth));
+    }
+    return std::min(fit, batch_size);
+}
+
+uint64_t memory_plan_t::peak(void) const {
+    return std::max({ seqidx, alignments, transclosure, compact, links, gfa });
+}
+
+void memory_plan_t::print(std::ostream& out) const {
+    out << "seqidx " << format_bytes(seqidx)
+        << " alignments " << format_bytes(alignments)
+        << " transclosure " << format_bytes(transclosure) << " (batch " << transclose_batch_size << ")"
+        << " compact " << format_bytes(compact)
+        << " links " << format_bytes(links)
+        << " gfa " << format_bytes(gfa);
+}
+
+}
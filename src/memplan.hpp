@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+
+namespace seqwish {
+
+/*
+A rough model of the memory each step of the induction needs, and the
+means to check it against what we actually used. The model counts heap
+structures and the mapped files each step walks through, as both end up
+in our resident set.
+*/
+
+// the closure pipeline's stages (explore, union, sort, emit) each hold a batch while they work on it,
+// and each of the queues between them holds up to closure_batch_queue_capacity more
+const uint64_t closure_pipeline_stages = 4;
+const uint64_t closure_pipeline_queues = closure_pipeline_stages - 1;
+const uint64_t closure_batch_queue_capacity = 2;
+// so at most this many batches are alive at once
+const uint64_t closure_batches_in_flight = closure_pipeline_stages + closure_pipeline_queues * closure_batch_queue_capacity;
+// the smallest batch we'll pick to fit a memory limit
+const uint64_t min_fit_batch_size = 1000;
+
+// resident set size of the process, now and at its peak since the last reset
+uint64_t current_rss_bytes(void);
+uint64_t peak_rss_bytes(void);
+// restart the peak from the current resident set, where the kernel lets us
+void reset_peak_rss(void);
+
+// e.g. 1.23GB, in the same decimal units as our size parameters
+std::string format_bytes(const uint64_t& bytes);
+
+// what the first rows of the PAF inputs tell us about all of them
+struct paf_sample_t {
+    double row_bytes = 0;   // mean bytes of text per row
+    double aligned_bp = 0;  // mean query bases per row
+    double match_ops = 0;   // mean M and = operations per row
+    uint64_t text_bytes = 0; // estimated uncompressed size of all the inputs
+};
+
+paf_sample_t sample_pafs(const std::vector<std::string>& paf_files, const uint64_t& max_rows = 10000);
+
+struct memory_plan_t {
+    // estimated peak bytes per step
+    uint64_t seqidx = 0;
+    uint64_t alignments = 0;
+    uint64_t transclosure = 0;
+    uint64_t compact = 0;
+    uint64_t links = 0;
+    uint64_t gfa = 0;
+    // the transitive closure needs closure_fixed, plus closure_per_touched_bp for each base
+    // its batches touch, which are about closure_depth times the bases they start from
+    uint64_t closure_fixed = 0;
+    double closure_depth = 1;
+    double closure_per_touched_bp = 0;
+    double closure_length = 0;
+    uint64_t transclose_batch_size = 0;
+    void estimate(const uint64_t& seq_length,
+                  const uint64_t& seq_count,
+                  const paf_sample_t& paf,
+                  const uint64_t& batch_size,
+                  const uint64_t& match_buffer_size,
+                  const uint64_t& num_threads,
+                  const uint64_t& base_bytes, // what the process holds before we start
+                  const bool& packed_seqs = false); // the input sequences take 2 bits a base
+    // the largest batch no longer than batch_size whose closure fits in max_bytes,
+    // though never below a floor that keeps the closure from crawling
+    uint64_t fit_batch(const uint64_t& max_bytes, const uint64_t& batch_size) const;
+    uint64_t closure_bytes(const uint64_t& batch_size) const;
+    uint64_t peak(void) const;
+    void print(std::ostream& out) const;
+};
+
+}
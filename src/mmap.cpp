@@ -1,8 +1,93 @@
+#include <fstream>
+#include <vector>
+#include <sys/syscall.h>
 #include "mmap.hpp"
+#include "tokenize.hpp"
 
 namespace seqwish {
 
-size_t mmap_open(const std::string& filename, char*& buf, int& fd) {
+static map_policy_t map_policy = map_policy_t::willneed;
+static bool map_huge_pages = false;
+
+map_policy_t parse_map_policy(const std::string& policy) {
+    if (policy == "willneed") {
+        return map_policy_t::willneed;
+    } else if (policy == "access") {
+        return map_policy_t::access;
+    } else if (policy == "random") {
+        return map_policy_t::random;
+    } else if (policy == "sequential") {
+        return map_policy_t::sequential;
+    }
+    std::cerr << "[seqwish::mmap] error: unknown madvise policy " << policy << ", expected willneed, access, random or sequential" << std::endl;
+    exit(1);
+}
+
+void set_map_policy(const map_policy_t& policy, const bool& huge_pages) {
+    map_policy = policy;
+    map_huge_pages = huge_pages;
+}
+
+void advise_map(void* buf, const size_t& len, const map_access_t& access) {
+    if (buf == nullptr || len == 0) return;
+    switch (map_policy) {
+    case map_policy_t::willneed:
+        madvise(buf, len, MADV_WILLNEED);
+        break;
+    case map_policy_t::access:
+        madvise(buf, len, access == map_access_t::random ? MADV_RANDOM : MADV_SEQUENTIAL);
+        break;
+    case map_policy_t::random:
+        madvise(buf, len, MADV_RANDOM);
+        break;
+    case map_policy_t::sequential:
+        madvise(buf, len, MADV_SEQUENTIAL);
+        break;
+    }
+#ifdef MADV_HUGEPAGE
+    // file mappings get huge pages only where the kernel and file system support them, elsewhere this is a no-op
+    if (map_huge_pages) {
+        madvise(buf, len, MADV_HUGEPAGE);
+    }
+#endif
+}
+
+bool interleave_numa_nodes(void) {
+#ifdef SYS_set_mempolicy
+    // the online nodes, as a list of ranges like 0-3,5
+    std::ifstream in("/sys/devices/system/node/online");
+    std::string line;
+    if (!std::getline(in, line)) {
+        return false;
+    }
+    std::vector<std::string> ranges;
+    tokenize(line, ranges, ",", true);
+    std::vector<unsigned long> mask;
+    const uint64_t bits = sizeof(unsigned long) * 8;
+    uint64_t n_nodes = 0;
+    for (auto& range : ranges) {
+        std::vector<std::string> ends;
+        tokenize(range, ends, "-", true);
+        if (ends.empty()) continue;
+        uint64_t first = std::stoull(ends.front());
+        uint64_t last = std::stoull(ends.back());
+        for (uint64_t n = first; n <= last; ++n) {
+            if (mask.size() <= n / bits) mask.resize(n / bits + 1, 0);
+            mask[n / bits] |= 1UL << (n % bits);
+            ++n_nodes;
+        }
+    }
+    if (n_nodes < 2) {
+        return false;
+    }
+    const int mpol_interleave = 3; // MPOL_INTERLEAVE in linux/mempolicy.h
+    return syscall(SYS_set_mempolicy, mpol_interleave, mask.data(), mask.size() * bits) == 0;
+#else
+    return false;
+#endif
+}
+
+size_t mmap_open(const std::string& filename, char*& buf, int& fd, const map_access_t& access) {
     fd = -1;
     assert(!filename.empty());
     // open in binary mode as we are reading from this interface
@@ -24,7 +109,7 @@ size_t mmap_open(const std::string& filename, char*& buf, int& fd) {
                        0))) {
         assert(false);
     }
-    madvise((void*)buf, fsize, POSIX_MADV_WILLNEED | POSIX_MADV_SEQUENTIAL);
+    advise_map((void*)buf, fsize, access);
     return fsize;
 }
 
@@ -14,7 +14,25 @@
 
 namespace seqwish {
 
-size_t mmap_open(const std::string& filename, char*& buf, int& fd);
+// how a mapping will be read
+enum class map_access_t { sequential, random };
+
+// how we advise the kernel of our mappings: as we always have, with WILLNEED, by how each is read, or all one way
+enum class map_policy_t { willneed, access, random, sequential };
+
+map_policy_t parse_map_policy(const std::string& policy);
+
+// to be set before anything is mapped, asking for transparent huge pages too if huge_pages
+void set_map_policy(const map_policy_t& policy, const bool& huge_pages);
+
+// advise the kernel of how we'll read the mapping, as the policy says
+void advise_map(void* buf, const size_t& len, const map_access_t& access);
+
+// interleave the memory we allocate from here on, page cache included, across the NUMA nodes
+// returns false on a machine with a single node or a kernel without NUMA
+bool interleave_numa_nodes(void);
+
+size_t mmap_open(const std::string& filename, char*& buf, int& fd, const map_access_t& access = map_access_t::sequential);
 void mmap_close(char*& buf, int& fd, size_t fsize);
 
 }
@@ -1,33 +1,66 @@
 #include "paf.hpp"
 #include "tokenize.hpp"
+#include <cstring>
 
 namespace seqwish {
 
+// read an unsigned integer from the start of a field, as stoull would
+static uint64_t parse_uint(const char* b, const char* e) {
+    uint64_t v = 0;
+    while (b != e && *b >= '0' && *b <= '9') {
+        v = v * 10 + (*b++ - '0');
+    }
+    return v;
+}
+
 paf_row_t::paf_row_t(const std::string& line) {
-    std::vector<std::string> fields;
-    tokenize(line, fields, " \t");
-    query_sequence_name = fields[0];
-    query_sequence_length = std::stoull(fields[1]);
-    query_start = std::stoull(fields[2]);
-    query_end = std::stoull(fields[3]);
-    query_target_same_strand = (fields[4] == "+");
-    target_sequence_name = fields[5];
-    target_sequence_length = std::stoull(fields[6]);
-    target_start = std::stoull(fields[7]);
-    target_end = std::stoull(fields[8]);
-    num_matches = std::stoull(fields[9]);
-    alignment_block_length = std::stoull(fields[10]);
-    mapping_quality = std::stoi(fields[11]);
-    // find the cigar in the last fields
-    for (size_t i = 12; i < fields.size(); ++i) {
-        // cg:Z:
-        auto& f = fields[i];
-        //std::string::size_type n;
-        auto n = f.find("cg:Z:");
-        if (n == 0) {
-            cigar = cigar_from_string(f.substr(5));
+    parse(line.data(), line.data() + line.size());
+}
+
+void paf_row_t::parse(const char* begin, const char* end) {
+    cigar = cigar_view_t();
+    const char* b = begin;
+    for (size_t i = 0; b <= end; ++i) {
+        // fields are split on every space or tab, as tokenize(line, fields, " \t") does
+        const char* e = b;
+        while (e != end && *e != ' ' && *e != '\t') ++e;
+        switch (i) {
+        case 0: query_sequence_name.assign(b, e); break;
+        case 1: query_sequence_length = parse_uint(b, e); break;
+        case 2: query_start = parse_uint(b, e); break;
+        case 3: query_end = parse_uint(b, e); break;
+        case 4: query_target_same_strand = (e - b == 1 && *b == '+'); break;
+        case 5: target_sequence_name.assign(b, e); break;
+        case 6: target_sequence_length = parse_uint(b, e); break;
+        case 7: target_start = parse_uint(b, e); break;
+        case 8: target_end = parse_uint(b, e); break;
+        case 9: num_matches = parse_uint(b, e); break;
+        case 10: alignment_block_length = parse_uint(b, e); break;
+        case 11: mapping_quality = parse_uint(b, e); break;
+        default:
+            // find the cigar in the last fields
+            // cg:Z:
+            if (e - b >= 5 && std::memcmp(b, "cg:Z:", 5) == 0) {
+                cigar = cigar_view_t(b + 5, e);
+                return;
+            }
             break;
         }
+        b = e + 1;
+    }
+}
+
+void paf_row_t::parse_names(const char* begin, const char* end) {
+    const char* b = begin;
+    for (size_t i = 0; i <= 5 && b <= end; ++i) {
+        const char* e = b;
+        while (e != end && *e != ' ' && *e != '\t') ++e;
+        if (i == 0) {
+            query_sequence_name.assign(b, e);
+        } else if (i == 5) {
+            target_sequence_name.assign(b, e);
+        }
+        b = e + 1;
     }
 }
 
@@ -44,7 +77,8 @@ std::ostream& operator<<(std::ostream& out, const paf_row_t& pafrow) {
         << pafrow.num_matches << "\t"
         << pafrow.alignment_block_length << "\t"
         << pafrow.mapping_quality << "\t"
-        << "cg:Z:" << cigar_to_string(pafrow.cigar);
+        << "cg:Z:";
+    out.write(pafrow.cigar.data, pafrow.cigar.length);
     return out;
 }
 
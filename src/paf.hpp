@@ -23,8 +23,14 @@ public:
     uint64_t num_matches;
     uint64_t alignment_block_length;
     uint16_t mapping_quality;
-    cigar_t cigar;
+    // points into the line that was parsed, which must outlive this row
+    cigar_view_t cigar;
+    paf_row_t(void) { }
     paf_row_t(const std::string& l);
+    // parse the line in [begin, end) without copying it, reusing our name buffers
+    void parse(const char* begin, const char* end);
+    // parse only the query and target names of the line
+    void parse_names(const char* begin, const char* end);
     friend std::ostream& operator<<(std::ostream& out, const paf_row_t& pafrow);
 };
 
@@ -0,0 +1,176 @@
+#include <fstream>
+#include <iomanip>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include "profile.hpp"
+#include "backoff.hpp"
+#include "tempfile.hpp"
+#include "time.hpp"
+#include "version.hpp"
+
+namespace seqwish {
+
+static profile_counters_t global_profile_counters = { {0}, {0}, {0}, {0} };
+
+profile_counters_t& profile_counters(void) {
+    return global_profile_counters;
+}
+
+static profile_t global_profile;
+
+profile_t& profile(void) {
+    return global_profile;
+}
+
+static double cpu_seconds(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+        + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// bytes passed through read and write calls, including those served by the page cache
+static void io_bytes(uint64_t& read_bytes, uint64_t& write_bytes) {
+    read_bytes = write_bytes = 0;
+    std::ifstream io("/proc/self/io");
+    std::string field;
+    uint64_t value;
+    while (io >> field >> value) {
+        if (field == "rchar:") read_bytes = value;
+        else if (field == "wchar:") write_bytes = value;
+    }
+}
+
+static std::string json_string(const std::string& s) {
+    std::string out = "\"";
+    for (auto c : s) {
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if ((unsigned char)c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out.append(buf);
+        } else {
+            out.push_back(c);
+        }
+    }
+    out.push_back('"');
+    return out;
+}
+
+profile_t::profile_t(void) {
+    start_time = step_start = std::chrono::steady_clock::now();
+}
+
+void profile_t::enable(const uint64_t& num_threads) {
+    active = true;
+    threads = num_threads;
+    start_time = step_start = std::chrono::steady_clock::now();
+    step_cpu_start = cpu_seconds();
+    io_bytes(step_read_start, step_write_start);
+}
+
+void profile_t::end_step(const std::string& name, const uint64_t& peak_rss_bytes, const uint64_t& estimated_bytes) {
+    if (!active) return;
+    step_profile_t step;
+    step.name = name;
+    step.wall_seconds = seconds_since(step_start);
+    double cpu_now = cpu_seconds();
+    step.cpu_seconds = cpu_now - step_cpu_start;
+    step.peak_rss_bytes = peak_rss_bytes;
+    step.estimated_bytes = estimated_bytes;
+    uint64_t read_now, write_now;
+    io_bytes(read_now, write_now);
+    step.read_bytes = read_now - step_read_start;
+    step.write_bytes = write_now - step_write_start;
+    steps.push_back(step);
+    step_start = std::chrono::steady_clock::now();
+    step_cpu_start = cpu_now;
+    step_read_start = read_now;
+    step_write_start = write_now;
+}
+
+void profile_t::add_batch(const batch_profile_t& batch) {
+    if (!active) return;
+    std::lock_guard<std::mutex> guard(batches_mutex);
+    batches.push_back(batch);
+}
+
+void profile_t::write(const std::string& filename) const {
+    std::ofstream out(filename.c_str());
+    if (!out.good()) {
+        std::cerr << "[seqwish::profile] error: could not write profile to " << filename << std::endl;
+        exit(1);
+    }
+    out << std::fixed << std::setprecision(6);
+    out << "{\n";
+    out << "  \"version\": " << json_string(Version::get_version()) << ",\n";
+    out << "  \"threads\": " << threads << ",\n";
+    out << "  \"wall_seconds\": " << seconds_since(start_time) << ",\n";
+    out << "  \"steps\": [";
+    for (uint64_t i = 0; i < steps.size(); ++i) {
+        auto& s = steps[i];
+        // how busy the threads we were given kept the cpus
+        double utilization = s.wall_seconds > 0 ? s.cpu_seconds / (s.wall_seconds * threads) : 0;
+        out << (i ? ",\n" : "\n")
+            << "    {\"name\": " << json_string(s.name)
+            << ", \"wall_seconds\": " << s.wall_seconds
+            << ", \"cpu_seconds\": " << s.cpu_seconds
+            << ", \"thread_utilization\": " << utilization
+            << ", \"peak_rss_bytes\": " << s.peak_rss_bytes
+            << ", \"estimated_bytes\": " << s.estimated_bytes
+            << ", \"read_bytes\": " << s.read_bytes
+            << ", \"write_bytes\": " << s.write_bytes << "}";
+    }
+    out << "\n  ],\n";
+    out << "  \"transclosure_batches\": [";
+    for (uint64_t i = 0; i < batches.size(); ++i) {
+        auto& b = batches[i];
+        out << (i ? ",\n" : "\n")
+            << "    {\"chunk_start\": " << b.chunk_start
+            << ", \"chunk_end\": " << b.chunk_end
+            << ", \"aln_overlap_queries\": " << b.aln_overlap_queries
+            << ", \"overlaps\": " << b.overlaps
+            << ", \"touched_bases\": " << b.touched_bases
+            << ", \"closed_bases\": " << b.closed_bases
+            << ", \"union_ops\": " << b.union_ops
+            << ", \"explore_seconds\": " << b.explore_seconds
+            << ", \"union_seconds\": " << b.union_seconds
+            << ", \"sort_seconds\": " << b.sort_seconds
+            << ", \"emit_seconds\": " << b.emit_seconds << "}";
+    }
+    out << "\n  ],\n";
+    auto& counters = profile_counters();
+    out << "  \"counters\": {"
+        << "\"aln_overlap_queries\": " << counters.aln_overlap_queries.load()
+        << ", \"overlaps_explored\": " << counters.overlaps_explored.load()
+        << ", \"union_ops\": " << counters.union_ops.load()
+        << ", \"queue_full_retries\": " << counters.queue_full_retries.load() << "},\n";
+    auto& idle = backoff_stats();
+    out << "  \"idle_threads\": {"
+        << "\"spin_seconds\": " << idle.spin_ns.load() / 1e9
+        << ", \"yield_seconds\": " << idle.yield_ns.load() / 1e9
+        << ", \"park_seconds\": " << idle.park_ns.load() / 1e9
+        << ", \"parks\": " << idle.parks.load() << "},\n";
+    // the size each temp file ended at, as we removed it or as it is now
+    // most of them are mapped, so this is no count of the bytes read and written through them
+    out << "  \"temp_files\": [";
+    bool first = true;
+    for (auto& file : temp_file::removed()) {
+        out << (first ? "\n" : ",\n")
+            << "    {\"name\": " << json_string(file.first) << ", \"final_bytes\": " << file.second << ", \"removed\": true}";
+        first = false;
+    }
+    for (auto& file : temp_file::list()) {
+        struct stat st;
+        if (stat(file.c_str(), &st) != 0) continue;
+        out << (first ? "\n" : ",\n")
+            << "    {\"name\": " << json_string(file) << ", \"final_bytes\": " << (uint64_t)st.st_size << ", \"removed\": false}";
+        first = false;
+    }
+    out << "\n  ]\n";
+    out << "}\n";
+}
+
+}
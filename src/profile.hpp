@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+namespace seqwish {
+
+/*
+The machine-readable side of -P. The hot path counters below are always
+kept, as the threads that bump them add up their own counts first and only
+touch these once per batch or per worker. The step and batch records are
+only collected if we were asked to write a profile with --profile.
+*/
+
+struct profile_counters_t {
+    std::atomic<uint64_t> aln_overlap_queries;
+    std::atomic<uint64_t> overlaps_explored;
+    std::atomic<uint64_t> union_ops;
+    std::atomic<uint64_t> queue_full_retries;
+};
+
+profile_counters_t& profile_counters(void);
+
+struct step_profile_t {
+    std::string name;
+    double wall_seconds = 0;
+    double cpu_seconds = 0;
+    uint64_t peak_rss_bytes = 0;
+    uint64_t estimated_bytes = 0;
+    uint64_t read_bytes = 0;
+    uint64_t write_bytes = 0;
+};
+
+struct batch_profile_t {
+    uint64_t chunk_start = 0;
+    uint64_t chunk_end = 0;
+    uint64_t aln_overlap_queries = 0;
+    uint64_t overlaps = 0;
+    uint64_t touched_bases = 0;
+    uint64_t closed_bases = 0;
+    uint64_t union_ops = 0;
+    double explore_seconds = 0;
+    double union_seconds = 0;
+    double sort_seconds = 0;
+    double emit_seconds = 0;
+};
+
+class profile_t {
+public:
+    profile_t(void);
+    // start collecting, measuring the first step from now
+    void enable(const uint64_t& num_threads);
+    bool enabled(void) const { return active; }
+    // close the step that ran since the last one ended
+    void end_step(const std::string& name, const uint64_t& peak_rss_bytes, const uint64_t& estimated_bytes);
+    // may be called from any thread
+    void add_batch(const batch_profile_t& batch);
+    void write(const std::string& filename) const;
+
+private:
+    bool active = false;
+    uint64_t threads = 1;
+    std::chrono::time_point<std::chrono::steady_clock> start_time;
+    std::chrono::time_point<std::chrono::steady_clock> step_start;
+    double step_cpu_start = 0;
+    uint64_t step_read_start = 0;
+    uint64_t step_write_start = 0;
+    std::vector<step_profile_t> steps;
+    std::mutex batches_mutex;
+    std::vector<batch_profile_t> batches;
+};
+
+profile_t& profile(void);
+
+}
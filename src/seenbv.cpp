@@ -0,0 +1,87 @@
+#include "seenbv.hpp"
+#include <algorithm>
+
+namespace seqwish {
+
+seen_bv_t::seen_bv_t(const uint64_t& len)
+    : length(len),
+      words((len + 63) / 64, 0),
+      block_counts((len + block_size - 1) / block_size, 0) { }
+
+uint64_t seen_bv_t::block_length(const uint64_t& block) const {
+    return std::min(block_size, length - (block << block_bits));
+}
+
+uint64_t seen_bv_t::next_unset(uint64_t i, const uint64_t& end) const {
+    while (i < end) {
+        uint64_t block = i >> block_bits;
+        if (block_counts[block] == block_length(block)) {
+            // fully set, jump to the next block
+            i = (block + 1) << block_bits;
+            continue;
+        }
+        // look for an unset bit in this word, ignoring the bits below i
+        uint64_t unset = ~words[i >> 6] & (~(uint64_t)0 << (i & 63));
+        if (unset) {
+            return std::min(end, (i & ~(uint64_t)63) + __builtin_ctzll(unset));
+        }
+        i = (i & ~(uint64_t)63) + 64;
+    }
+    return end;
+}
+
+uint64_t seen_bv_t::next_set(uint64_t i, const uint64_t& end) const {
+    while (i < end) {
+        uint64_t block = i >> block_bits;
+        if (block_counts[block] == 0) {
+            // fully unset, jump to the next block
+            i = (block + 1) << block_bits;
+            continue;
+        }
+        uint64_t set = words[i >> 6] & (~(uint64_t)0 << (i & 63));
+        if (set) {
+            return std::min(end, (i & ~(uint64_t)63) + __builtin_ctzll(set));
+        }
+        i = (i & ~(uint64_t)63) + 64;
+    }
+    return end;
+}
+
+uint64_t seen_bv_t::after_nth_unset(uint64_t i, uint64_t n) const {
+    if (n == 0) return i;
+    // walk up to the next word boundary a bit at a time
+    while (i < length && (i & 63)) {
+        if (!(*this)[i] && --n == 0) return i + 1;
+        ++i;
+    }
+    while (i < length) {
+        uint64_t block = i >> block_bits;
+        if (!(i & (block_size - 1))) {
+            // take whole blocks while they hold fewer unset bits than we need
+            uint64_t unset = block_length(block) - block_counts[block];
+            if (unset < n) {
+                n -= unset;
+                i = std::min(length, (block + 1) << block_bits);
+                continue;
+            }
+        }
+        // then whole words, keeping only the bits that are within the sequence
+        uint64_t valid = std::min((uint64_t)64, length - i);
+        uint64_t unset = ~words[i >> 6];
+        if (valid < 64) unset &= ((uint64_t)1 << valid) - 1;
+        uint64_t c = __builtin_popcountll(unset);
+        if (c < n) {
+            n -= c;
+            i += valid;
+            continue;
+        }
+        // the n-th unset bit is in this word, so clear the lower ones to find it
+        while (--n) {
+            unset &= unset - 1;
+        }
+        return i + __builtin_ctzll(unset) + 1;
+    }
+    return length;
+}
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace seqwish {
+
+/*
+'seen_bv_t' is a plain bitvector over Q that remembers which bases we've
+already closed. Besides the bits themselves, we keep a count of the set
+bits in each block of 4096 positions, which lets scans skip blocks that are
+entirely set (or entirely unset) without looking at their words, and the
+rest of a scan moves a 64-bit word at a time using ctz and popcount.
+Setting bits isn't thread safe, but concurrent reads are fine.
+*/
+
+class seen_bv_t {
+public:
+    seen_bv_t(const uint64_t& length);
+    uint64_t size(void) const { return length; }
+    bool operator[](const uint64_t& i) const {
+        return (words[i >> 6] >> (i & 63)) & 1;
+    }
+    void set(const uint64_t& i) {
+        uint64_t bit = (uint64_t)1 << (i & 63);
+        uint64_t& word = words[i >> 6];
+        if (!(word & bit)) {
+            word |= bit;
+            ++block_counts[i >> block_bits];
+        }
+    }
+    // the first unset position in [begin, end), or end if there is none
+    uint64_t next_unset(uint64_t begin, const uint64_t& end) const;
+    // the first set position in [begin, end), or end if there is none
+    uint64_t next_set(uint64_t begin, const uint64_t& end) const;
+    // the position just past the n-th unset bit at or after begin, or size() if there aren't n
+    uint64_t after_nth_unset(uint64_t begin, uint64_t n) const;
+
+private:
+    static const uint64_t block_bits = 12;
+    static const uint64_t block_size = (uint64_t)1 << block_bits;
+    uint64_t length = 0;
+    std::vector<uint64_t> words;
+    std::vector<uint16_t> block_counts;
+    // the number of valid positions in the given block
+    uint64_t block_length(const uint64_t& block) const;
+};
+
+}
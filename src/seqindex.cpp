@@ -1,8 +1,28 @@
 #include "seqindex.hpp"
+#include "mmap.hpp"
 #include "tempfile.hpp"
+#include "wang.hpp"
+#include "sdsl/bits.hpp"
+#include "blockreader.hpp"
+#include "paryfor.hpp"
+#include "tokenize.hpp"
+#include "exists.hpp"
+#include <fcntl.h>
+#include <sstream>
+#include <cstdlib>
 
 namespace seqwish {
 
+// FNV-1a over the name, finished with a 64-bit mix
+uint64_t seq_name_hash(const std::string& name) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const char& c : name) {
+        h ^= (uint8_t)c;
+        h *= 0x100000001b3ULL;
+    }
+    return wang_hash_64(h);
+}
+
 // load a FASTA or FASTQ file into a file with a name index mapping name -> offset and indexed with a CSA
 // provide queries over this index that let us extract particular positions and subsequences
 void seqindex_t::set_base_filename() {
@@ -11,132 +31,572 @@ void seqindex_t::set_base_filename() {
     seqnamefile = temp_file::create("seqwish-", ".sqi.seqnames.tmp"); // used during construction
 }
 
-void seqindex_t::build_index(const std::string& filename) {
-    set_base_filename();
-    // read the file
-    igzstream in(filename.c_str());
-    std::ofstream seqnames(seqnamefile.c_str());
-    std::ofstream seqout(seqfilename.c_str());
+// one block of the input, parsed apart from the others
+// positions are relative to the sequence bytes that the block holds
+struct input_block_t {
+    uint64_t first_line = 0; // the index in the file of the first line of the block
+    std::string seq; // the upper-cased sequence bytes
+    std::vector<std::pair<uint64_t, std::string>> names; // where each header falls in seq, and its name
+    std::vector<uint64_t> n_boundaries; // where runs of N start and stop, after the first base
+};
+
+// append the bases from p to e to the block
+static void add_block_bases(const char* p, const char* e, input_block_t& block) {
+    bool in_n_run = !block.seq.empty() && block.seq.back() == 'N';
+    for (const char* c = p; c < e; ++c) {
+        // force the sequence to be upper-case
+        char b = (*c >= 'a' && *c <= 'z') ? *c - ('a' - 'A') : *c;
+        // note where runs of N start and stop
+        if ((b == 'N') != in_n_run) {
+            if (!block.seq.empty()) block.n_boundaries.push_back(block.seq.size());
+            in_n_run = !in_n_run;
+        }
+        block.seq.push_back(b);
+    }
+}
+
+static void clear_block(input_block_t& block, const uint64_t& size) {
+    block.seq.clear();
+    block.names.clear();
+    block.n_boundaries.clear();
+    block.seq.reserve(size);
+}
+
+static void parse_input_block(const std::string& text, const bool& input_is_fastq, input_block_t& block) {
+    clear_block(block, text.size());
+    uint64_t line_no = block.first_line;
+    const char* p = text.data();
+    const char* end = p + text.size();
+    while (p < end) {
+        const char* e = (const char*)memchr(p, '\n', end - p);
+        if (e == nullptr) e = end;
+        // the first line is always a header, as are those after each FASTQ record
+        bool is_header = input_is_fastq ? line_no % 4 == 0 : (line_no == 0 || *p == '>');
+        if (is_header) {
+            std::string line(p, e);
+            if (!line.empty()) line[0] = '>';
+            block.names.emplace_back(block.seq.size(), line.substr(0, line.find(' ')));
+        } else if (!input_is_fastq || line_no % 4 == 1) {
+            add_block_bases(p, e, block);
+        }
+        p = e + 1;
+        ++line_no;
+    }
+}
+
+static void pwrite_fully(int fd, const char* data, uint64_t len, uint64_t offset, const std::string& filename) {
+    while (len) {
+        ssize_t w = pwrite(fd, data, len, offset);
+        if (w <= 0) {
+            std::cerr << "[seqwish::seqindex] error: could not write to " << filename << std::endl;
+            exit(1);
+        }
+        data += w;
+        len -= w;
+        offset += w;
+    }
+}
+
+// what we learn of the input sequences, in their order, as their bases go into the sequence file
+struct seq_collector_t {
+    std::ofstream seqnames;
+    int seqout = -1;
+    std::string seqfilename;
     std::vector<uint64_t> seqname_offset;
     std::vector<uint64_t> seq_offset;
-    bool input_is_fasta=false, input_is_fastq=false;
-    // look at the first character to determine if it's fastq or fasta
-    std::string line;
-    std::getline(in, line);
-    if (line[0] == '>') {
-        input_is_fasta = true;
-    } else if (line[0] == '@') {
-        input_is_fastq = true;
-    } else {
-        std::cerr << "unknown file format given to seqindex_t" << std::endl;
-        assert(false);
-    }
+    std::vector<uint64_t> n_boundaries;
+    bool in_n_run = false;
     size_t seq_bytes_written = 0;
     size_t seq_names_bytes_written = 0;
     bool notified_empty_seqs = false;
-    while (in.good()) {
-        line[0] = '>';
-        std::string seq_name = line.substr(0, line.find(' '));
-
-        std::string seq;
-        // get the sequence
-        if (input_is_fasta) {
-            while (std::getline(in, line)) {
-                if (line[0] == '>') {
-                    // this is the header of the next sequence
-                    break;
-                } else {
-                    seq.append(line);
-                }
-            }
-        } else if (input_is_fastq) {
-            std::getline(in, seq);  // sequence
-            std::getline(in, line); // delimiter
-            std::getline(in, line); // quality
-            std::getline(in, line);
-        }
-        if (seq.empty()){
+    // a sequence of the given length starts at seq_start
+    void add_seq(const std::string& seq_name, const uint64_t& seq_start, const uint64_t& length) {
+        if (length == 0) {
             if (!notified_empty_seqs){
                 notified_empty_seqs = true;
                 std::cerr << "[seqwish] WARNING: input FASTA file contains empty sequences, which will be ignored." << std::endl;
             }
         } else {
             seqname_offset.push_back(seq_names_bytes_written);
-            seq_offset.push_back(seq_bytes_written);
-
+            seq_offset.push_back(seq_start);
             seqnames << seq_name << " ";
             seq_names_bytes_written += seq_name.size() + 1;
+        }
+    }
+    // the bases of the block follow those before, returning where they start
+    uint64_t add_bases(const input_block_t& block) {
+        uint64_t offset = seq_bytes_written;
+        if (!block.seq.empty()) {
+            if ((block.seq.front() == 'N') != in_n_run) {
+                n_boundaries.push_back(offset);
+            }
+            for (auto& b : block.n_boundaries) {
+                n_boundaries.push_back(offset + b);
+            }
+            in_n_run = block.seq.back() == 'N';
+        }
+        seq_bytes_written += block.seq.size();
+        return offset;
+    }
+    void write(const input_block_t& block, const uint64_t& offset) {
+        pwrite_fully(seqout, block.seq.data(), block.seq.size(), offset, seqfilename);
+    }
+};
+
+// read a FASTA or FASTQ file in blocks of whole lines, which are parsed in parallel
+// a sequential pass then places what each holds, and the blocks of sequence are written at their offsets
+static void read_seq_file(const std::string& filename, const uint64_t& num_threads, seq_collector_t& seqs) {
+    block_reader_t in(filename, num_threads, input_block_size);
+    if (!in.good()) {
+        std::cerr << "[seqwish::seqindex] error: could not open " << filename << std::endl;
+        exit(1);
+    }
+    bool input_is_fasta=false, input_is_fastq=false;
+    // the sequence we're in, waiting for its length to be known
+    bool in_seq = false;
+    std::string seq_name;
+    uint64_t seq_start = 0;
+    auto end_seq = [&](const uint64_t& seq_end) {
+        if (in_seq) seqs.add_seq(seq_name, seq_start, seq_end - seq_start);
+    };
+    const uint64_t window = std::max((uint64_t)1, num_threads) * 2;
+    std::vector<std::string> texts(window);
+    std::vector<input_block_t> blocks(window);
+    std::vector<uint64_t> block_offset(window);
+    uint64_t lines_read = 0;
+    bool more = true;
+    while (more) {
+        uint64_t n_blocks = 0;
+        while (n_blocks < window && (more = in.next(texts[n_blocks]))) {
+            if (!texts[n_blocks].empty()) ++n_blocks;
+        }
+        if (n_blocks == 0) break;
+        if (!input_is_fasta && !input_is_fastq) {
+            // look at the first character to determine if it's fastq or fasta
+            if (texts[0][0] == '>') {
+                input_is_fasta = true;
+            } else if (texts[0][0] == '@') {
+                input_is_fastq = true;
+            } else {
+                break;
+            }
+        }
+        // the FASTQ records are told apart by counting lines
+        if (input_is_fastq) {
+            paryfor::parallel_for<uint64_t>(
+                0, n_blocks, num_threads, 1,
+                [&](uint64_t i, int tid) {
+                    const std::string& t = texts[i];
+                    blocks[i].first_line = std::count(t.begin(), t.end(), '\n') + (t.back() != '\n');
+                });
+            for (uint64_t i = 0; i < n_blocks; ++i) {
+                uint64_t n_lines = blocks[i].first_line;
+                blocks[i].first_line = lines_read;
+                lines_read += n_lines;
+            }
+        } else {
+            for (uint64_t i = 0; i < n_blocks; ++i) {
+                blocks[i].first_line = lines_read + i;
+            }
+            lines_read += n_blocks;
+        }
+        paryfor::parallel_for<uint64_t>(
+            0, n_blocks, num_threads, 1,
+            [&](uint64_t i, int tid) {
+                parse_input_block(texts[i], input_is_fastq, blocks[i]);
+            });
+        for (uint64_t i = 0; i < n_blocks; ++i) {
+            auto& block = blocks[i];
+            for (auto& name : block.names) {
+                end_seq(seqs.seq_bytes_written + name.first);
+                in_seq = true;
+                seq_name = name.second;
+                seq_start = seqs.seq_bytes_written + name.first;
+            }
+            block_offset[i] = seqs.add_bases(block);
+        }
+        paryfor::parallel_for<uint64_t>(
+            0, n_blocks, num_threads, 1,
+            [&](uint64_t i, int tid) {
+                seqs.write(blocks[i], block_offset[i]);
+            });
+    }
+    if (!input_is_fasta && !input_is_fastq) {
+        std::cerr << "[seqwish::seqindex] error: unknown file format given to seqindex_t for " << filename << ", expected FASTA or FASTQ" << std::endl;
+        exit(1);
+    }
+    end_seq(seqs.seq_bytes_written);
+}
+
+// a record of a samtools faidx index: where the sequence lies in the FASTA and how its lines are laid out
+struct fai_record_t {
+    std::string name;
+    uint64_t length = 0;
+    uint64_t offset = 0;
+    uint64_t line_bases = 0;
+    uint64_t line_bytes = 0;
+};
+
+// read the .fai of an uncompressed FASTA, returning false if there's none we can use
+static bool read_fai(const std::string& filename, std::vector<fai_record_t>& records) {
+    // we look into the FASTA only once we know it has an index and can be read again, unlike a pipe
+    if (!is_regular_file(filename) || !is_regular_file(filename + ".fai")) return false;
+    std::ifstream fasta(filename.c_str(), std::ios::binary);
+    if (fasta.get() != '>') return false; // compressed, or FASTQ
+    std::ifstream fai((filename + ".fai").c_str());
+    if (!fai.good()) return false;
+    std::string line;
+    while (std::getline(fai, line)) {
+        if (line.empty()) continue;
+        std::vector<std::string> fields;
+        tokenize(line, fields, "\t");
+        if (fields.size() != 5) return false; // FASTQ records have a sixth
+        fai_record_t r;
+        r.name = ">" + fields[0];
+        r.length = std::stoull(fields[1]);
+        r.offset = std::stoull(fields[2]);
+        r.line_bases = std::stoull(fields[3]);
+        r.line_bytes = std::stoull(fields[4]);
+        if (r.length && (r.line_bases == 0 || r.line_bytes <= r.line_bases)) return false;
+        records.push_back(r);
+    }
+    return true;
+}
 
-            // force the sequence to be upper-case
-            std::transform(seq.begin(), seq.end(), seq.begin(), [](char c) { return std::toupper(c); });
-            seqout << seq;
-            // record where the sequence starts
-            seq_bytes_written += seq.size();
+// read a FASTA through its .fai, with no parsing of headers
+// every sequence is placed in the sequence file up front, so the pieces of them are read and written in parallel
+static void read_indexed_fasta(const std::string& filename, const std::vector<fai_record_t>& records,
+                               const uint64_t& num_threads, seq_collector_t& seqs) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1) {
+        std::cerr << "[seqwish::seqindex] error: could not open " << filename << std::endl;
+        exit(1);
+    }
+    // pieces of whole lines, from the file to the sequence file
+    struct piece_t { uint64_t file_offset; uint64_t bases; uint64_t line_bases; uint64_t line_bytes; uint64_t seq_offset; };
+    std::vector<piece_t> pieces;
+    uint64_t seq_pos = seqs.seq_bytes_written;
+    for (auto& r : records) {
+        seqs.add_seq(r.name, seq_pos, r.length);
+        if (r.length == 0) continue;
+        uint64_t lines_per_piece = std::max((uint64_t)1, input_block_size / r.line_bytes);
+        for (uint64_t l = 0; l * r.line_bases < r.length; l += lines_per_piece) {
+            uint64_t bases = std::min(lines_per_piece * r.line_bases, r.length - l * r.line_bases);
+            pieces.push_back({ r.offset + l * r.line_bytes, bases, r.line_bases, r.line_bytes, seq_pos + l * r.line_bases });
         }
+        seq_pos += r.length;
     }
-    in.close();
+    const uint64_t window = std::max((uint64_t)1, num_threads) * 2;
+    std::vector<std::string> texts(window);
+    std::vector<input_block_t> blocks(window);
+    for (uint64_t w = 0; w < pieces.size(); w += window) {
+        uint64_t n_blocks = std::min(window, pieces.size() - w);
+        paryfor::parallel_for<uint64_t>(
+            0, n_blocks, num_threads, 1,
+            [&](uint64_t i, int tid) {
+                auto& piece = pieces[w + i];
+                auto& text = texts[i];
+                auto& block = blocks[i];
+                uint64_t bytes = piece.bases / piece.line_bases * piece.line_bytes + piece.bases % piece.line_bases;
+                text.resize(bytes);
+                clear_block(block, piece.bases);
+                bool ok = pread(fd, &text[0], bytes, piece.file_offset) == (ssize_t)bytes;
+                for (uint64_t off = 0; ok && off < bytes; off += piece.line_bytes) {
+                    uint64_t line_end = std::min(off + piece.line_bases, bytes);
+                    // each full line ends where the index says it does
+                    ok = (line_end == bytes || text[off + piece.line_bytes - 1] == '\n');
+                    ok = ok && memchr(&text[off], '\n', line_end - off) == nullptr;
+                    add_block_bases(&text[off], &text[line_end], block);
+                }
+                if (!ok) {
+                    std::cerr << "[seqwish::seqindex] error: " << filename << ".fai does not match " << filename << ", index it again or remove it" << std::endl;
+                    exit(1);
+                }
+                seqs.write(block, piece.seq_offset);
+            });
+        for (uint64_t i = 0; i < n_blocks; ++i) {
+            seqs.add_bases(blocks[i]);
+        }
+    }
+    close(fd);
+}
+
+void seqindex_t::build_index(const std::string& filename, const uint64_t& num_threads) {
+    build_index(std::vector<std::string>(1, filename), num_threads);
+}
+
+void seqindex_t::build_index(const std::vector<std::string>& filenames, const uint64_t& num_threads) {
+    set_base_filename();
+    seq_collector_t seqs;
+    seqs.seqnames.open(seqnamefile.c_str());
+    seqs.seqfilename = seqfilename;
+    seqs.seqout = open(seqfilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (seqs.seqout == -1) {
+        std::cerr << "[seqwish::seqindex] error: could not open " << seqfilename << " for writing" << std::endl;
+        exit(1);
+    }
+    // the files follow one another, as if they had been concatenated
+    for (auto& filename : filenames) {
+        std::vector<fai_record_t> records;
+        if (read_fai(filename, records)) {
+            read_indexed_fasta(filename, records, num_threads, seqs);
+        } else {
+            read_seq_file(filename, num_threads, seqs);
+        }
+    }
+    uint64_t seq_bytes_written = seqs.seq_bytes_written;
+    std::vector<uint64_t>& seqname_offset = seqs.seqname_offset;
+    std::vector<uint64_t>& seq_offset = seqs.seq_offset;
+    std::vector<uint64_t>& n_boundaries = seqs.n_boundaries;
     // add the last value so we can get sequence length for the last sequence and name
     seq_offset.push_back(seq_bytes_written);
-    seqname_offset.push_back(seq_names_bytes_written);
-    seqnames.close();
-    seqout.close();
+    seqname_offset.push_back(seqs.seq_names_bytes_written);
+    seqs.seqnames.close();
+    close(seqs.seqout);
     // save the count of sequences
     seq_count = seqname_offset.size()-1;
-    // mark the seq name starts vector, adding a terminating mark
-    sdsl::bit_vector seq_name_starts(seqname_offset.back()+1);
-    for (size_t i = 0; i < seqname_offset.size(); ++i) {
-        seq_name_starts[seqname_offset[i]] = 1;
-    }
     // build the name index
     construct(seq_name_csa, seqnamefile, 1);
-
-    // check if there are duplicated sequence names
-    std::ifstream seqnames_in(seqnamefile.c_str());
-    bool duplicated_ids = false;
-    while (std::getline(seqnames_in, line, ' ')) {
-        //std::cout << line << " (" << locate(seq_name_csa, line).size() << ")" << std::endl;
-        std::string query = line + " ";
-        if(locate(seq_name_csa, query).size() > 1){
-            duplicated_ids = true;
-            break;
-        }
-    }
-    seqnames_in.close();
-
     // destroy the file
     std::remove(seqnamefile.c_str());
 
-    if (duplicated_ids){
-        std::cerr << "[seqwish] ERROR: input sequences have duplicated IDs." << std::endl;
-        exit(1);
-    }
-
     // build the rest of the index
-    sdsl::util::assign(seq_name_cbv, sdsl::sd_vector<>(seq_name_starts));
+    // the marks come in order, so each vector is built directly from its offsets
+    // mark the seq name starts vector, adding a terminating mark
+    sdsl::sd_vector_builder seq_name_builder(seqname_offset.back()+1, seqname_offset.size());
+    for (auto& o : seqname_offset) {
+        seq_name_builder.set(o);
+    }
+    sdsl::util::assign(seq_name_cbv, sdsl::sd_vector<>(seq_name_builder));
     sdsl::util::assign(seq_name_cbv_rank, sdsl::sd_vector<>::rank_1_type(&seq_name_cbv));
     sdsl::util::assign(seq_name_cbv_select, sdsl::sd_vector<>::select_1_type(&seq_name_cbv));
+    // this also checks for duplicated sequence names
+    build_name_mphf();
     // mark the seq begin vector, adding a terminating mark
-    sdsl::bit_vector seq_begin_bv(seq_offset.back()+1);
-    for (size_t i = 0; i < seq_offset.size(); ++i) {
-        seq_begin_bv[seq_offset[i]] = 1;
+    sdsl::sd_vector_builder seq_begin_builder(seq_offset.back()+1, seq_offset.size());
+    for (auto& o : seq_offset) {
+        seq_begin_builder.set(o);
     }
-    sdsl::util::assign(seq_begin_cbv, sdsl::sd_vector<>(seq_begin_bv));
+    sdsl::util::assign(seq_begin_cbv, sdsl::sd_vector<>(seq_begin_builder));
     sdsl::util::assign(seq_begin_cbv_rank, sdsl::sd_vector<>::rank_1_type(&seq_begin_cbv));
     sdsl::util::assign(seq_begin_cbv_select, sdsl::sd_vector<>::select_1_type(&seq_begin_cbv));
+    // mark the N run boundaries, closing any run that reaches the end
+    if (seqs.in_n_run) {
+        n_boundaries.push_back(seq_bytes_written);
+    }
+    sdsl::sd_vector_builder seq_n_builder(seq_offset.back()+1, n_boundaries.size());
+    for (auto& b : n_boundaries) {
+        seq_n_builder.set(b);
+    }
+    sdsl::util::assign(seq_n_cbv, sdsl::sd_vector<>(seq_n_builder));
+    sdsl::util::assign(seq_n_cbv_rank, sdsl::sd_vector<>::rank_1_type(&seq_n_cbv));
+    sdsl::util::assign(seq_n_cbv_select, sdsl::sd_vector<>::select_1_type(&seq_n_cbv));
+    if (packed) {
+        pack_seq_file();
+    }
     //std::cerr << seq_offset_civ << std::endl;
     // validate
     // look up each sequence by name
 }
 
+// the 2-bit code of each character, with 4 for those we keep on the side
+static const uint8_t* base_codes(void) {
+    static uint8_t codes[256];
+    static bool filled = [](void) {
+        memset(codes, 4, sizeof(codes));
+        codes[(uint8_t)'A'] = 0;
+        codes[(uint8_t)'C'] = 1;
+        codes[(uint8_t)'G'] = 2;
+        codes[(uint8_t)'T'] = 3;
+        return true;
+    }();
+    (void)filled;
+    return codes;
+}
+
+// the four bases held by each packed byte, so that a byte is unpacked with one copy
+static const uint32_t* packed_byte_bases(void) {
+    static uint32_t bases[256];
+    static bool filled = [](void) {
+        const char acgt[4] = { 'A', 'C', 'G', 'T' };
+        for (uint64_t b = 0; b < 256; ++b) {
+            char four[4];
+            for (uint64_t i = 0; i < 4; ++i) {
+                four[i] = acgt[(b >> (i * 2)) & 3];
+            }
+            memcpy(&bases[b], four, 4);
+        }
+        return true;
+    }();
+    (void)filled;
+    return bases;
+}
+
+void seqindex_t::pack_seq_file(void) {
+    // stream the sequence file into its packed form, noting the runs of other characters as we go
+    std::string packed_file = temp_file::create("seqwish-", ".sqq");
+    std::ifstream in(seqfilename.c_str(), std::ios::binary);
+    std::ofstream out(packed_file.c_str(), std::ios::binary);
+    const uint8_t* codes = base_codes();
+    const uint64_t block_size = 1 << 22; // a multiple of 4, so that every block starts a byte
+    std::vector<char> block(block_size);
+    std::vector<char> packed_block(block_size / 4);
+    std::vector<uint64_t> exc_starts;
+    std::vector<uint64_t> exc_ends;
+    std::vector<char> exc_chars;
+    uint64_t pos = 0;
+    while (in.read(block.data(), block_size) || in.gcount()) {
+        uint64_t n = in.gcount();
+        memset(packed_block.data(), 0, (n + 3) / 4);
+        for (uint64_t i = 0; i < n; ++i) {
+            char c = block[i];
+            uint8_t code = codes[(uint8_t)c];
+            if (code == 4) {
+                if (!exc_ends.empty() && exc_ends.back() == pos + i && exc_chars.back() == c) {
+                    ++exc_ends.back();
+                } else {
+                    exc_starts.push_back(pos + i);
+                    exc_ends.push_back(pos + i + 1);
+                    exc_chars.push_back(c);
+                }
+                code = 0;
+            }
+            packed_block[i >> 2] |= code << ((i & 3) * 2);
+        }
+        out.write(packed_block.data(), (n + 3) / 4);
+        pos += n;
+    }
+    in.close();
+    out.close();
+    std::rename(packed_file.c_str(), seqfilename.c_str());
+    sdsl::sd_vector_builder exc_builder(pos + 1, exc_starts.size());
+    for (auto& s : exc_starts) {
+        exc_builder.set(s);
+    }
+    sdsl::util::assign(seq_exc_cbv, sdsl::sd_vector<>(exc_builder));
+    sdsl::util::assign(seq_exc_cbv_rank, sdsl::sd_vector<>::rank_1_type(&seq_exc_cbv));
+    sdsl::util::assign(seq_exc_cbv_select, sdsl::sd_vector<>::select_1_type(&seq_exc_cbv));
+    seq_exc_end = sdsl::int_vector<>(exc_ends.size(), 0, sdsl::bits::hi(pos + 1) + 1);
+    seq_exc_char = sdsl::int_vector<8>(exc_chars.size(), 0);
+    for (uint64_t i = 0; i < exc_ends.size(); ++i) {
+        seq_exc_end[i] = exc_ends[i];
+        seq_exc_char[i] = (uint8_t)exc_chars[i];
+    }
+}
+
+void seqindex_t::decode(size_t pos, size_t count, char* out) const {
+    if (!packed) {
+        memcpy(out, &seq_buf[pos], count);
+        return;
+    }
+    const uint32_t* byte_bases = packed_byte_bases();
+    const char acgt[4] = { 'A', 'C', 'G', 'T' };
+    auto base_at = [&](const size_t& p) { return acgt[((uint8_t)seq_buf[p >> 2] >> ((p & 3) * 2)) & 3]; };
+    size_t i = 0;
+    // up to a byte boundary, then four bases a byte
+    for ( ; i < count && (pos + i) & 3; ++i) {
+        out[i] = base_at(pos + i);
+    }
+    for ( ; i + 4 <= count; i += 4) {
+        memcpy(out + i, &byte_bases[(uint8_t)seq_buf[(pos + i) >> 2]], 4);
+    }
+    for ( ; i < count; ++i) {
+        out[i] = base_at(pos + i);
+    }
+    // then lay the runs of other characters over what we unpacked
+    size_t n_runs = seq_exc_end.size();
+    size_t r = seq_exc_cbv_rank(pos + 1); // the runs starting at or before pos
+    for (size_t j = (r ? r - 1 : 0); j < n_runs; ++j) {
+        size_t start = seq_exc_cbv_select(j + 1);
+        if (start >= pos + count) break;
+        size_t end = seq_exc_end[j];
+        if (end <= pos) continue;
+        size_t b = std::max(start, pos);
+        size_t e = std::min(end, pos + count);
+        memset(out + (b - pos), (char)seq_exc_char[j], e - b);
+    }
+}
+
+void seqindex_t::build_name_mphf(void) {
+    seq_name_mphf.reset();
+    seq_name_mphf_hash = sdsl::int_vector<>();
+    seq_name_mphf_rank = sdsl::int_vector<>();
+    if (seq_count == 0) return;
+    // names with the same hash are either duplicates, which we refuse, or a collision of the hash
+    std::vector<std::pair<uint64_t, uint64_t>> hashes(seq_count);
+    for (size_t i = 1; i <= seq_count; ++i) {
+        hashes[i-1] = std::make_pair(seq_name_hash(nth_name(i)), i);
+    }
+    std::sort(hashes.begin(), hashes.end());
+    bool collision = false;
+    for (size_t i = 1; i < seq_count; ++i) {
+        if (hashes[i].first == hashes[i-1].first) {
+            if (nth_name(hashes[i].second) == nth_name(hashes[i-1].second)) {
+                std::cerr << "[seqwish] ERROR: input sequences have duplicated IDs." << std::endl;
+                exit(1);
+            }
+            collision = true;
+        }
+    }
+    // the perfect hash needs distinct keys, so on a collision we look names up in the CSA
+    if (collision) return;
+    std::vector<uint64_t> keys(seq_count);
+    for (size_t i = 0; i < seq_count; ++i) {
+        keys[i] = hashes[i].first;
+    }
+    seq_name_mphf = std::make_unique<name_mphf_t>(keys.size(), keys, 1, 2.0, false, false);
+    seq_name_mphf_hash = sdsl::int_vector<>(seq_count, 0, 64);
+    seq_name_mphf_rank = sdsl::int_vector<>(seq_count, 0, sdsl::bits::hi(seq_count) + 1);
+    for (auto& h : hashes) {
+        uint64_t idx = seq_name_mphf->lookup(h.first);
+        seq_name_mphf_hash[idx] = h.first;
+        seq_name_mphf_rank[idx] = h.second;
+    }
+}
+
+size_t seqindex_t::write_header(std::ostream& out, const std::string& key) const {
+    size_t written = 0;
+    out << "seqidx"; written += 6;
+    uint32_t version_buffer = OUTPUT_VERSION;
+    out.write((char*) &version_buffer, sizeof(version_buffer));
+    written += sizeof(version_buffer);
+    // the identity of the input for a cached index, empty otherwise
+    uint64_t key_length = key.size();
+    written += sdsl::write_member(key_length, out);
+    out.write(key.data(), key.size());
+    written += key.size();
+    return written;
+}
+
+bool seqindex_t::read_header(std::istream& in, std::string& key) const {
+    std::string magic(6, '\0');
+    in.read(&magic[0], magic.size());
+    uint32_t version = 0;
+    in.read((char*) &version, sizeof(version));
+    if (!in.good() || magic != "seqidx" || version != OUTPUT_VERSION) {
+        return false;
+    }
+    uint64_t key_length = 0;
+    sdsl::read_member(key_length, in);
+    key.resize(key_length);
+    in.read(&key[0], key_length);
+    return in.good();
+}
+
 size_t seqindex_t::save(sdsl::structure_tree_node* s, const std::string& name) {
     //assert(seq_name_csa.size() && seq_name_cbv.size() && seq_offset_civ.size());
-    sdsl::structure_tree_node* child = sdsl::structure_tree::add_child(s, name, sdsl::util::class_name(*this));
     // open the sdsl index
     std::ofstream out(seqidxfile.c_str());
+    size_t written = write_header(out, "");
+    written += save_members(out, s, name);
+    out.close();
+    open_seq(seqfilename);
+    return written;
+}
+
+size_t seqindex_t::save_members(std::ostream& out, sdsl::structure_tree_node* s, const std::string& name) const {
+    sdsl::structure_tree_node* child = sdsl::structure_tree::add_child(s, name, sdsl::util::class_name(*this));
     size_t written = 0;
-    out << "seqidx"; written += 9;
-    uint32_t version_buffer = OUTPUT_VERSION;
-    out.write((char*) &version_buffer, sizeof(version_buffer));
     written += sdsl::write_member(seq_count, out, child, "seq_count");
     written += seq_name_csa.serialize(out, child, "seq_name_csa");
     written += seq_name_cbv.serialize(out, child, "seq_name_cbv");
@@ -145,12 +605,31 @@ size_t seqindex_t::save(sdsl::structure_tree_node* s, const std::string& name) {
     written += seq_begin_cbv.serialize(out, child, "seq_begin_cbv");
     written += seq_begin_cbv_rank.serialize(out, child, "seq_begin_cbv_rank");
     written += seq_begin_cbv_select.serialize(out, child, "seq_begin_cbv_select");
-    out.close();
-    open_seq(seqfilename);
+    written += seq_n_cbv.serialize(out, child, "seq_n_cbv");
+    written += seq_n_cbv_rank.serialize(out, child, "seq_n_cbv_rank");
+    written += seq_n_cbv_select.serialize(out, child, "seq_n_cbv_select");
+    bool has_name_mphf = (bool)seq_name_mphf;
+    written += sdsl::write_member(has_name_mphf, out, child, "has_name_mphf");
+    written += sdsl::write_member(packed, out, child, "packed");
+    if (packed) {
+        written += seq_exc_cbv.serialize(out, child, "seq_exc_cbv");
+        written += seq_exc_cbv_rank.serialize(out, child, "seq_exc_cbv_rank");
+        written += seq_exc_cbv_select.serialize(out, child, "seq_exc_cbv_select");
+        written += seq_exc_end.serialize(out, child, "seq_exc_end");
+        written += seq_exc_char.serialize(out, child, "seq_exc_char");
+    }
+    if (has_name_mphf) {
+        std::streampos mphf_start = out.tellp();
+        seq_name_mphf->save(out);
+        written += out.tellp() - mphf_start;
+        written += seq_name_mphf_hash.serialize(out, child, "seq_name_mphf_hash");
+        written += seq_name_mphf_rank.serialize(out, child, "seq_name_mphf_rank");
+    }
     return written;
 }
 
 void seqindex_t::remove_index_files() {
+    if (cached) return;
     std::remove(seqfilename.c_str());
     std::remove(seqidxfile.c_str());
 }
@@ -159,9 +638,11 @@ void seqindex_t::open_seq(const std::string& filename) {
     if (seq_fd) return; //open
     assert(!filename.empty());
     // open in binary mode as we are reading from this interface
-    seq_fd = open(filename.c_str(), O_RDWR);
+    // the file may be shared with other runs through the index cache, so we never write to it
+    seq_fd = open(filename.c_str(), O_RDONLY);
     if (seq_fd == -1) {
-        assert(false);
+        std::cerr << "[seqwish::seqindex] error: could not open " << filename << std::endl;
+        exit(1);
     }
     struct stat stats;
     if (-1 == fstat(seq_fd, &stats)) {
@@ -171,13 +652,14 @@ void seqindex_t::open_seq(const std::string& filename) {
     if (!(seq_buf =
           (char*) mmap(NULL,
                        seq_size,
-                       PROT_READ | PROT_WRITE,
+                       PROT_READ,
                        MAP_SHARED,
                        seq_fd,
                        0))) {
         assert(false);
     }
-    madvise((void*)seq_buf, seq_size, POSIX_MADV_WILLNEED | POSIX_MADV_SEQUENTIAL);
+    // the alignments and the closure look up bases all over the input
+    advise_map((void*)seq_buf, seq_size, map_access_t::random);
 }
 
 void seqindex_t::close_seq(void) {
@@ -191,24 +673,123 @@ void seqindex_t::close_seq(void) {
     }
 }
 
-void seqindex_t::load(const std::string& filename) {
-    set_base_filename();
+void seqindex_t::load(const std::string& seq_file, const std::string& idx_file) {
+    seqfilename = seq_file;
+    seqidxfile = idx_file;
     std::ifstream in(seqidxfile.c_str());
-    std::string magic;
-    in.read((char*)magic.c_str(), 6);
-    uint32_t version;
-    in.read((char*) &version, sizeof(version));
-    assert(version == OUTPUT_VERSION);
+    std::string key;
+    if (!read_header(in, key)) {
+        std::cerr << "[seqwish::seqindex] error: " << seqidxfile << " is not a sequence index of version " << OUTPUT_VERSION << std::endl;
+        exit(1);
+    }
+    load_members(in);
+    in.close(); // close the sdsl index input
+    open_seq(seqfilename);
+}
+
+void seqindex_t::load_members(std::istream& in) {
     sdsl::read_member(seq_count, in);
     seq_name_csa.load(in);
     seq_name_cbv.load(in);
-    seq_name_cbv_rank.load(in);
-    seq_name_cbv_select.load(in);
+    seq_name_cbv_rank.load(in, &seq_name_cbv);
+    seq_name_cbv_select.load(in, &seq_name_cbv);
     seq_begin_cbv.load(in);
-    seq_begin_cbv_rank.load(in);
-    seq_begin_cbv_select.load(in);
-    in.close(); // close the sdsl index input
-    open_seq(filename);
+    seq_begin_cbv_rank.load(in, &seq_begin_cbv);
+    seq_begin_cbv_select.load(in, &seq_begin_cbv);
+    seq_n_cbv.load(in);
+    seq_n_cbv_rank.load(in, &seq_n_cbv);
+    seq_n_cbv_select.load(in, &seq_n_cbv);
+    bool has_name_mphf = false;
+    sdsl::read_member(has_name_mphf, in);
+    sdsl::read_member(packed, in);
+    if (packed) {
+        seq_exc_cbv.load(in);
+        seq_exc_cbv_rank.load(in, &seq_exc_cbv);
+        seq_exc_cbv_select.load(in, &seq_exc_cbv);
+        seq_exc_end.load(in);
+        seq_exc_char.load(in);
+    }
+    seq_name_mphf.reset();
+    if (has_name_mphf) {
+        seq_name_mphf = std::make_unique<name_mphf_t>();
+        seq_name_mphf->load(in);
+        seq_name_mphf_hash.load(in);
+        seq_name_mphf_rank.load(in);
+    }
+}
+
+std::string seq_index_cache_base(const std::string& dir, const std::vector<std::string>& filenames, const bool& packed) {
+    // the name of the first file keeps the cache readable, and a hash of the full paths keeps inputs of the same name apart
+    std::string full_paths;
+    for (auto& filename : filenames) {
+        char* path = realpath(filename.c_str(), nullptr);
+        full_paths += (path ? path : filename) + "\n";
+        free(path);
+    }
+    std::string base = full_paths.substr(0, full_paths.find('\n'));
+    base = base.substr(base.find_last_of('/') + 1);
+    std::stringstream ss;
+    ss << dir << "/" << base << "." << std::hex << seq_name_hash(full_paths) << (packed ? ".packed" : "");
+    return ss.str();
+}
+
+bool seqindex_t::load_cache(const std::string& cache_base, const std::vector<std::string>& filenames) {
+    std::ifstream in((cache_base + ".sqi").c_str());
+    if (!in.good()) {
+        return false;
+    }
+    std::string key;
+    // an index of an older format, or of an earlier version of the input, is built again
+    if (!read_header(in, key) || key != file_identity(filenames)) {
+        return false;
+    }
+    bool pack = packed;
+    load_members(in);
+    in.close();
+    if (packed != pack) {
+        packed = pack;
+        return false;
+    }
+    seqfilename = cache_base + ".sqq";
+    seqidxfile = cache_base + ".sqi";
+    cached = true;
+    open_seq(seqfilename);
+    return true;
+}
+
+void seqindex_t::save_cache(const std::string& cache_base, const std::vector<std::string>& filenames) {
+    mkdir(cache_base.substr(0, cache_base.find_last_of('/')).c_str(), 0755);
+    // both files go in under names of our own and are then renamed into place, sequences first,
+    // so that a run reading the cache never sees an index without its sequences
+    std::string suffix = ".tmp." + std::to_string(getpid());
+    std::string cache_seq = cache_base + ".sqq";
+    std::string cache_idx = cache_base + ".sqi";
+    // files that belong to another cache stay where they are
+    bool moved = !cached && std::rename(seqfilename.c_str(), (cache_seq + suffix).c_str()) == 0;
+    if (!moved) {
+        // the temp dir is on another file system, or the files aren't ours to move
+        std::ifstream seq_in(seqfilename.c_str(), std::ios::binary);
+        std::ofstream seq_out((cache_seq + suffix).c_str(), std::ios::binary);
+        seq_out << seq_in.rdbuf();
+        if (!seq_out.good()) {
+            std::cerr << "[seqwish::seqindex] warning: could not write the index cache " << cache_seq << std::endl;
+            std::remove((cache_seq + suffix).c_str());
+            return;
+        }
+    }
+    std::ofstream out((cache_idx + suffix).c_str());
+    write_header(out, file_identity(filenames));
+    save_members(out);
+    out.close();
+    std::rename((cache_seq + suffix).c_str(), cache_seq.c_str());
+    std::rename((cache_idx + suffix).c_str(), cache_idx.c_str());
+    if (moved) {
+        // our mapping of the sequences follows the file
+        std::remove(seqidxfile.c_str());
+        seqfilename = cache_seq;
+        seqidxfile = cache_idx;
+        cached = true;
+    }
 }
 
 void seqindex_t::to_fasta(std::ostream& out, size_t linewidth) const {
@@ -236,6 +817,15 @@ std::string seqindex_t::nth_name(size_t n) const {
 }
 
 size_t seqindex_t::rank_of_seq_named(const std::string& name) const {
+    if (seq_name_mphf) {
+        uint64_t h = seq_name_hash(name);
+        uint64_t idx = seq_name_mphf->lookup(h);
+        if (idx >= seq_count || seq_name_mphf_hash[idx] != h) {
+            std::cerr << "[seqwish::seqindex] error: no input sequence is named " << name << std::endl;
+            exit(1);
+        }
+        return seq_name_mphf_rank[idx];
+    }
     std::string query = ">" + name + " ";
     //std::cerr << query << std::endl;
     auto occs = locate(seq_name_csa, query);
@@ -268,7 +858,7 @@ std::string seqindex_t::subseq(size_t n, size_t pos, size_t count) const {
 
 std::string seqindex_t::subseq(size_t pos, size_t count) const {
     std::string s; s.resize(count);
-    memcpy((void*)s.c_str(), &seq_buf[pos], count);
+    decode(pos, count, &s[0]);
     return s;
 }
 
@@ -286,7 +876,13 @@ size_t seqindex_t::seq_length(void) const {
 }
 
 char seqindex_t::at(size_t pos) const {
-    return seq_buf[pos];
+    if (!packed) return seq_buf[pos];
+    size_t r = seq_exc_cbv_rank(pos + 1);
+    if (r && pos < seq_exc_end[r - 1]) {
+        return (char)seq_exc_char[r - 1];
+    }
+    const char acgt[4] = { 'A', 'C', 'G', 'T' };
+    return acgt[((uint8_t)seq_buf[pos >> 2] >> ((pos & 3) * 2)) & 3];
 }
 
 char seqindex_t::at_pos(pos_t pos) const {
@@ -298,6 +894,52 @@ char seqindex_t::at_pos(pos_t pos) const {
     return c;
 }
 
+size_t seqindex_t::match_length(pos_t q, pos_t t, size_t len) const {
+    if (packed) {
+        // unpack both sides a window at a time for the comparison kernels
+        const size_t window = 1024;
+        char q_bases[window];
+        char t_bases[window];
+        size_t matched = 0;
+        while (matched < len) {
+            size_t n = std::min(window, len - matched);
+            decode(offset(t) + matched, n, t_bases);
+            size_t m;
+            if (is_rev(q)) {
+                decode(offset(q) - matched - (n - 1), n, q_bases);
+                m = match_prefix_rev(q_bases + n - 1, t_bases, n);
+            } else {
+                decode(offset(q) + matched, n, q_bases);
+                m = match_prefix_fwd(q_bases, t_bases, n);
+            }
+            matched += m;
+            if (m < n) break;
+        }
+        return matched;
+    }
+    // the target is always read on the forward strand
+    const char* t_seq = seq_buf + offset(t);
+    if (is_rev(q)) {
+        return match_prefix_rev(seq_buf + offset(q), t_seq, len);
+    } else {
+        return match_prefix_fwd(seq_buf + offset(q), t_seq, len);
+    }
+}
+
+size_t seqindex_t::non_n_length(size_t pos, size_t len) const {
+    // an even count of boundaries up to pos puts us outside of an N run
+    size_t k = seq_n_cbv_rank(pos+1);
+    if (k % 2) return 0;
+    if (k == seq_n_cbv_rank(seq_n_cbv.size())) return len;
+    return std::min(len, seq_n_cbv_select(k+1) - pos);
+}
+
+size_t seqindex_t::n_length(size_t pos, size_t len) const {
+    size_t k = seq_n_cbv_rank(pos+1);
+    if (k % 2 == 0) return 0;
+    return std::min(len, seq_n_cbv_select(k+1) - pos);
+}
+
 size_t seqindex_t::n_seqs(void) const {
     return seq_count;
 }
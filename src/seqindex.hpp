@@ -4,6 +4,8 @@
 #include <iostream>
 #include <cstdio>
 #include <string>
+#include <vector>
+#include <memory>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -12,11 +14,19 @@
 #include "sdsl/suffix_arrays.hpp"
 #include "sdsl/dac_vector.hpp"
 #include "gzstream.h"
+#include "BooPHF.h"
 #include "pos.hpp"
 #include "dna.hpp"
+#include "basematch.hpp"
 
 namespace seqwish {
 
+// the size of the blocks of input that are parsed in parallel while building the index
+const uint64_t input_block_size = 1 << 22;
+
+// where the cached index of the files is kept in dir
+std::string seq_index_cache_base(const std::string& dir, const std::vector<std::string>& filenames, const bool& packed);
+
 class seqindex_t {
 
 private:
@@ -38,22 +48,60 @@ private:
     sdsl::sd_vector<> seq_begin_cbv;
     sdsl::sd_vector<>::rank_1_type seq_begin_cbv_rank;
     sdsl::sd_vector<>::select_1_type seq_begin_cbv_select;
+    // boundaries of runs of N in the concatenated sequences, marking the first N and the first base after
+    sdsl::sd_vector<> seq_n_cbv;
+    sdsl::sd_vector<>::rank_1_type seq_n_cbv_rank;
+    sdsl::sd_vector<>::select_1_type seq_n_cbv_select;
     // seq name compressed suffix array
     sdsl::csa_wt<> seq_name_csa;
     // seq name index
     sdsl::sd_vector<> seq_name_cbv;
     sdsl::sd_vector<>::rank_1_type seq_name_cbv_rank;
     sdsl::sd_vector<>::select_1_type seq_name_cbv_select;
-    uint32_t OUTPUT_VERSION = 1; // update as we change our format
+    // a minimal perfect hash of the hashes of the names, for looking up sequences by name without the CSA
+    // each slot keeps the hash it was built for, so names that aren't ours are caught
+    typedef boomphf::mphf<uint64_t, boomphf::SingleHashFunctor<uint64_t>> name_mphf_t;
+    std::unique_ptr<name_mphf_t> seq_name_mphf;
+    sdsl::int_vector<> seq_name_mphf_hash;
+    sdsl::int_vector<> seq_name_mphf_rank;
+    void build_name_mphf(void);
+    // when packed, the sequence file holds 2 bits per base, A, C, G and T by their codes 0 to 3
+    // and the runs of anything else, N or the other IUPAC codes, are kept on the side
+    bool packed = false;
+    sdsl::sd_vector<> seq_exc_cbv; // where each run starts
+    sdsl::sd_vector<>::rank_1_type seq_exc_cbv_rank;
+    sdsl::sd_vector<>::select_1_type seq_exc_cbv_select;
+    sdsl::int_vector<> seq_exc_end; // where each run ends
+    sdsl::int_vector<8> seq_exc_char; // and the character it repeats
+    void pack_seq_file(void);
+    // write the count bases from pos into out, unpacking them if we must
+    void decode(size_t pos, size_t count, char* out) const;
+    uint32_t OUTPUT_VERSION = 5; // update as we change our format
+    // the serialized index is a header, holding the key of the input when it's cached, then the members
+    size_t write_header(std::ostream& out, const std::string& key) const;
+    bool read_header(std::istream& in, std::string& key) const;
+    size_t save_members(std::ostream& out, sdsl::structure_tree_node* s = NULL, const std::string& name = "") const;
+    void load_members(std::istream& in);
+    // whether our files belong to the index cache, and so outlive the run
+    bool cached = false;
 
 public:
 
     seqindex_t(void) { }
     ~seqindex_t(void) { close_seq(); }
     void set_base_filename();
-    void build_index(const std::string& filename);
+    // keep the sequences 2-bit packed, to be set before build_index
+    void set_packed(const bool& pack) { packed = pack; }
+    bool is_packed(void) const { return packed; }
+    void build_index(const std::string& filename, const uint64_t& num_threads = 1);
+    // index the sequences of the files as if they had been concatenated, using the .fai of any plain FASTA
+    void build_index(const std::vector<std::string>& filenames, const uint64_t& num_threads = 1);
     size_t save(sdsl::structure_tree_node* s = NULL, const std::string& name = "");
-    void load(const std::string& filename);
+    void load(const std::string& seq_file, const std::string& idx_file);
+    // load the index of the files kept under cache_base, returning false if it's missing or out of date
+    bool load_cache(const std::string& cache_base, const std::vector<std::string>& filenames);
+    // keep the index we built of the files under cache_base for later runs
+    void save_cache(const std::string& cache_base, const std::vector<std::string>& filenames);
     void remove_index_files(void);
     void to_fasta(std::ostream& out, size_t linewidth = 60) const;
     std::string nth_name(size_t n) const;
@@ -69,6 +117,12 @@ public:
     size_t seq_length(void) const;
     char at(size_t pos) const;
     char at_pos(pos_t pos) const;
+    // the number of bases from q and t onward that match, of at most len
+    size_t match_length(pos_t q, pos_t t, size_t len) const;
+    // the number of bases from pos onward that aren't N, of at most len
+    size_t non_n_length(size_t pos, size_t len) const;
+    // the number of bases from pos onward that are N, of at most len
+    size_t n_length(size_t pos, size_t len) const;
     size_t n_seqs(void) const;
     size_t seq_id_at(size_t pos) const;
     bool seq_start(size_t pos) const;
@@ -0,0 +1,142 @@
+#include <iostream>
+#include <fstream>
+#include <atomic>
+#include <memory>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "shard.hpp"
+#include "iitree_index.hpp"
+#include "paryfor.hpp"
+
+namespace seqwish {
+
+std::vector<closure_shard_t> plan_closure_shards(const seqindex_t& seqidx,
+                                                 mmmulti::iitree<uint64_t, pos_t>& aln_iitree,
+                                                 const uint64_t& n_shards,
+                                                 const uint64_t& num_threads) {
+    uint64_t n_seqs = seqidx.n_seqs();
+    // the last sequence that each is joined to by an alignment starting in it or in one before it
+    std::vector<std::atomic<uint64_t>> reach(n_seqs + 1);
+    for (uint64_t s = 0; s <= n_seqs; ++s) {
+        reach[s].store(s);
+    }
+    paryfor::parallel_for<uint64_t>(
+        0, aln_iitree.size(), num_threads, 10000,
+        [&](uint64_t k) {
+            uint64_t a = seqidx.seq_id_at(aln_iitree.start(k));
+            uint64_t b = seqidx.seq_id_at(offset(aln_iitree.data(k)));
+            if (a > b) std::swap(a, b);
+            uint64_t r = reach[a].load();
+            while (r < b && !reach[a].compare_exchange_weak(r, b)) { }
+        });
+    // we may cut after sequence s if nothing before or at it reaches past it
+    std::vector<uint64_t> cuts;
+    uint64_t max_reach = 0;
+    for (uint64_t s = 1; s < n_seqs; ++s) {
+        max_reach = std::max(max_reach, reach[s].load());
+        if (max_reach <= s) {
+            cuts.push_back(seqidx.nth_seq_offset(s + 1));
+        }
+    }
+    // of these we take the nearest to each multiple of the balanced shard length
+    std::vector<closure_shard_t> shards;
+    uint64_t length = seqidx.seq_length();
+    closure_shard_t shard;
+    auto c = cuts.begin();
+    for (uint64_t k = 1; k < n_shards && c != cuts.end(); ++k) {
+        uint64_t ideal = length / n_shards * k;
+        while (c + 1 != cuts.end() && *(c + 1) <= ideal) ++c;
+        if (c + 1 != cuts.end() && *(c + 1) - ideal < ideal - std::min(ideal, *c)) ++c;
+        if (*c <= shard.begin) continue;
+        shard.end = *c;
+        shards.push_back(shard);
+        shard.begin = *c;
+        ++c;
+    }
+    shard.end = length;
+    shards.push_back(shard);
+    // the shards we couldn't cut are left empty, at the end of Q
+    while (shards.size() < n_shards) {
+        closure_shard_t empty;
+        empty.begin = empty.end = seqidx.seq_length();
+        shards.push_back(empty);
+    }
+    return shards;
+}
+
+void make_closure_shard_dir(const std::string& dir) {
+    struct stat stats;
+    if (mkdir(dir.c_str(), 0755) == -1 && !(stat(dir.c_str(), &stats) == 0 && S_ISDIR(stats.st_mode))) {
+        std::cerr << "[seqwish::shard] error: could not make the shard directory " << dir << std::endl;
+        exit(1);
+    }
+}
+
+std::string closure_shard_file(const std::string& dir, const uint64_t& i, const std::string& suffix) {
+    return dir + "/shard." + std::to_string(i) + suffix;
+}
+
+void finish_closure_shard(const std::string& dir, const uint64_t& i, const uint64_t& graph_length) {
+    // written under a name of our own and renamed, so a merge never reads a partial record
+    std::string done = closure_shard_file(dir, i, ".done");
+    std::string tmp = done + ".tmp." + std::to_string(getpid());
+    std::ofstream out(tmp.c_str());
+    out << graph_length << std::endl;
+    out.close();
+    if (!out.good() || std::rename(tmp.c_str(), done.c_str()) != 0) {
+        std::cerr << "[seqwish::shard] error: could not write " << done << std::endl;
+        exit(1);
+    }
+}
+
+size_t merge_closure_shards(const std::string& dir,
+                            const uint64_t& n_shards,
+                            const std::string& seq_v_file,
+                            mmmulti::iitree<uint64_t, pos_t>& node_iitree,
+                            mmmulti::iitree<uint64_t, pos_t>& path_iitree,
+                            const uint64_t& num_threads) {
+    node_iitree.open_writer();
+    path_iitree.open_writer();
+    std::ofstream seq_v_out(seq_v_file.c_str(), std::ios::binary);
+    uint64_t graph_length = 0;
+    for (uint64_t i = 0; i < n_shards; ++i) {
+        std::ifstream done(closure_shard_file(dir, i, ".done").c_str());
+        uint64_t shard_length = 0;
+        if (!(done >> shard_length)) {
+            std::cerr << "[seqwish::shard] error: shard " << i << " has not finished its closure in " << dir << std::endl;
+            exit(1);
+        }
+        std::ifstream seq_in(closure_shard_file(dir, i, ".sqs").c_str(), std::ios::binary);
+        if (shard_length) {
+            seq_v_out << seq_in.rdbuf();
+        }
+        if ((uint64_t)seq_v_out.tellp() != graph_length + shard_length) {
+            std::cerr << "[seqwish::shard] error: the graph sequence of shard " << i << " in " << dir << " is not " << shard_length << "bp long" << std::endl;
+            exit(1);
+        }
+        // the shard's positions in S move up by the graphs before it, what they point to in Q stays
+        if (shard_length) {
+            auto shard_nodes = std::make_unique<mmmulti::iitree<uint64_t, pos_t>>(closure_shard_file(dir, i, ".sqn"));
+            shard_nodes->index(num_threads);
+            for (uint64_t k = 0; k < shard_nodes->size(); ++k) {
+                node_iitree.add(shard_nodes->start(k) + graph_length, shard_nodes->end(k) + graph_length, shard_nodes->data(k));
+            }
+            shard_nodes.reset();
+            auto shard_paths = std::make_unique<mmmulti::iitree<uint64_t, pos_t>>(closure_shard_file(dir, i, ".sqp"));
+            shard_paths->index(num_threads);
+            for (uint64_t k = 0; k < shard_paths->size(); ++k) {
+                const pos_t& p = shard_paths->data(k);
+                path_iitree.add(shard_paths->start(k), shard_paths->end(k), make_pos_t(offset(p) + graph_length, is_rev(p)));
+            }
+        }
+        graph_length += shard_length;
+    }
+    seq_v_out.close();
+    node_iitree.close_writer();
+    path_iitree.close_writer();
+    index_together(node_iitree, path_iitree, num_threads);
+    return graph_length;
+}
+
+}
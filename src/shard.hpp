@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "seqindex.hpp"
+#include "mmiitree.hpp"
+#include "pos.hpp"
+
+namespace seqwish {
+
+/*
+The transitive closure can be split across machines that share a directory.
+The graph sequence holds the closed sets of bases in the order of their
+first base in Q, whatever the batches, so a run of input sequences that no
+alignment joins to the sequences outside it closes into the same stretch of
+the graph on its own. We cut Q between sequences only where no alignment
+crosses the cut, so that each shard is closed independently, and the shards'
+graphs are then laid end to end, which gives the graph of a single run.
+*/
+
+struct closure_shard_t {
+    uint64_t begin = 0; // in Q
+    uint64_t end = 0;
+};
+
+// cut Q into up to n_shards runs of whole sequences that no alignment joins, balanced by length
+// every machine finds the same cuts from the same alignments
+std::vector<closure_shard_t> plan_closure_shards(const seqindex_t& seqidx,
+                                                 mmmulti::iitree<uint64_t, pos_t>& aln_iitree,
+                                                 const uint64_t& n_shards,
+                                                 const uint64_t& num_threads);
+
+// make the shared directory if no run has yet
+void make_closure_shard_dir(const std::string& dir);
+
+// the closure outputs of shard i in the shared directory
+std::string closure_shard_file(const std::string& dir, const uint64_t& i, const std::string& suffix);
+
+// mark the shard's outputs as complete, noting the length of its graph sequence
+void finish_closure_shard(const std::string& dir, const uint64_t& i, const uint64_t& graph_length);
+
+// lay the graphs of the shards end to end into the closure outputs, returning the graph length
+size_t merge_closure_shards(const std::string& dir,
+                            const uint64_t& n_shards,
+                            const std::string& seq_v_file,
+                            mmmulti::iitree<uint64_t, pos_t>& node_iitree,
+                            mmmulti::iitree<uint64_t, pos_t>& path_iitree,
+                            const uint64_t& num_threads);
+
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <algorithm>
+#include <string>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "tempfile.hpp"
+
+namespace seqwish {
+
+/*
+Arrays that leave the heap when memory runs short. Each spill_vector_t
+charges its bytes to a shared memory_budget_t. When a resize would take the
+total past the limit, the array moves into a file in the temp dir, which we
+map into memory. The kernel can then write its pages back to disk instead
+of letting the process be killed. We sort these arrays in place, so the
+sorts run on disk too.
+*/
+
+class memory_budget_t {
+public:
+    // a limit of 0 means we never spill
+    memory_budget_t(const uint64_t& limit_bytes = 0) : limit(limit_bytes) { used.store(0); spills.store(0); }
+    // try to account for more bytes on the heap, false if they don't fit
+    bool reserve(const uint64_t& bytes) {
+        if (limit == 0) return true;
+        uint64_t curr = used.load();
+        do {
+            if (curr + bytes > limit) return false;
+        } while (!used.compare_exchange_weak(curr, curr + bytes));
+        return true;
+    }
+    void release(const uint64_t& bytes) {
+        if (limit == 0) return;
+        used.fetch_sub(bytes);
+    }
+    void count_spill(void) { ++spills; }
+    uint64_t spill_count(void) const { return spills.load(); }
+    uint64_t limit_bytes(void) const { return limit; }
+
+private:
+    uint64_t limit;
+    std::atomic<uint64_t> used;
+    std::atomic<uint64_t> spills;
+};
+
+template<typename T>
+class spill_vector_t {
+    // we move the values with memcpy and never run their destructors
+    static_assert(std::is_trivially_destructible<T>::value, "spill_vector_t holds plain data");
+public:
+    spill_vector_t(memory_budget_t* b = nullptr) : budget(b) { }
+    spill_vector_t(const spill_vector_t&) = delete;
+    spill_vector_t& operator=(const spill_vector_t&) = delete;
+    ~spill_vector_t(void) { clear(); }
+
+    void set_budget(memory_budget_t* b) { budget = b; }
+    // new elements are zeroed
+    void resize(const uint64_t& n) {
+        uint64_t old_length = length;
+        resize_for_overwrite(n);
+        if (n > old_length) {
+            memset((void*)(ptr + old_length), 0, (n - old_length) * sizeof(T));
+        }
+    }
+    // for callers that write every element, new elements hold whatever was there before
+    // shrinking keeps the storage, so an array reused across batches stops faulting in pages once it has grown
+    void resize_for_overwrite(const uint64_t& n) {
+        if (!on_disk && n > heap_capacity) {
+            // grow geometrically, as a vector would, so arrays grown a batch at a time copy little
+            uint64_t new_capacity = std::max(n, 2 * heap_capacity);
+            uint64_t more = (new_capacity - heap_capacity) * sizeof(T);
+            if (budget == nullptr || budget->reserve(more)) {
+                charged += more;
+                grow_heap(new_capacity);
+            } else {
+                spill();
+            }
+        }
+        if (on_disk) {
+            if (n > capacity) map_file(n);
+        } else {
+            ptr = heap;
+        }
+        length = n;
+    }
+    // free the storage, removing any file
+    void clear(void) {
+        if (on_disk) {
+            unmap_file();
+            close(fd);
+            fd = -1;
+            temp_file::remove(filename);
+            on_disk = false;
+        }
+        free_heap();
+        if (budget) budget->release(charged);
+        charged = 0;
+        ptr = nullptr;
+        length = 0;
+        capacity = 0;
+    }
+    // trade storage with another array of the same budget
+    void swap(spill_vector_t& other) {
+        std::swap(budget, other.budget);
+        std::swap(charged, other.charged);
+        std::swap(heap, other.heap);
+        std::swap(heap_capacity, other.heap_capacity);
+        std::swap(on_disk, other.on_disk);
+        std::swap(filename, other.filename);
+        std::swap(fd, other.fd);
+        std::swap(ptr, other.ptr);
+        std::swap(length, other.length);
+        std::swap(capacity, other.capacity);
+    }
+    bool spilled(void) const { return on_disk; }
+    uint64_t size(void) const { return length; }
+    bool empty(void) const { return length == 0; }
+    T* data(void) { return ptr; }
+    const T* data(void) const { return ptr; }
+    T* begin(void) { return ptr; }
+    T* end(void) { return ptr + length; }
+    const T* begin(void) const { return ptr; }
+    const T* end(void) const { return ptr + length; }
+    T& operator[](const uint64_t& i) { return ptr[i]; }
+    const T& operator[](const uint64_t& i) const { return ptr[i]; }
+    T& front(void) { return ptr[0]; }
+    const T& front(void) const { return ptr[0]; }
+
+private:
+    memory_budget_t* budget = nullptr;
+    uint64_t charged = 0; // the heap bytes we hold against the budget
+    T* heap = nullptr; // left uninitialized, so growing doesn't write every new element
+    uint64_t heap_capacity = 0;
+    bool on_disk = false;
+    std::string filename;
+    int fd = -1;
+    T* ptr = nullptr;
+    uint64_t length = 0;
+    uint64_t capacity = 0; // elements in the mapping
+
+    // move what we hold on the heap into a temp file
+    void spill(void) {
+        filename = temp_file::create("seqwish-", ".sqb");
+        fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            std::cerr << "[seqwish::spillvec] error: could not open " << filename << std::endl;
+            exit(1);
+        }
+        on_disk = true;
+        map_file(heap_capacity);
+        if (length) {
+            memcpy((void*)ptr, (const void*)heap, length * sizeof(T));
+        }
+        free_heap();
+        if (budget) {
+            budget->release(charged);
+            budget->count_spill();
+        }
+        charged = 0;
+    }
+    void grow_heap(const uint64_t& n) {
+        T* grown = static_cast<T*>(::operator new(n * sizeof(T)));
+        if (length) {
+            memcpy((void*)grown, (const void*)heap, length * sizeof(T));
+        }
+        free_heap();
+        heap = grown;
+        heap_capacity = n;
+    }
+    void free_heap(void) {
+        ::operator delete((void*)heap);
+        heap = nullptr;
+        heap_capacity = 0;
+    }
+    void map_file(const uint64_t& n) {
+        unmap_file();
+        // never map zero bytes
+        uint64_t bytes = std::max((uint64_t)1, n) * sizeof(T);
+        if (ftruncate(fd, bytes) != 0) {
+            std::cerr << "[seqwish::spillvec] error: could not extend " << filename << " to " << bytes << " bytes" << std::endl;
+            exit(1);
+        }
+        void* m = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (m == MAP_FAILED) {
+            std::cerr << "[seqwish::spillvec] error: could not map " << filename << std::endl;
+            exit(1);
+        }
+        ptr = (T*)m;
+        capacity = std::max((uint64_t)1, n);
+    }
+    void unmap_file(void) {
+        if (on_disk && ptr != nullptr) {
+            munmap((void*)ptr, capacity * sizeof(T));
+            ptr = nullptr;
+            capacity = 0;
+        }
+    }
+};
+
+}
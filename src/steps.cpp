@@ -0,0 +1,54 @@
+#include "steps.hpp"
+#include "sdsl/bits.hpp"
+
+namespace seqwish {
+
+void path_steps_t::build(mmmulti::iitree<uint64_t, pos_t>& path_iitree,
+                         const std::string& seq_v_file,
+                         const sdsl::sd_vector<>& seq_id_cbv,
+                         const sdsl::sd_vector<>::rank_1_type& seq_id_cbv_rank,
+                         const sdsl::sd_vector<>::select_1_type& seq_id_cbv_select,
+                         const seqindex_t& seqidx,
+                         const validate_mode_t& validate,
+                         const uint64_t& num_threads) {
+    int seq_v_fd = -1;
+    char* seq_v_buf = nullptr;
+    size_t seq_v_filesize = mmap_open(seq_v_file, seq_v_buf, seq_v_fd);
+    uint64_t n_nodes = seq_id_cbv_rank(seq_id_cbv.size()-1);
+    uint8_t width = sdsl::bits::hi(make_pos_t(n_nodes, true)) + 1;
+    step_pieces = path_pieces(seqidx);
+    piece_starts.clear();
+    piece_starts.reserve(step_pieces.size() + 1);
+    {
+        sdsl::int_vector_buffer<> out(steps_file, std::ios::out, 1 << 20, width);
+        format_in_order(
+            step_pieces.size(), num_threads,
+            [&](const uint64_t& i, std::string& buf) {
+                std::vector<pos_t> steps;
+                walk_path_piece(step_pieces[i], path_iitree, seq_id_cbv, seq_id_cbv_rank, seq_id_cbv_select, seqidx, seq_v_buf, validate, steps);
+                buf.append((const char*)steps.data(), steps.size() * sizeof(pos_t));
+            },
+            [&](const uint64_t& i, const std::string& buf) {
+                piece_starts.push_back(out.size());
+                const pos_t* steps = (const pos_t*)buf.data();
+                for (uint64_t x = 0; x < buf.size() / sizeof(pos_t); ++x) {
+                    out.push_back(steps[x]);
+                }
+            });
+        piece_starts.push_back(out.size());
+        out.close();
+    }
+    mmap_close(seq_v_buf, seq_v_fd, seq_v_filesize);
+}
+
+void path_steps_t::read(const uint64_t& begin, const uint64_t& end, std::vector<pos_t>& steps) const {
+    if (begin == end) return;
+    // each reader has its own buffer over the file
+    sdsl::int_vector_buffer<> in(steps_file, std::ios::in, 1 << 16);
+    steps.reserve(steps.size() + (end - begin));
+    for (uint64_t i = begin; i < end; ++i) {
+        steps.push_back(in[i]);
+    }
+}
+
+}
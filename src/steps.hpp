@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "sdsl/bit_vectors.hpp"
+#include "sdsl/int_vector_buffer.hpp"
+#include "mmiitree.hpp"
+#include "seqindex.hpp"
+#include "pos.hpp"
+#include "mmap.hpp"
+#include "gfa.hpp"
+
+namespace seqwish {
+
+/*
+The steps of every path through the graph, found once after compaction and
+kept on disk. They go into an sdsl int_vector_buffer, bit-packed to the width
+of the largest handle, in the order of the path pieces of path_pieces(). The
+link derivation and every output format can then read a piece's steps in
+order, without going back to path_iitree and the node rank.
+*/
+
+class path_steps_t {
+public:
+    path_steps_t(const std::string& filename) : steps_file(filename) { }
+    // walk every path piece in parallel, checking the paths as asked and writing their steps in order
+    void build(mmmulti::iitree<uint64_t, pos_t>& path_iitree,
+               const std::string& seq_v_file,
+               const sdsl::sd_vector<>& seq_id_cbv,
+               const sdsl::sd_vector<>::rank_1_type& seq_id_cbv_rank,
+               const sdsl::sd_vector<>::select_1_type& seq_id_cbv_select,
+               const seqindex_t& seqidx,
+               const validate_mode_t& validate,
+               const uint64_t& num_threads);
+    // the pieces as in path_pieces()
+    const std::vector<path_piece_t>& pieces(void) const { return step_pieces; }
+    // the index of the first step of piece i, with piece_start(pieces().size()) the number of steps
+    uint64_t piece_start(const uint64_t& i) const { return piece_starts[i]; }
+    uint64_t size(void) const { return piece_starts.back(); }
+    // append the steps [begin, end) to steps, safe to call from many threads at once
+    void read(const uint64_t& begin, const uint64_t& end, std::vector<pos_t>& steps) const;
+    // append the steps of piece i to steps
+    void piece_steps(const uint64_t& i, std::vector<pos_t>& steps) const {
+        read(piece_starts[i], piece_starts[i+1], steps);
+    }
+
+private:
+    std::string steps_file;
+    std::vector<path_piece_t> step_pieces;
+    std::vector<uint64_t> piece_starts;
+};
+
+}
@@ -1,6 +1,7 @@
 #include <set>
 #include <iostream>
 #include <unistd.h>
+#include <sys/stat.h>
 #include "tempfile.hpp"
 
 namespace temp_file {
@@ -12,6 +13,8 @@ namespace temp_file {
 
     bool keep_temp = false;
 
+    std::vector<std::pair<std::string, uint64_t>> removed_files;
+
     /// Because the names are in a static object, we can delete them when
     /// std::exit() is called.
     struct Handler {
@@ -81,6 +84,10 @@ namespace temp_file {
     void remove(const std::string &filename) {
         std::lock_guard <std::recursive_mutex> lock(monitor);
 
+        struct stat st;
+        if (handler.filenames.count(filename) && stat(filename.c_str(), &st) == 0) {
+            removed_files.emplace_back(filename, (uint64_t)st.st_size);
+        }
         std::remove(filename.c_str());
         handler.filenames.erase(filename);
     }
@@ -111,6 +118,18 @@ namespace temp_file {
         return temp_dir;
     }
 
+    std::vector<std::string> list() {
+        std::lock_guard <std::recursive_mutex> lock(monitor);
+
+        return std::vector<std::string>(handler.filenames.begin(), handler.filenames.end());
+    }
+
+    std::vector<std::pair<std::string, uint64_t>> removed() {
+        std::lock_guard <std::recursive_mutex> lock(monitor);
+
+        return removed_files;
+    }
+
     void set_keep_temp(bool setting) {
         keep_temp = setting;
     }
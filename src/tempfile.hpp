@@ -1,6 +1,9 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
 #include <mutex>
 #include <cstdio>
 #include <dirent.h>
@@ -28,6 +31,12 @@ namespace temp_file {
     /// Get the current temp dir
     std::string get_dir();
 
+    /// The temporary files that exist now
+    std::vector<std::string> list();
+
+    /// The temporary files removed so far, with their sizes as we removed them
+    std::vector<std::pair<std::string, uint64_t>> removed();
+
     void set_keep_temp(bool setting);
 
 } // namespace temp_file
\ No newline at end of file
@@ -1,15 +1,19 @@
 #include "transclosure.hpp"
+#include "iitree_index.hpp"
 
 namespace seqwish {
 
-using namespace std::chrono_literals;
+bool breaks_range(const pos_t& q_last_pos,
+                  const pos_t& q_pos,
+                  const seqindex_t& seqidx) {
+    return (!is_rev(q_pos) && seqidx.seq_start(offset(q_pos))) || (is_rev(q_pos) && seqidx.seq_start(offset(q_last_pos)));
+}
 
 void extend_range(const uint64_t& s_pos,
                   const pos_t& q_pos,
-                  std::map<pos_t, range_t>& range_buffer,
+                  range_buffer_t& range_buffer,
                   const seqindex_t& seqidx,
-                  mmmulti::iitree<uint64_t, pos_t>& node_iitree,
-                  mmmulti::iitree<uint64_t, pos_t>& path_iitree) {
+                  const range_flush_t& flush) {
     // find a position in the map that we can add onto
     // it must match position and orientation
     pos_t q_last_pos = q_pos;
@@ -17,12 +21,12 @@ void extend_range(const uint64_t& s_pos,
     auto f = range_buffer.find(q_last_pos);
     // if one doesn't exist, add the range
     if (f == range_buffer.end()) {
-        range_buffer[q_pos] = {s_pos, s_pos+1};
-    } else if ((!is_rev(q_pos) && seqidx.seq_start(offset(q_pos))) || (is_rev(q_pos) && seqidx.seq_start(offset(q_last_pos)))) {
+        range_buffer.set(q_pos, {s_pos, s_pos+1});
+    } else if (breaks_range(q_last_pos, q_pos, seqidx)) {
         // flush the buffer we found, so we don't extend across node boundaries
-        flush_range(f, node_iitree, path_iitree);
+        flush(f->first, f->second);
         range_buffer.erase(f);
-        range_buffer[q_pos] = {s_pos, s_pos+1};
+        range_buffer.set(q_pos, {s_pos, s_pos+1});
     } else {
         // if one does, check that it matches our extension,
         range_t x = f->second;
@@ -30,38 +34,75 @@ void extend_range(const uint64_t& s_pos,
             // if so we expand its range and drop it back into the map at the new Q end pos
             range_buffer.erase(f);
             ++x.end; // increment the match length
-            range_buffer[q_pos] = x; // and stash it
+            range_buffer.set(q_pos, x); // and stash it
         } else {
             // if it doesn't, we store a new range
-            range_buffer[q_pos] = {s_pos, s_pos+1};
+            range_buffer.set(q_pos, {s_pos, s_pos+1});
         }
     }
 }
 
-void flush_ranges(const uint64_t& s_pos,
-                  std::map<pos_t, range_t>& range_buffer,
+void extend_range(const uint64_t& s_pos,
+                  const pos_t& q_pos,
+                  range_buffer_t& range_buffer,
+                  const seqindex_t& seqidx,
                   mmmulti::iitree<uint64_t, pos_t>& node_iitree,
                   mmmulti::iitree<uint64_t, pos_t>& path_iitree) {
+    extend_range(s_pos, q_pos, range_buffer, seqidx,
+                 [&](const pos_t& q_end_pos, const range_t& range_in_s) {
+                     flush_range(q_end_pos, range_in_s, node_iitree, path_iitree);
+                 });
+}
+
+void flush_ranges(const uint64_t& s_pos,
+                  range_buffer_t& range_buffer,
+                  const range_flush_t& flush) {
     // for each range, we're going to see if we've stepped more than one past the end
     // if we have, we'll write them out
-    std::map<pos_t, range_t>::iterator it = range_buffer.begin();
-    while (it != range_buffer.end()) {
-        if (it->second.end != s_pos) {
-            flush_range(it, node_iitree, path_iitree);
-            it = range_buffer.erase(it);
-        } else {
-            ++it;
+    // every range ends at or before s_pos and the queue is ordered by end,
+    // so the ranges to flush are those at the front of the queue that ended before it
+    std::vector<pos_t> expired;
+    auto& expiry = range_buffer.expiry;
+    while (!expiry.empty() && expiry.front().first < s_pos) {
+        auto& e = expiry.front();
+        auto f = range_buffer.find(e.second);
+        if (f != range_buffer.end() && f->second.end == e.first) {
+            expired.push_back(e.second);
         }
+        expiry.pop_front();
     }
+    // write them in order of their position in Q, as we would walking an ordered map
+    std::sort(expired.begin(), expired.end());
+    for (auto& q_pos : expired) {
+        auto f = range_buffer.find(q_pos);
+        flush(f->first, f->second);
+        range_buffer.erase(f);
+    }
+}
+
+void flush_ranges(const uint64_t& s_pos,
+                  range_buffer_t& range_buffer,
+                  mmmulti::iitree<uint64_t, pos_t>& node_iitree,
+                  mmmulti::iitree<uint64_t, pos_t>& path_iitree) {
+    flush_ranges(s_pos, range_buffer,
+                 [&](const pos_t& q_end_pos, const range_t& range_in_s) {
+                     flush_range(q_end_pos, range_in_s, node_iitree, path_iitree);
+                 });
 }
 
-void flush_range(std::map<pos_t, range_t>::iterator it,
+void flush_range(range_buffer_t::iterator it,
+                 mmmulti::iitree<uint64_t, pos_t>& node_iitree,
+                 mmmulti::iitree<uint64_t, pos_t>& path_iitree) {
+    flush_range(it->first, it->second, node_iitree, path_iitree);
+}
+
+void flush_range(const pos_t& q_end_pos,
+                 const range_t& range_in_s,
                  mmmulti::iitree<uint64_t, pos_t>& node_iitree,
                  mmmulti::iitree<uint64_t, pos_t>& path_iitree) {
-    auto& range_in_s = it->second;
     uint64_t match_length, match_start_in_s, match_end_in_s, match_start_in_q, match_end_in_q;
     pos_t match_pos_in_q, match_pos_in_s, match_start_pos_in_q;
-    pos_t match_end_pos_in_q = it->first;
+    pos_t match_end_pos_in_q = q_end_pos;
     bool is_rev_match = is_rev(match_end_pos_in_q);
     if (!is_rev_match) {
         match_length = range_in_s.end - range_in_s.begin;
@@ -89,55 +130,48 @@ void flush_range(std::map<pos_t, range_t>::iterator it,
 // break the big range into its component ranges that we haven't already closed,
 // breaking on sequence breaks
 void for_each_fresh_range(const match_t& range,
-                          const std::vector<bool>& seen_bv,
+                          const seen_bv_t& seen_bv,
                           const std::function<void(match_t)>& lambda) {
     // walk range, breaking where we've seen it, emitting new ranges
     uint64_t p = range.start;
-    pos_t t = range.pos;
     //std::cerr << "for_each_fresh_range " << range.start << "-" << range.end << " " << pos_to_string(range.pos) << std::endl;
     while (p < range.end) {
-        // if we haven't seen p, start making a range
-        //std::cerr << "looking at " << p << std::endl;
-        if (seen_bv[p]) {
-            ++p;
-            incr_pos(t);
-        } else {
-            // otherwise, skip along
-            uint64_t q = p;
-            pos_t v = t;
-            while (p < range.end && !seen_bv[p]) {
-                ++p;
-                incr_pos(t);
-            }
-            //std::cerr << "lambda\t" << q << " " << p << " " << pos_to_string(v) << std::endl;
-            lambda({q, p, v});
-        }
+        // skip what we've seen, then take everything up to the next seen base
+        uint64_t q = seen_bv.next_unset(p, range.end);
+        if (q == range.end) break;
+        p = seen_bv.next_set(q, range.end);
+        pos_t v = range.pos;
+        incr_pos(v, q - range.start);
+        //std::cerr << "lambda\t" << q << " " << p << " " << pos_to_string(v) << std::endl;
+        lambda({q, p, v});
     }
 }
 
 void handle_range(match_t s,
                   atomicbitvector::atomic_bv_t& curr_bv,
-                  overlap_atomic_queue_t& ovlp_q,
-                  range_atomic_queue_t& todo_in) {
+                  std::vector<std::pair<match_t, bool>>& ovlp,
+                  range_work_queues_t& todo,
+                  const uint64_t& tid) {
     bool all_set_there = true;
     pos_t n = s.pos;
     for (uint64_t i = s.start; i < s.end; ++i) {
         all_set_there = curr_bv.set(offset(n)) && all_set_there;
         incr_pos(n);
     }
-    ovlp_q.push(std::make_pair(s, is_rev(s.pos)));
+    ovlp.push_back(std::make_pair(s, is_rev(s.pos)));
     if (!all_set_there) {
         auto item = std::make_pair(make_pos_t(offset(s.pos),is_rev(s.pos)), s.end - s.start);
-        todo_in.push(item);
+        todo.push(tid, item);
     }
 }
 
 void explore_overlaps(const match_t& b,
-                      const std::vector<bool>& seen_bv,
+                      const seen_bv_t& seen_bv,
                       atomicbitvector::atomic_bv_t& curr_bv,
                       mmmulti::iitree<uint64_t, pos_t>& aln_iitree,
-                      overlap_atomic_queue_t& ovlp_q,
-                      range_atomic_queue_t& todo_in) {
+                      std::vector<std::pair<match_t, bool>>& ovlp,
+                      range_work_queues_t& todo,
+                      const uint64_t& tid) {
     //std::vector<size_t> o;
     aln_iitree.overlap(
         b.start, b.end,
@@ -159,21 +193,22 @@ void explore_overlaps(const match_t& b,
                 r,
                 seen_bv,
                 [&](match_t s) {
-                    handle_range(s, curr_bv, ovlp_q, todo_in);
+                    handle_range(s, curr_bv, ovlp, todo, tid);
                 });
         });
 }
 
-void write_graph_chunk(const seqindex_t& seqidx,
-                       mmmulti::iitree<uint64_t, pos_t>& node_iitree,
-                       mmmulti::iitree<uint64_t, pos_t>& path_iitree,
-                       std::ofstream& seq_v_out,
-                       std::map<pos_t, range_t>& range_buffer,
-                       std::vector<std::pair<uint64_t, uint64_t>>* dsets_ptr,
-                       uint64_t repeat_max,
-                       uint64_t min_repeat_dist) {
-    auto& dsets = *dsets_ptr;
-    size_t seq_v_length = seq_v_out.tellp();
+void emit_sets(const seqindex_t& seqidx,
+               const dset_vector_t& dsets,
+               const uint64_t& begin,
+               const uint64_t& end,
+               const uint64_t& s_start,
+               range_buffer_t& range_buffer,
+               std::string& seq_out,
+               const range_flush_t& flush,
+               uint64_t repeat_max,
+               uint64_t min_repeat_dist) {
+    size_t seq_v_length = s_start;
     uint64_t last_dset_id = std::numeric_limits<uint64_t>::max(); // ~inf
     char current_base = '\0';
     // determine if we've switched references
@@ -198,18 +233,18 @@ void write_graph_chunk(const seqindex_t& seqidx,
         };
     // run the closure for each dset, avoiding looping as configured
     std::map<uint64_t, std::vector<pos_t>> todos;
-    std::string seq_out;
     auto flush_todos =
         [&](void) {
             for (auto& t : todos) {
                 seq_out.push_back(current_base);
                 ++seq_v_length;
                 for (auto& pos : t.second) {
-                    extend_range(seq_v_length-1, pos, range_buffer, seqidx, node_iitree, path_iitree);
+                    extend_range(seq_v_length-1, pos, range_buffer, seqidx, flush);
                 }
             }
         };
-    for (auto& d : dsets) {
+    for (uint64_t k = begin; k < end; ++k) {
+        auto& d = dsets[k];
         const auto& curr_dset_id = d.first;
         const auto& curr_offset = d.second;
         char base = seqidx.at(curr_offset);
@@ -227,7 +262,7 @@ void write_graph_chunk(const seqindex_t& seqidx,
             current_base = base;
             seq_out.push_back(current_base);
             ++seq_v_length;
-            flush_ranges(seq_v_length-1, range_buffer, node_iitree, path_iitree);
+            flush_ranges(seq_v_length-1, range_buffer, flush);
             last_dset_id = curr_dset_id;
         }
         pos_t curr_q_pos = make_pos_t(curr_offset, false);
@@ -244,17 +279,399 @@ void write_graph_chunk(const seqindex_t& seqidx,
             ++seq_counts[curr_seq_id];
         }
         if (curr_seq_count == 0) {
-            extend_range(seq_v_length-1, curr_q_pos, range_buffer, seqidx, node_iitree, path_iitree);
+            extend_range(seq_v_length-1, curr_q_pos, range_buffer, seqidx, flush);
         } else {
             todos[seq_counts[curr_seq_id]].push_back(curr_q_pos);
         }
         last_seq_pos[curr_seq_id] = curr_q_pos;
     }
     flush_todos(); // catch any todos we had hanging around
-    seq_v_out << seq_out;
-    delete dsets_ptr;
 }
 
+void write_graph_chunk(const seqindex_t& seqidx,
+                       mmmulti::iitree<uint64_t, pos_t>& node_iitree,
+                       mmmulti::iitree<uint64_t, pos_t>& path_iitree,
+                       std::ofstream& seq_v_out,
+                       range_buffer_t& range_buffer,
+                       const dset_vector_t& dsets,
+                       uint64_t repeat_max,
+                       uint64_t min_repeat_dist,
+                       const uint64_t& num_threads) {
+    size_t seq_v_length = seq_v_out.tellp();
+    range_flush_t to_trees =
+        [&](const pos_t& q_end_pos, const range_t& range_in_s) {
+            flush_range(q_end_pos, range_in_s, node_iitree, path_iitree);
+        };
+    const uint64_t n = dsets.size();
+    const uint64_t n_slices = std::min(num_threads, n / min_graph_slice_length);
+    if (n_slices <= 1) {
+        std::string seq_out;
+        emit_sets(seqidx, dsets, 0, n, seq_v_length, range_buffer, seq_out, to_trees, repeat_max, min_repeat_dist);
+        seq_v_out << seq_out;
+        return;
+    }
+    // cut the sets into slices, each of which is written with a range buffer of its own
+    // the repeat limits only look within a set, so the slices are independent but for the ranges running between them
+    std::vector<uint64_t> bounds = { 0 };
+    for (uint64_t k = 1; k < n_slices; ++k) {
+        uint64_t j = std::max(k * n / n_slices, bounds.back());
+        while (j > 0 && j < n && dsets[j].first == dsets[j-1].first) ++j;
+        if (j > bounds.back() && j < n) bounds.push_back(j);
+    }
+    bounds.push_back(n);
+    std::vector<graph_slice_t> slices(bounds.size() - 1);
+    paryfor::parallel_for<uint64_t>(
+        0, slices.size(), num_threads, 1,
+        [&](uint64_t k) {
+            auto& slice = slices[k];
+            range_buffer_t slice_buffer;
+            emit_sets(seqidx, dsets, bounds[k], bounds[k+1], 0, slice_buffer, slice.seq,
+                      [&](const pos_t& q_end_pos, const range_t& range_in_s) {
+                          slice.flushed.push_back(std::make_pair(q_end_pos, range_in_s));
+                      },
+                      repeat_max, min_repeat_dist);
+            for (auto& r : slice_buffer.ranges) {
+                slice.open.push_back(r);
+            }
+        });
+    // stitch them together in order, as if we had written them one base after another
+    std::vector<std::pair<pos_t, range_t>> open;
+    for (auto& slice : slices) {
+        const uint64_t s_start = seq_v_length;
+        // what didn't reach the slice is done, as it would be when we wrote its first base
+        flush_ranges(s_start, range_buffer, to_trees);
+        open.clear();
+        auto place =
+            [&](std::pair<pos_t, range_t> r, const bool& is_open) {
+                r.second.begin += s_start;
+                r.second.end += s_start;
+                if (r.second.begin == s_start) {
+                    // a range starting the slice carries on any ending next to it in Q just before it in S
+                    pos_t q_first = r.first;
+                    decr_pos(q_first, r.second.end - r.second.begin - 1);
+                    pos_t q_last_pos = q_first;
+                    decr_pos(q_last_pos);
+                    auto f = range_buffer.find(q_last_pos);
+                    if (f != range_buffer.end()) {
+                        if (breaks_range(q_last_pos, q_first, seqidx)) {
+                            flush_range(f, node_iitree, path_iitree);
+                            range_buffer.erase(f);
+                        } else if (f->second.end == s_start) {
+                            r.second.begin = f->second.begin;
+                            range_buffer.erase(f);
+                        }
+                    }
+                }
+                if (is_open) {
+                    open.push_back(r);
+                } else {
+                    flush_range(r.first, r.second, node_iitree, path_iitree);
+                }
+            };
+        for (auto& r : slice.flushed) place(r, false);
+        for (auto& r : slice.open) place(r, true);
+        // the range buffer expects its ranges to arrive in order of their end
+        std::sort(open.begin(), open.end(),
+                  [](const std::pair<pos_t, range_t>& a,
+                     const std::pair<pos_t, range_t>& b) {
+                      return a.second.end < b.second.end;
+                  });
+        for (auto& r : open) {
+            range_buffer.set(r.first, r.second);
+        }
+        seq_v_out << slice.seq;
+        seq_v_length += slice.seq.size();
+        std::vector<std::pair<pos_t, range_t>>().swap(slice.flushed);
+    }
+}
+
+
+void touched_runs_t::build(spill_vector_t<std::pair<uint64_t, uint64_t>>& ranges) {
+    starts.clear();
+    ends.clear();
+    ranks.clear();
+    count = 0;
+    ips4o::parallel::sort(ranges.begin(), ranges.end());
+    for (auto& r : ranges) {
+        if (!starts.empty() && r.first <= ends.back()) {
+            ends.back() = std::max(ends.back(), r.second);
+        } else {
+            starts.push_back(r.first);
+            ends.push_back(r.second);
+        }
+    }
+    ranks.resize(starts.size());
+    for (uint64_t k = 0; k < starts.size(); ++k) {
+        ranks[k] = count;
+        count += ends[k] - starts[k];
+    }
+}
+
+uint64_t touched_runs_t::run_of(const uint64_t& p) const {
+    // find the last run starting at or before p
+    uint64_t k = std::upper_bound(starts.begin(), starts.end(), p) - starts.begin() - 1;
+    assert(p >= starts[k] && p < ends[k]);
+    return k;
+}
+
+uint64_t touched_runs_t::rank(const uint64_t& p) const {
+    uint64_t k = run_of(p);
+    return ranks[k] + (p - starts[k]);
+}
+
+void unite_batch(closure_batch_t& batch,
+                 spill_vector_t<DisjointSets::Aint>& q_sets_data,
+                 const uint64_t& num_threads) {
+    auto& ovlp = batch.ovlp;
+    auto& runs = batch.runs;
+    // order the overlaps by their query start, so neighboring tasks touch neighboring ids
+    ips4o::parallel::sort(ovlp.begin(), ovlp.end(),
+                          [](const std::pair<match_t, bool>& a,
+                             const std::pair<match_t, bool>& b) {
+                              return a.first.start < b.first.start;
+                          });
+    // disjoint set structure
+    q_sets_data.resize_for_overwrite(runs.count);
+    // this initializes everything
+    auto disjoint_sets = DisjointSets(q_sets_data.data(), q_sets_data.size());
+    paryfor::parallel_for<uint64_t>(
+        0, ovlp.size(), num_threads, 10000,
+        [&](uint64_t k) {
+            auto& s = ovlp[k];
+            auto& r = s.first;
+            bool rev = is_rev(r.pos);
+            uint64_t j = r.start;
+            uint64_t t = offset(r.pos);
+            while (j != r.end) {
+                // both sides advance through consecutive ids until one leaves its touched run
+                uint64_t q_run = runs.run_of(j);
+                uint64_t t_run = runs.run_of(t);
+                uint64_t q_id = runs.ranks[q_run] + (j - runs.starts[q_run]);
+                uint64_t t_id = runs.ranks[t_run] + (t - runs.starts[t_run]);
+                uint64_t n = std::min(r.end - j, runs.ends[q_run] - j);
+                if (!rev) {
+                    n = std::min(n, runs.ends[t_run] - t);
+                    for (uint64_t i = 0; i < n; ++i) {
+                        // unite both sides of the overlap
+                        disjoint_sets.unite(q_id + i, t_id + i);
+                    }
+                    t += n;
+                } else {
+                    n = std::min(n, t - runs.starts[t_run] + 1);
+                    for (uint64_t i = 0; i < n; ++i) {
+                        disjoint_sets.unite(q_id + i, t_id - i);
+                    }
+                    t -= n;
+                }
+                j += n;
+            }
+        });
+    // the overlaps are freed rather than kept for the next batch, as this one still has to be sorted and emitted
+    ovlp.clear();
+    // now read out our transclosures, replacing each base's id with that of its set
+    // the ids are first pointed at their roots block by block, so the readout is a single hop
+    const uint64_t find_block = 1 << 16;
+    paryfor::parallel_for<uint64_t>(
+        0, (disjoint_sets.size() + find_block - 1) / find_block, num_threads, 1,
+        [&](uint64_t b) {
+            disjoint_sets.find_all(b * find_block, std::min(disjoint_sets.size(), (b + 1) * find_block));
+        });
+    auto& dsets = batch.dsets;
+    paryfor::parallel_for<uint64_t>(
+        0, dsets.size(), num_threads, 10000,
+        [&](uint64_t j) {
+            dsets[j].first = disjoint_sets.parent(dsets[j].first);
+        });
+}
+
+uint64_t exclusive_prefix_sum(uint64_t* v,
+                              const uint64_t& n,
+                              const uint64_t& num_threads) {
+    const uint64_t block = 1 << 16;
+    const uint64_t n_blocks = (n + block - 1) / block;
+    std::vector<uint64_t> sums(n_blocks);
+    paryfor::parallel_for<uint64_t>(
+        0, n_blocks, num_threads, 1,
+        [&](uint64_t b) {
+            uint64_t sum = 0;
+            for (uint64_t i = b * block; i < std::min(n, (b + 1) * block); ++i) {
+                sum += v[i];
+            }
+            sums[b] = sum;
+        });
+    uint64_t total = 0;
+    for (auto& sum : sums) {
+        uint64_t x = sum;
+        sum = total;
+        total += x;
+    }
+    paryfor::parallel_for<uint64_t>(
+        0, n_blocks, num_threads, 1,
+        [&](uint64_t b) {
+            uint64_t sum = sums[b];
+            for (uint64_t i = b * block; i < std::min(n, (b + 1) * block); ++i) {
+                uint64_t x = v[i];
+                v[i] = sum;
+                sum += x;
+            }
+        });
+    return total;
+}
+
+void sort_batch(closure_batch_t& batch,
+                dset_sort_scratch_t& scratch,
+                const uint64_t& num_threads) {
+    auto& dsets = batch.dsets;
+    // the dsets come in the order of their bases in Q, each with the id of its set
+    // so the first entry of a set holds its smallest position, and numbering the sets
+    // in the order of their first entries numbers them in the order we emit them
+    const uint64_t n = dsets.size();
+    const uint64_t m = batch.runs.count; // the set ids are below this
+    assert(n);
+    auto& first = scratch.first;
+    auto& names = scratch.names;
+    first.resize_for_overwrite(m);
+    names.resize_for_overwrite(m);
+    paryfor::parallel_for<uint64_t>(
+        0, m, num_threads, 10000,
+        [&](uint64_t r) {
+            first[r] = n;
+        });
+    paryfor::parallel_for<uint64_t>(
+        0, n, num_threads, 10000,
+        [&](uint64_t j) {
+            uint64_t* f = &first[dsets[j].first];
+            uint64_t curr = __atomic_load_n(f, __ATOMIC_RELAXED);
+            while (j < curr && !__atomic_compare_exchange_n(f, &curr, j, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { }
+        });
+    // count the first entries in each block of the dsets, and from that name the sets block by block
+    const uint64_t block = 1 << 16;
+    const uint64_t n_blocks = (n + block - 1) / block;
+    std::vector<uint64_t> block_sets(n_blocks);
+    paryfor::parallel_for<uint64_t>(
+        0, n_blocks, num_threads, 1,
+        [&](uint64_t b) {
+            uint64_t count = 0;
+            for (uint64_t j = b * block; j < std::min(n, (b + 1) * block); ++j) {
+                count += first[dsets[j].first] == j;
+            }
+            block_sets[b] = count;
+        });
+    uint64_t c = exclusive_prefix_sum(block_sets.data(), n_blocks, 1);
+    paryfor::parallel_for<uint64_t>(
+        0, n_blocks, num_threads, 1,
+        [&](uint64_t b) {
+            uint64_t x = block_sets[b];
+            for (uint64_t j = b * block; j < std::min(n, (b + 1) * block); ++j) {
+                if (first[dsets[j].first] == j) {
+                    names[dsets[j].first] = x++;
+                }
+            }
+        });
+    // bucket the bases by the name of their set, reusing first for the bucket offsets
+    paryfor::parallel_for<uint64_t>(
+        0, c, num_threads, 10000,
+        [&](uint64_t x) {
+            first[x] = 0;
+        });
+    paryfor::parallel_for<uint64_t>(
+        0, n, num_threads, 10000,
+        [&](uint64_t j) {
+            __atomic_fetch_add(&first[names[dsets[j].first]], 1, __ATOMIC_RELAXED);
+        });
+    exclusive_prefix_sum(first.data(), c, num_threads);
+    auto& sorted = scratch.sorted;
+    sorted.resize_for_overwrite(n);
+    paryfor::parallel_for<uint64_t>(
+        0, n, num_threads, 10000,
+        [&](uint64_t j) {
+            uint64_t x = names[dsets[j].first];
+            sorted[__atomic_fetch_add(&first[x], 1, __ATOMIC_RELAXED)] = std::make_pair(x, dsets[j].second);
+        });
+    // each bucket now ends at first[x], and the threads may have filled it out of order
+    paryfor::parallel_for<uint64_t>(
+        0, c, num_threads, 1000,
+        [&](uint64_t x) {
+            uint64_t begin = x ? first[x - 1] : 0;
+            if (first[x] - begin > 1) {
+                std::sort(sorted.begin() + begin, sorted.begin() + first[x]);
+            }
+        });
+    dsets.swap(sorted);
+}
+
+closure_batch_pool_t::~closure_batch_pool_t(void) {
+    for (auto* batch : batches) {
+        delete batch;
+    }
+}
+
+closure_batch_t* closure_batch_pool_t::take(void) {
+    std::lock_guard<SpinLock> guard(lock);
+    if (batches.empty()) {
+        return new closure_batch_t(budget);
+    }
+    closure_batch_t* batch = batches.back();
+    batches.pop_back();
+    batch->profile = batch_profile_t();
+    return batch;
+}
+
+void closure_batch_pool_t::give(closure_batch_t* batch) {
+    std::lock_guard<SpinLock> guard(lock);
+    batches.push_back(batch);
+}
+
+closure_batch_sizer_t::closure_batch_sizer_t(const uint64_t& initial_size, const bool& adaptive_batch, const uint64_t& memory_limit)
+    : adaptive(adaptive_batch), size(initial_size) {
+    min_size = std::min(initial_size, min_fit_batch_size);
+    // without a memory limit the time target alone would let a run of cheap batches grow without bound
+    max_size = memory_limit ? std::numeric_limits<uint64_t>::max() : initial_size * 64;
+    // the limit is shared by every batch the pipeline can hold, those waiting in its queues as well as
+    // those its stages are working on
+    batch_bytes = memory_limit / closure_batches_in_flight;
+}
+
+void closure_batch_sizer_t::observe(const batch_profile_t& batch) {
+    smallest = std::min(smallest, size);
+    largest = std::max(largest, size);
+    if (!adaptive) return;
+    double next = 2.0 * size;
+    if (batch.explore_seconds > 0) {
+        next = size * std::min(2.0, std::max(0.5, adaptive_batch_seconds / batch.explore_seconds));
+    }
+    if (batch_bytes) {
+        // the arrays grow with the closure a batch touches and the overlaps it finds
+        double bytes = batch.touched_bases * (sizeof(std::pair<uint64_t, uint64_t>) + sizeof(DisjointSets::Aint))
+            + batch.overlaps * 2 * sizeof(std::pair<match_t, bool>);
+        if (bytes > 0) {
+            next = std::min(next, (double)size * batch_bytes / bytes);
+        }
+    }
+    size = std::max(min_size, std::min(max_size, (uint64_t)next));
+}
+
+void push_batch(closure_batch_queue_t& queue,
+                waiter_t& waiter,
+                closure_batch_t* batch) {
+    backoff_t idle(waiter);
+    while (!queue.try_push(batch)) {
+        ++profile_counters().queue_full_retries;
+        idle.wait();
+    }
+    waiter.notify();
+}
+
+closure_batch_t* pop_batch(closure_batch_queue_t& queue,
+                           waiter_t& waiter) {
+    closure_batch_t* batch = nullptr;
+    backoff_t idle(waiter);
+    while (!queue.try_pop(batch)) {
+        idle.wait();
+    }
+    waiter.notify();
+    return batch;
+}
 
 size_t compute_transitive_closures(
         const seqindex_t& seqidx,
@@ -265,62 +682,137 @@ size_t compute_transitive_closures(
         uint64_t repeat_max,
         uint64_t min_repeat_dist,
         uint64_t transclose_batch_size, // size of a batch to collect for lock-free transitive closure
+        bool adaptive_batch,
+        uint64_t memory_limit,
         bool show_progress,
         uint64_t num_threads,
-        const std::chrono::time_point<std::chrono::steady_clock>& start_time) {
+        const std::chrono::time_point<std::chrono::steady_clock>& start_time,
+        uint64_t q_begin,
+        uint64_t q_end) {
     // open the writers in the iitrees
     node_iitree.open_writer();
     path_iitree.open_writer();
     // open seq_v_file
     std::ofstream seq_v_out(seq_v_file.c_str());
+    if (!seq_v_out) {
+        std::cerr << "[seqwish::transclosure] error: could not open " << seq_v_file << " for writing" << std::endl;
+        exit(1);
+    }
     // remember the elements of Q we've seen
     //std::cerr << "seq_size " << seqidx.seq_length() << std::endl;
-    std::vector<bool> q_seen_bv(seqidx.seq_length());
+    seen_bv_t q_seen_bv(seqidx.seq_length());
     //atomicbitvector::atomic_bv_t q_seen_bv(seqidx.seq_length());
-    uint64_t input_seq_length = seqidx.seq_length();
+    uint64_t input_seq_length = std::min(q_end, (uint64_t)seqidx.seq_length());
     // a buffer of ranges to write into our iitree, arranged by range ending position in Q
     // we flush those intervals that don't get extended into the next position in S
     // this maps from a position in Q (our input seqs concatenated, offset and orientation)
     // to a range (start and length) in S (our graph sequence vector)
     // we are mapping from the /last/ position in the matched range, not the first
-    std::map<pos_t, range_t> range_buffer;
-    uint64_t bases_seen = 0;
-    std::thread* graph_writer = nullptr;
+    range_buffer_t range_buffer;
+    std::atomic<uint64_t> bases_seen; bases_seen.store(0);
+    // bits of sequence we've seen during the current union-find chunk
+    // allocated once and cleared after each chunk only where it was set
+    atomicbitvector::atomic_bv_t q_curr_bv(seqidx.seq_length());
+    // the arrays of the batches in flight share this budget, and those that don't fit go to disk
+    // beyond it we hold the two bitvectors over Q, the touched runs and the threads' overlap lists while exploring
+    memory_budget_t budget(memory_limit);
+    // the arrays of a run are kept from batch to batch, as the pipeline's batches and each stage's scratch space
+    // they grow to the largest batch and are then overwritten in place, not faulted in and zeroed again
+    closure_batch_pool_t batch_pool(&budget);
+    closure_batch_sizer_t batch_sizer(transclose_batch_size, adaptive_batch, memory_limit);
+    // the batches pass explore -> union -> sort -> emit, each stage running on its own thread
+    // the queues between the stages are short, which bounds the batches in memory to closure_batches_in_flight
+    closure_batch_queue_t union_q, sort_q, emit_q;
+    waiter_t union_waiter, sort_waiter, emit_waiter;
+    // the time each stage spends working, each written only by its own stage
+    double explore_seconds = 0, union_seconds = 0, sort_seconds = 0, emit_seconds = 0;
+    auto log_step =
+        [&](const closure_batch_t& batch, const std::string& step) {
+#ifdef DEBUG_TRANSCLOSURE
+            if (!show_progress) return;
+            // the stages log concurrently, so we write each line at once
+            std::stringstream line;
+            line << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " " << std::setprecision(2) << (double)bases_seen.load() / (double)seqidx.seq_length() * 100 << "% " << batch.chunk_start << "-" << batch.chunk_end << " " << step << "\n";
+            std::cerr << line.str();
+#endif
+        };
+    std::thread union_stage(
+        [&](void) {
+            spill_vector_t<DisjointSets::Aint> q_sets_data(&budget);
+            closure_batch_t* batch;
+            while ((batch = pop_batch(union_q, union_waiter)) != nullptr) {
+                auto stage_start = std::chrono::steady_clock::now();
+                log_step(*batch, "parallel_union_find");
+                unite_batch(*batch, q_sets_data, num_threads);
+                batch->profile.union_seconds = seconds_since(stage_start);
+                union_seconds += batch->profile.union_seconds;
+                push_batch(sort_q, sort_waiter, batch);
+            }
+            push_batch(sort_q, sort_waiter, nullptr);
+        });
+    std::thread sort_stage(
+        [&](void) {
+            dset_sort_scratch_t sort_scratch(&budget);
+            closure_batch_t* batch;
+            while ((batch = pop_batch(sort_q, sort_waiter)) != nullptr) {
+                auto stage_start = std::chrono::steady_clock::now();
+                log_step(*batch, "dset_sort");
+                sort_batch(*batch, sort_scratch, num_threads);
+                batch->profile.sort_seconds = seconds_since(stage_start);
+                sort_seconds += batch->profile.sort_seconds;
+                push_batch(emit_q, emit_waiter, batch);
+            }
+            push_batch(emit_q, emit_waiter, nullptr);
+        });
+    std::thread emit_stage(
+        [&](void) {
+            closure_batch_t* batch;
+            while ((batch = pop_batch(emit_q, emit_waiter)) != nullptr) {
+                auto stage_start = std::chrono::steady_clock::now();
+                log_step(*batch, "graph_emission");
+                write_graph_chunk(seqidx, node_iitree, path_iitree, seq_v_out, range_buffer, batch->dsets,
+                                  repeat_max, min_repeat_dist, num_threads);
+                batch->profile.emit_seconds = seconds_since(stage_start);
+                emit_seconds += batch->profile.emit_seconds;
+                profile().add_batch(batch->profile);
+                batch_pool.give(batch);
+            }
+        });
     //uint64_t last_seq_id = seqidx.seq_id_at(0);
+    // per-thread work queues, from which idle threads steal
+    range_work_queues_t todo(num_threads);
+    // the overlaps found by each thread
+    std::vector<std::vector<std::pair<match_t, bool>>> ovlps(num_threads);
+    // and how many times each queried the alignments
+    std::vector<uint64_t> aln_queries(num_threads);
+    // the ranges of Q we touch in a chunk
+    std::vector<std::pair<uint64_t, uint64_t>> seeds;
+    spill_vector_t<std::pair<uint64_t, uint64_t>> touched(&budget);
     // collect based on a seed chunk of a given length
-    for (uint64_t i = 0; i < input_seq_length; ) {
+    for (uint64_t i = q_begin; i < input_seq_length; ) {
         // scan our q_seen_bv to find our next start
         //std::cerr << "closing\t" << i << std::endl;
-        while (i < input_seq_length && q_seen_bv[i]) ++i;
+        i = q_seen_bv.next_unset(i, input_seq_length);
         //std::cerr << "scanned_to\t" << i << std::endl;
         if (i >= input_seq_length) break; // we're done!
+        auto stage_start = std::chrono::steady_clock::now();
 
+        auto* batch = batch_pool.take();
         // where our chunk begins
-        uint64_t chunk_start = i;
+        uint64_t chunk_start = batch->chunk_start = i;
         // extend until we've got chunk_size unseen bases (and where it ends (not past the end of the sequence))
-        uint64_t bases_to_consider = 0;
-        uint64_t chunk_end = chunk_start;
-        while (bases_to_consider < transclose_batch_size && chunk_end < input_seq_length) {
-            bases_to_consider += !q_seen_bv[chunk_end++];
-        }
+        uint64_t chunk_end = batch->chunk_end = std::min(input_seq_length, q_seen_bv.after_nth_unset(chunk_start, batch_sizer.size));
+        batch->profile.chunk_start = chunk_start;
+        batch->profile.chunk_end = chunk_end;
 
         // collect ranges overlapping, per thread to avoid contention
-        // bits of sequence we've seen during this union-find chunk
-        atomicbitvector::atomic_bv_t q_curr_bv(seqidx.seq_length());
-        // shared work queues for our threads
-        auto todo_in_ptr = new range_atomic_queue_t;
-        auto& todo_in = *todo_in_ptr;
-        auto todo_out_ptr = new range_atomic_queue_t;
-        auto& todo_out = *todo_out_ptr;
-        auto ovlp_q_ptr = new overlap_atomic_queue_t;
-        auto& ovlp_q = *ovlp_q_ptr;
-        std::deque<std::pair<pos_t, uint64_t>> todo; // intermediate buffer for master thread
-        std::vector<std::pair<match_t, bool>> ovlp; // written into by the master thread
-#ifdef DEBUG_TRANSCLOSURE
-        if (show_progress) std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " " << std::setprecision(2) << (double)bases_seen / (double)seqidx.seq_length() * 100 << "% " << chunk_start << "-" << chunk_end << " overlap_collect" << std::endl;
-#endif
+        std::fill(aln_queries.begin(), aln_queries.end(), 0);
+        log_step(*batch, "overlap_collect");
         // seed the initial ranges
         // the chunk range isn't an actual alignment, so we handle it differently
+        uint64_t seed_count = 0;
+        // the ranges of Q we touch in this chunk, starting with the seeds
+        seeds.clear();
         for_each_fresh_range({chunk_start, chunk_end, 0}, q_seen_bv, [&](match_t b) {
                 // the special case is handling ranges that have no matches
                 // we need to close these even if they aren't matched to anything
@@ -328,27 +820,19 @@ size_t compute_transitive_closures(
                     assert(!q_seen_bv[j]);
                     q_curr_bv.set(j);
                 }
+                seeds.push_back(std::make_pair(b.start, b.end));
                 auto range = std::make_pair(make_pos_t(b.start, false), b.end - b.start);
-                if (!todo_out.try_push(range)) {
-                    todo.push_back(range);
-                    //todo_seen.insert(range);
-                }
+                // deal the seeds out across the threads
+                todo.push(seed_count++, range);
             });
-        std::atomic<bool> work_todo;
-        std::vector<std::atomic<bool>> explorings(num_threads);
-        work_todo.store(false);
         auto worker_lambda =
             [&](uint64_t tid) {
-                //auto& ovlp = ovlps[tid];
-                auto& exploring = explorings[tid];
-                while (!work_todo.load()) {
-                    std::this_thread::sleep_for(1ns);
-                }
-                exploring.store(true);
+                auto& ovlp = ovlps[tid];
                 std::pair<pos_t, uint64_t> item;
-                while (work_todo.load()) {
-                    if (todo_out.try_pop(item)) {
-                        exploring.store(true);
+                backoff_t idle(todo.waiter());
+                while (true) {
+                    if (todo.pop(tid, item)) {
+                        idle.reset();
                         auto& pos = item.first;
                         auto& match_len = item.second;
                         uint64_t n = !is_rev(pos) ? offset(pos) : offset(pos) - match_len + 1;
@@ -358,267 +842,129 @@ size_t compute_transitive_closures(
                                          q_seen_bv,
                                          q_curr_bv,
                                          aln_iitree,
-                                         ovlp_q,
-                                         todo_in);
+                                         ovlp,
+                                         todo,
+                                         tid);
+                        ++aln_queries[tid];
+                        todo.done();
+                    } else if (todo.finished()) {
+                        // nothing is queued and nobody is exploring, so nothing more can arrive
+                        break;
                     } else {
-                        exploring.store(false);
-                        std::this_thread::sleep_for(0.00001ns);
+                        idle.wait();
                     }
                 }
-                exploring.store(false);
             };
         // launch our threads to expand the overlap set in parallel
         std::vector<std::thread> workers; workers.reserve(num_threads);
         for (uint64_t t = 0; t < num_threads; ++t) {
             workers.emplace_back(worker_lambda, t);
         }
-        // manage the threads
-        uint64_t empty_iter_count = 0;
-        auto still_exploring = [&explorings]() {
-            bool ongoing = false;
-            for (auto& e : explorings) {
-                ongoing = ongoing || e.load();
-            }
-            return ongoing;
-        };
-        work_todo.store(true);
-        while (!todo_in.was_empty() || !todo.empty() || !todo_out.was_empty() || !ovlp_q.was_empty() || still_exploring() || ++empty_iter_count < 1000) {
-            std::this_thread::sleep_for(0.00001ns);
-            // read from todo_in, into todo
-            std::pair<pos_t, uint64_t> item;
-            while (todo_in.try_pop(item)) {
-                todo.push_back(item);
-            }
-            // then transfer to todo_out, until it's full
-            while (!todo.empty()) {
-                empty_iter_count = 0;
-                item = todo.front();
-                if (todo_out.try_push(item)) {
-                    todo.pop_front();
-                } else {
-                    break;
-                }
-            }
-            // collect our overlaps
-            std::pair<match_t, bool> o;
-            while (ovlp_q.try_pop(o)) {
-                ovlp.push_back(o);
-            }
-        }
-        //std::cerr << "telling threads to stop" << std::endl;
-        work_todo.store(false);
-        assert(todo.empty() && todo_in.was_empty() && todo_out.was_empty() && ovlp_q.was_empty() && !still_exploring());
-        //std::cerr << "gonna join" << std::endl;
         for (uint64_t t = 0; t < num_threads; ++t) {
             workers[t].join();
         }
-        delete todo_in_ptr;
-        delete todo_out_ptr;
-        delete ovlp_q_ptr;
-
-#ifdef DEBUG_TRANSCLOSURE
-        if (show_progress) std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " " << std::setprecision(2) << (double)bases_seen / (double)seqidx.seq_length() * 100 << "% " << chunk_start << "-" << chunk_end << " rank_build" << std::endl;
-#endif
-        // run the transclosure for this region using lock-free union find
-        // convert the ranges into positions in the input sequence space
-        // ... compute ranges
-        std::vector<std::pair<uint64_t, uint64_t>> ranges;
+        // gather the overlaps
+        auto& ovlp = batch->ovlp;
         {
-            uint64_t begin = 0;
-            uint64_t end = q_curr_bv.size();
-            uint64_t chunk_size = end/num_threads;
-
-            std::pair<uint64_t, uint64_t> todo_range = std::make_pair(begin, std::min(begin + chunk_size, end));
-            uint64_t& todo_i = todo_range.first;
-            uint64_t& todo_j = todo_range.second;
-            while (todo_i != end) {
-                ranges.push_back(todo_range);
-                todo_i = std::min(todo_i + chunk_size, end);
-                todo_j = std::min(todo_j + chunk_size, end);
+            uint64_t ovlp_count = 0;
+            for (auto& o : ovlps) {
+                ovlp_count += o.size();
             }
-        }
-
-        // ... compute how many set elements in each range and in total
-        std::vector<uint64_t> q_curr_bv_counts; q_curr_bv_counts.resize(ranges.size());
-        for (auto& x : q_curr_bv_counts) { x = 0; }
-        paryfor::parallel_for<uint64_t>(
-                0, ranges.size(), num_threads,
-                [&](uint64_t num_range, int tid) {
-                    for (uint64_t ii = ranges[num_range].first; ii < ranges[num_range].second; ++ii) {
-                        if (q_curr_bv[ii]) {
-                            ++q_curr_bv_counts[num_range];
-                        }
-                    }
-                });
-        uint64_t q_curr_bv_count = 0;
-        for(auto& value : q_curr_bv_counts) { q_curr_bv_count += value; }
-
-        // use a rank support to make a dense mapping from the current bases to an integer range
-        // ... pre-allocate default values
-        std::vector<uint64_t> q_curr_bv_vec; q_curr_bv_vec.resize(q_curr_bv_count);
-        // ... prepare offsets in the vector to fill: we already know the number of items that will come from each range.
-        {
-            // ...... range 0 elements will be inserted from the position 0
-            // ...... range 1 elements will be inserted from the position num_element_range_0
-            // ...... range N elements will be inserted from the position num_element_range_0+1+...+N-1
-            uint64_t current_starting_pos_for_range = q_curr_bv_count;
-            for(int64_t num_range = (int64_t)ranges.size() - 1; num_range >= 0; --num_range) {
-                current_starting_pos_for_range -= q_curr_bv_counts[num_range];
-                q_curr_bv_counts[num_range] = current_starting_pos_for_range;
+            ovlp.resize_for_overwrite(ovlp_count);
+            auto* next = ovlp.begin();
+            uint64_t union_ops = 0;
+            for (auto& o : ovlps) {
+                for (auto& r : o) {
+                    union_ops += r.first.end - r.first.start;
+                }
+                next = std::copy(o.begin(), o.end(), next);
+                o.clear();
+            }
+            auto& counters = profile_counters();
+            for (auto& q : aln_queries) {
+                batch->profile.aln_overlap_queries += q;
             }
+            batch->profile.overlaps = ovlp_count;
+            batch->profile.union_ops = union_ops;
+            counters.aln_overlap_queries += batch->profile.aln_overlap_queries;
+            counters.overlaps_explored += ovlp_count;
+            counters.union_ops += union_ops;
         }
 
-        // ... fill in parallel
-        paryfor::parallel_for<uint64_t>(
-                0, ranges.size(), num_threads,
-                [&](uint64_t num_range, int tid) {
-                    for (uint64_t ii = ranges[num_range].first; ii < ranges[num_range].second; ++ii) {
-                        if (q_curr_bv[ii]) {
-                            q_curr_bv_vec[q_curr_bv_counts[num_range]++] = ii;
-                        }
-                    }
+        log_step(*batch, "rank_build");
+        // convert the ranges into positions in the input sequence space
+        // ... every base we've touched is in a seed or in the target of an overlap
+        {
+            uint64_t seed_ranges = seeds.size();
+            touched.resize_for_overwrite(seed_ranges + ovlp.size());
+            std::copy(seeds.begin(), seeds.end(), touched.begin());
+            paryfor::parallel_for<uint64_t>(
+                0, ovlp.size(), num_threads, 10000,
+                [&](uint64_t k) {
+                    auto& r = ovlp[k].first;
+                    uint64_t length = r.end - r.start;
+                    uint64_t first = !is_rev(r.pos) ? offset(r.pos) : offset(r.pos) - length + 1;
+                    touched[seed_ranges + k] = std::make_pair(first, first + length);
                 });
-
-        sdsl::bit_vector q_curr_bv_sdsl(seqidx.seq_length());
-        for (auto p : q_curr_bv_vec) {
-            q_curr_bv_sdsl[p] = 1;
         }
-        sdsl::bit_vector::rank_1_type q_curr_rank;
-        sdsl::util::assign(q_curr_rank, sdsl::bit_vector::rank_1_type(&q_curr_bv_sdsl));
-        //q_curr_bv_vec.clear();
-        // disjoint set structure
-        std::vector<DisjointSets::Aint> q_sets_data(q_curr_bv_count);
-        // this initializes everything
-        auto disjoint_sets = DisjointSets(q_sets_data.data(), q_sets_data.size());
-#ifdef DEBUG_TRANSCLOSURE
-        if (show_progress) std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " " << std::setprecision(2) << (double)bases_seen / (double)seqidx.seq_length() * 100 << "% " << chunk_start << "-" << chunk_end << " parallel_union_find" << std::endl;
-#endif
-        paryfor::parallel_for<uint64_t>(
-            0, ovlp.size(), num_threads, 10000,
-            [&](uint64_t k) {
-                auto& s = ovlp.at(k);
-                auto& r = s.first;
-                pos_t p = r.pos;
-                for (uint64_t j = r.start; j != r.end; ++j) {
-                    // unite both sides of the overlap
-                    disjoint_sets.unite(q_curr_rank(j), q_curr_rank(offset(p)));
-                    incr_pos(p);
-                }
-            });
-        // now read out our transclosures
-#ifdef DEBUG_TRANSCLOSURE
-        if (show_progress) std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " " << std::setprecision(2) << (double)bases_seen / (double)seqidx.seq_length() * 100 << "% " << chunk_start << "-" << chunk_end << " dset_write" << std::endl;
-#endif
-        // maps from dset id to query base
-        auto* dsets_ptr = new std::vector<std::pair<uint64_t, uint64_t>>(q_curr_bv_count);
-        auto& dsets = *dsets_ptr;
+        // ... collapse them into sorted disjoint runs, which define a dense id for each touched base
+        auto& q_curr_runs = batch->runs;
+        q_curr_runs.build(touched);
+        touched.resize_for_overwrite(0);
+        uint64_t q_curr_bv_count = q_curr_runs.count;
+        // maps from dset id to query base, starting with each base's own id
+        // bases closed in earlier chunks are excluded
+        auto& dsets = batch->dsets;
+        dsets.resize_for_overwrite(q_curr_bv_count);
         std::pair<uint64_t, uint64_t> max_pair = std::make_pair(std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max());
         paryfor::parallel_for<uint64_t>(
-            0, q_curr_bv_count, num_threads, 10000,
-            [&](uint64_t j) {
-                auto& p = q_curr_bv_vec[j];
-                if (!q_seen_bv[p]) {
-                    dsets[j] = std::make_pair(disjoint_sets.find(q_curr_rank(p)), p);
-                } else {
-                    dsets[j] = max_pair;
+            0, q_curr_runs.starts.size(), num_threads, 1000,
+            [&](uint64_t k) {
+                uint64_t j = q_curr_runs.ranks[k];
+                for (uint64_t p = q_curr_runs.starts[k]; p < q_curr_runs.ends[k]; ++p, ++j) {
+                    // clear the bits we set in this chunk, so the next can reuse them
+                    q_curr_bv.reset(p);
+                    if (!q_seen_bv[p]) {
+                        dsets[j] = std::make_pair(j, p);
+                    } else {
+                        dsets[j] = max_pair;
+                    }
                 }
             });
-        //q_curr_bv_vec.clear();
         // remove excluded elements
-        dsets.erase(std::remove_if(dsets.begin(), dsets.end(),
-                                   [&max_pair](const std::pair<uint64_t, uint64_t>& x) {
-                                       return x == max_pair;
-                                   }),
-                    dsets.end());
-        // compress the dsets
-#ifdef DEBUG_TRANSCLOSURE
-        if (show_progress) std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " " << std::setprecision(2) << (double)bases_seen / (double)seqidx.seq_length() * 100 << "% " << chunk_start << "-" << chunk_end << " dset_compression" << std::endl;
-#endif
-        ips4o::parallel::sort(dsets.begin(), dsets.end());
-
-        uint64_t c = 0;
-        assert(dsets.size());
-        uint64_t l = dsets.front().first;
-        for (auto& d : dsets) {
-            if (d.first != l) {
-                ++c;
-                l = d.first;
-            }
-            d.first = c;
-        }
-        /*
-        for (auto& d : dsets) {
-            std::cerr << "sdset\t" << d.first << "\t" << d.second << std::endl;
-        }
-        */
-        // sort by the smallest starting position in each disjoint set
-#ifdef DEBUG_TRANSCLOSURE
-        if (show_progress) std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " " << std::setprecision(2) << (double)bases_seen / (double)seqidx.seq_length() * 100 << "% " << chunk_start << "-" << chunk_end << " dset_sort" << std::endl;
-#endif
-        std::vector<std::pair<uint64_t, uint64_t>> dsets_by_min_pos(c+1);
-        for (uint64_t x = 0; x < c+1; ++x) {
-            dsets_by_min_pos[x].second = x;
-            dsets_by_min_pos[x].first = std::numeric_limits<uint64_t>::max();
-        }
-        for (auto& d : dsets) {
-            uint64_t& minpos = dsets_by_min_pos[d.first].first;
-            minpos = std::min(minpos, d.second);
-        }
-        ips4o::parallel::sort(dsets_by_min_pos.begin(), dsets_by_min_pos.end());
-        /*
-        for (auto& d : dsets_by_min_pos) {
-            std::cerr << "sdset_min_pos\t" << d.second << "\t" << d.first << std::endl;
-        }
-        */
-        // invert the naming
-#ifdef DEBUG_TRANSCLOSURE
-        if (show_progress) std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " " << std::setprecision(2) << (double)bases_seen / (double)seqidx.seq_length() * 100 << "% " << chunk_start << "-" << chunk_end << " dset_invert" << std::endl;
-#endif
-        std::vector<uint64_t> dset_names(c+1);
-        uint64_t x = 0;
-        for (auto& d : dsets_by_min_pos) {
-            dset_names[d.second] = x++;
-        }
-        // rename sdsets and re-sort
-        for (auto& d : dsets) {
-            d.first = dset_names[d.first];
-        }
-        ips4o::parallel::sort(dsets.begin(), dsets.end());
-        /*
+        dsets.resize(std::remove_if(dsets.begin(), dsets.end(),
+                                    [&max_pair](const std::pair<uint64_t, uint64_t>& x) {
+                                        return x == max_pair;
+                                    }) - dsets.begin());
+        // mark q_seen_bv, so that the next chunk can be explored while this one is closed
         for (auto& d : dsets) {
-            std::cerr << "sdset_rename\t" << d.first << "\t" << pos_to_string(d.second) << std::endl;
+            q_seen_bv.set(d.second);
         }
-        */
-        // now, run the graph emission
-#ifdef DEBUG_TRANSCLOSURE
-        if (show_progress) std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " " << std::setprecision(2) << (double)bases_seen / (double)seqidx.seq_length() * 100 << "% " << chunk_start << "-" << chunk_end << " graph_emission" << std::endl;
-#endif
-        // mark q_seen_bv
-        for (auto& d : dsets) {
-            const auto& curr_offset = d.second;
-            q_seen_bv[curr_offset] = 1;
-            ++bases_seen;
+        bases_seen += dsets.size();
+        batch->profile.touched_bases = q_curr_bv_count;
+        batch->profile.closed_bases = dsets.size();
+        batch->profile.explore_seconds = seconds_since(stage_start);
+        explore_seconds += batch->profile.explore_seconds;
+        batch_sizer.observe(batch->profile);
+        push_batch(union_q, union_waiter, batch);
+    }
+    // signal the end of the batches and wait for them to drain through the stages
+    push_batch(union_q, union_waiter, nullptr);
+    union_stage.join();
+    sort_stage.join();
+    emit_stage.join();
+    if (show_progress) {
+        std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time)
+                  << " stage times explore " << explore_seconds << "s union " << union_seconds
+                  << "s sort " << sort_seconds << "s emit " << emit_seconds << "s" << std::endl;
+        if (adaptive_batch && batch_sizer.largest) {
+            std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time)
+                      << " adaptive batches of " << batch_sizer.smallest << "-" << batch_sizer.largest << "bp" << std::endl;
         }
-        // wait for completion of the last writer
-        if (graph_writer != nullptr) {
-            graph_writer->join();
-            delete graph_writer;
+        if (memory_limit) {
+            std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time)
+                      << " " << budget.spill_count() << " batch arrays spilled to disk" << std::endl;
         }
-        // spawn the graph writer thread
-        graph_writer = new std::thread(write_graph_chunk,
-                                       std::ref(seqidx),
-                                       std::ref(node_iitree),
-                                       std::ref(path_iitree),
-                                       std::ref(seq_v_out),
-                                       std::ref(range_buffer),
-                                       dsets_ptr,
-                                       repeat_max,
-                                       min_repeat_dist);
-    }
-    // clean up the last writer
-    if (graph_writer != nullptr) {
-        graph_writer->join();
-        delete graph_writer;
     }
     // close the graph sequence vector
     size_t seq_bytes = seq_v_out.tellp();
@@ -626,16 +972,15 @@ size_t compute_transitive_closures(
     flush_ranges(seq_bytes+1, range_buffer, node_iitree, path_iitree);
     assert(range_buffer.empty());
 #ifdef DEBUG_TRANSCLOSURE
-    if (show_progress) std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " " << std::setprecision(2) << (double)bases_seen / (double)seqidx.seq_length() * 100 << "% " << "building node_iitree and path_iitree indexes" << std::endl;
+    if (show_progress) std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " " << std::setprecision(2) << (double)bases_seen.load() / (double)seqidx.seq_length() * 100 << "% " << "building node_iitree and path_iitree indexes" << std::endl;
 #endif
     // close writers
     node_iitree.close_writer();
     path_iitree.close_writer();
-    // build node_mm and path_mm indexes
-    node_iitree.index(num_threads);
-    path_iitree.index(num_threads);
+    // build node_mm and path_mm indexes, which don't depend on each other
+    index_together(node_iitree, path_iitree, num_threads);
 #ifdef DEBUG_TRANSCLOSURE
-    if (show_progress) std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " " << std::setprecision(2) << (double)bases_seen / (double)seqidx.seq_length() * 100 << "% " << "done" << std::endl;
+    if (show_progress) std::cerr << "[seqwish::transclosure] " << std::fixed << std::showpoint << std::setprecision(3) << seconds_since(start_time) << " " << std::setprecision(2) << (double)bases_seen.load() / (double)seqidx.seq_length() * 100 << "% " << "done" << std::endl;
 #endif
     return seq_bytes;
 }
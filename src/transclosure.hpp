@@ -5,7 +5,11 @@
 #include <iostream>
 #include <unordered_set>
 #include <set>
+#include <deque>
 #include <thread>
+#include <sstream>
+#include <limits>
+#include <functional>
 #include "sdsl/bit_vectors.hpp"
 #include "atomic_bitvector.hpp"
 #include "flat_hash_map.hpp"
@@ -17,62 +21,231 @@
 #include "spinlock.hpp"
 #include "dset64-gccAtomic.hpp"
 #include "atomic_queue.h"
+#include "worksteal.hpp"
+#include "seenbv.hpp"
+#include "spillvec.hpp"
+#include "backoff.hpp"
+#include "profile.hpp"
 #include "time.hpp"
 #include "wang.hpp"
 #include "paryfor.hpp"
+#include "memplan.hpp"
 
 namespace seqwish {
 
 #define DEBUG_TRANSCLOSURE true
 
-typedef atomic_queue::AtomicQueue2<std::pair<pos_t, uint64_t>, 2 << 16> range_atomic_queue_t;
-typedef atomic_queue::AtomicQueue2<std::pair<match_t, bool>, 2 << 16> overlap_atomic_queue_t;
+typedef work_stealing_queues_t<std::pair<pos_t, uint64_t>> range_work_queues_t;
+
+// dset id and query base
+typedef spill_vector_t<std::pair<uint64_t, uint64_t>> dset_vector_t;
 
 struct range_t {
     uint64_t begin = 0;
     uint64_t end = 0;
 };
 
+// the open ranges of the graph being written, keyed by their last position in Q
+// each is also queued by its end in S, so that we can find the ones that weren't extended
+// into the latest base of S without walking through all of them
+struct range_buffer_t {
+    typedef ska::flat_hash_map<pos_t, range_t>::iterator iterator;
+    ska::flat_hash_map<pos_t, range_t> ranges;
+    // (end in S, last position in Q), entries go stale when their range is extended or flushed
+    std::deque<std::pair<uint64_t, pos_t>> expiry;
+    iterator find(const pos_t& q_pos) { return ranges.find(q_pos); }
+    iterator end(void) { return ranges.end(); }
+    void set(const pos_t& q_pos, const range_t& range) {
+        ranges[q_pos] = range;
+        expiry.push_back(std::make_pair(range.end, q_pos));
+    }
+    void erase(iterator it) { ranges.erase(it); }
+    bool empty(void) const { return ranges.empty(); }
+};
+
+// the bases of Q touched by a closure chunk, as sorted disjoint runs
+// each touched base gets a dense id, its rank among all the touched bases
+struct touched_runs_t {
+    std::vector<uint64_t> starts;
+    std::vector<uint64_t> ends;
+    std::vector<uint64_t> ranks; // the dense id of the first base in each run
+    uint64_t count = 0;
+    // build from half-open ranges, which may overlap
+    void build(spill_vector_t<std::pair<uint64_t, uint64_t>>& ranges);
+    // the index of the run holding p
+    uint64_t run_of(const uint64_t& p) const;
+    uint64_t rank(const uint64_t& p) const;
+};
+
+// a chunk of the closure as it moves through the pipeline stages
+// its large arrays are charged to the closure's memory budget
+struct closure_batch_t {
+    closure_batch_t(memory_budget_t* budget) : ovlp(budget), dsets(budget) { }
+    uint64_t chunk_start = 0;
+    uint64_t chunk_end = 0;
+    spill_vector_t<std::pair<match_t, bool>> ovlp;
+    touched_runs_t runs;
+    dset_vector_t dsets;
+    batch_profile_t profile;
+};
+
+// the batches that have been emitted, kept with their arrays to carry the next ones
+// there are never more than were in flight at once
+struct closure_batch_pool_t {
+    closure_batch_pool_t(memory_budget_t* b) : budget(b) { }
+    ~closure_batch_pool_t(void);
+    // a batch to fill, reused if we have one
+    closure_batch_t* take(void);
+    void give(closure_batch_t* batch);
+    memory_budget_t* budget;
+    SpinLock lock;
+    std::vector<closure_batch_t*> batches;
+};
+
+// picks the size of each closure batch from what the batches before it cost when --adaptive-batch is on
+// it aims for batches that take about adaptive_batch_seconds to explore, which amortizes the fixed costs
+// of a batch without leaving the later stages idle, changing by at most a factor of two from one batch to
+// the next, and keeps the arrays of the batches in flight within the memory limit if we have one
+// as the closure doesn't depend on where the batches break, neither does the graph
+const double adaptive_batch_seconds = 1.0;
+struct closure_batch_sizer_t {
+    closure_batch_sizer_t(const uint64_t& initial_size, const bool& adaptive, const uint64_t& memory_limit);
+    bool adaptive = false;
+    uint64_t size = 0; // of the next batch
+    uint64_t min_size = 0;
+    uint64_t max_size = 0;
+    uint64_t batch_bytes = 0; // what the arrays of one of the closure_batches_in_flight may hold, 0 for no limit
+    // the range of sizes we used
+    uint64_t smallest = std::numeric_limits<uint64_t>::max();
+    uint64_t largest = 0;
+    // learn from the batch we just explored, which was started with the current size
+    void observe(const batch_profile_t& batch);
+};
+
+// the hand-off between two stages, a nullptr marks the end of the batches
+typedef atomic_queue::AtomicQueue2<closure_batch_t*, closure_batch_queue_capacity> closure_batch_queue_t;
+
+// where a range goes once it can't be extended, given its last position in Q and its range in S
+// usually the node and path trees, or the buffer of a slice of the graph that is written in parallel
+typedef std::function<void(const pos_t&, const range_t&)> range_flush_t;
+
+// the graph a slice of a batch writes, its positions in S counted from the start of the slice
+struct graph_slice_t {
+    std::string seq;
+    std::vector<std::pair<pos_t, range_t>> flushed;
+    std::vector<std::pair<pos_t, range_t>> open; // those left in the range buffer at the end
+};
+
+// a range can't run across the start of a sequence, from q_last_pos into q_pos
+bool breaks_range(const pos_t& q_last_pos,
+                  const pos_t& q_pos,
+                  const seqindex_t& seqidx);
+
 void extend_range(const uint64_t& s_pos,
                   const pos_t& q_pos,
-                  std::map<pos_t, range_t>& range_buffer,
+                  range_buffer_t& range_buffer,
+                  const seqindex_t& seqidx,
+                  const range_flush_t& flush);
+
+void extend_range(const uint64_t& s_pos,
+                  const pos_t& q_pos,
+                  range_buffer_t& range_buffer,
                   const seqindex_t& seqidx,
                   mmmulti::iitree<uint64_t, pos_t>& node_iitree,
                   mmmulti::iitree<uint64_t, pos_t>& path_iitree);
 
 void flush_ranges(const uint64_t& s_pos,
-                  std::map<pos_t, range_t>& range_buffer,
+                  range_buffer_t& range_buffer,
+                  const range_flush_t& flush);
+
+void flush_ranges(const uint64_t& s_pos,
+                  range_buffer_t& range_buffer,
                   mmmulti::iitree<uint64_t, pos_t>& node_iitree,
                   mmmulti::iitree<uint64_t, pos_t>& path_iitree);
 
-void flush_range(std::map<pos_t, range_t>::iterator it,
+void flush_range(const pos_t& q_end_pos,
+                 const range_t& range_in_s,
+                 mmmulti::iitree<uint64_t, pos_t>& node_iitree,
+                 mmmulti::iitree<uint64_t, pos_t>& path_iitree);
+
+void flush_range(range_buffer_t::iterator it,
                  mmmulti::iitree<uint64_t, pos_t>& node_iitree,
                  mmmulti::iitree<uint64_t, pos_t>& path_iitree);
 
 void for_each_fresh_range(const match_t& range,
-                          const std::vector<bool>& seen_bv,
+                          const seen_bv_t& seen_bv,
                           const std::function<void(match_t)>& lambda);
 
 void handle_range(match_t s,
                   atomicbitvector::atomic_bv_t& curr_bv,
-                  overlap_atomic_queue_t& ovlp_q,
-                  range_atomic_queue_t& todo_in);
+                  std::vector<std::pair<match_t, bool>>& ovlp,
+                  range_work_queues_t& todo,
+                  const uint64_t& tid);
 
 void explore_overlaps(const match_t& b,
-                      const std::vector<bool>& seen_bv,
+                      const seen_bv_t& seen_bv,
                       atomicbitvector::atomic_bv_t& curr_bv,
                       mmmulti::iitree<uint64_t, pos_t>& aln_iitree,
-                      overlap_atomic_queue_t& ovlp_q,
-                      range_atomic_queue_t& todo_in);
+                      std::vector<std::pair<match_t, bool>>& ovlp,
+                      range_work_queues_t& todo,
+                      const uint64_t& tid);
+
+// write the graph of the sets in dsets[begin, end), numbering its positions in S from s_start
+void emit_sets(const seqindex_t& seqidx,
+               const dset_vector_t& dsets,
+               const uint64_t& begin,
+               const uint64_t& end,
+               const uint64_t& s_start,
+               range_buffer_t& range_buffer,
+               std::string& seq_out,
+               const range_flush_t& flush,
+               uint64_t repeat_max,
+               uint64_t min_repeat_dist);
 
+// the smallest slice of a batch that we write on its own thread
+const uint64_t min_graph_slice_length = 1 << 16;
+
+// write the graph of a batch, in parallel over slices of its sets when it is large enough
 void write_graph_chunk(const seqindex_t& seqidx,
                        mmmulti::iitree<uint64_t, pos_t>& node_iitree,
                        mmmulti::iitree<uint64_t, pos_t>& path_iitree,
                        std::ofstream& seq_v_out,
-                       std::map<pos_t, range_t>& range_buffer,
-                       std::vector<std::pair<uint64_t, uint64_t>>* dsets_ptr,
+                       range_buffer_t& range_buffer,
+                       const dset_vector_t& dsets,
                        uint64_t repeat_max,
-                       uint64_t min_repeat_dist);
+                       uint64_t min_repeat_dist,
+                       const uint64_t& num_threads = 1);
+
+// union the overlaps of the batch and set each base's dset id
+// the disjoint sets live in q_sets_data, which the union stage keeps across batches
+void unite_batch(closure_batch_t& batch,
+                 spill_vector_t<DisjointSets::Aint>& q_sets_data,
+                 const uint64_t& num_threads);
+
+// the arrays the sort stage keeps across batches
+struct dset_sort_scratch_t {
+    dset_sort_scratch_t(memory_budget_t* budget) : first(budget), names(budget), sorted(budget) { }
+    spill_vector_t<uint64_t> first; // the first entry of each set, then the offsets of their buckets
+    spill_vector_t<uint64_t> names; // the number of each set in emission order
+    dset_vector_t sorted;
+};
+
+// replace v[0..n) with its exclusive prefix sums, in parallel over blocks, returning the total
+uint64_t exclusive_prefix_sum(uint64_t* v,
+                              const uint64_t& n,
+                              const uint64_t& num_threads);
+
+// renumber the dsets by their first base and bucket them into emission order
+void sort_batch(closure_batch_t& batch,
+                dset_sort_scratch_t& scratch,
+                const uint64_t& num_threads);
+
+void push_batch(closure_batch_queue_t& queue,
+                waiter_t& waiter,
+                closure_batch_t* batch);
+
+closure_batch_t* pop_batch(closure_batch_queue_t& queue,
+                           waiter_t& waiter);
 
 size_t compute_transitive_closures(
     const seqindex_t& seqidx,
@@ -83,8 +256,13 @@ size_t compute_transitive_closures(
     uint64_t repeat_max,
     uint64_t min_repeat_dist,
     uint64_t transclose_batch_size,
+    bool adaptive_batch, // adapt the batch size to the batches before, starting from transclose_batch_size
+    uint64_t memory_limit, // bytes for batch arrays before they spill to disk, 0 for no limit
     bool show_progress,
     uint64_t num_threads,
-    const std::chrono::time_point<std::chrono::steady_clock>& start_time);
+    const std::chrono::time_point<std::chrono::steady_clock>& start_time,
+    // close only the bases in [q_begin, q_end), which no alignment may join to those outside
+    uint64_t q_begin = 0,
+    uint64_t q_end = std::numeric_limits<uint64_t>::max());
 
 }
@@ -3,24 +3,29 @@
 
 #include <iostream>
 #include <sstream>
-#include "mmmultimap.hpp"
+#include "mmiitree.hpp"
+#include "mmmultiset.hpp"
 #include "seqindex.hpp"
 #include "pos.hpp"
 #include "mmap.hpp"
+#include "gfa.hpp"
 
 namespace seqwish {
 
-
+// write the graph as basename.seq (the nodes), basename.scf (the joins between them)
+// and basename.sxs (where the input sequences lie in the nodes), formatting in parallel as for the GFA
 void emit_vgp(const std::string& basename,
               size_t graph_length,
               const std::string& seq_v_file,
-              mmmulti::map<uint64_t, pos_t>& path_mm,
-              mmmulti::map<pos_t, pos_t>& link_fwd_mm,
-              mmmulti::map<pos_t, pos_t>& link_rev_mm,
+              mmmulti::iitree<uint64_t, pos_t>& path_iitree,
               const sdsl::sd_vector<>& seq_id_cbv,
               const sdsl::sd_vector<>::rank_1_type& seq_id_cbv_rank,
               const sdsl::sd_vector<>::select_1_type& seq_id_cbv_select,
-              seqindex_t& seqidx);
+              seqindex_t& seqidx,
+              mmmulti::set<std::pair<pos_t, pos_t>>& link_mmset,
+              const validate_mode_t& validate,
+              const uint64_t& num_threads,
+              const path_steps_t* path_steps = nullptr);
 
 }
 
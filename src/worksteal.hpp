@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include "spinlock.hpp"
+#include "backoff.hpp"
+
+namespace seqwish {
+
+/*
+'work_stealing_queues_t' gives each worker its own deque of tasks. Workers
+push the tasks they discover onto their own deque and take from its back,
+so related work stays on the same thread. A worker whose deque is empty
+steals from the front of the others' deques. We count the tasks that have
+been pushed but not yet finished: once that reaches zero, no task is queued
+or running, nothing more can be pushed, and the workers can stop. Idle
+workers wait on our waiter_t, which we notify on every push and when the
+last task finishes.
+*/
+
+template<typename T>
+class work_stealing_queues_t {
+public:
+    work_stealing_queues_t(const uint64_t& num_workers)
+        : queues(std::max((uint64_t)1, num_workers)) {
+        pending.store(0);
+    }
+    // queue a task on the given worker's deque
+    void push(const uint64_t& tid, const T& item) {
+        pending.fetch_add(1);
+        auto& q = queues[tid % queues.size()];
+        {
+            std::lock_guard<SpinLock> guard(q.lock);
+            q.items.push_back(item);
+        }
+        idle_waiter.notify();
+    }
+    // take our most recent task, or steal the oldest one from another worker
+    bool pop(const uint64_t& tid, T& item) {
+        uint64_t n = queues.size();
+        {
+            auto& q = queues[tid % n];
+            std::lock_guard<SpinLock> guard(q.lock);
+            if (!q.items.empty()) {
+                item = q.items.back();
+                q.items.pop_back();
+                return true;
+            }
+        }
+        for (uint64_t i = 1; i < n; ++i) {
+            auto& q = queues[(tid + i) % n];
+            std::lock_guard<SpinLock> guard(q.lock);
+            if (!q.items.empty()) {
+                item = q.items.front();
+                q.items.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+    // mark a popped task as finished, after any tasks it generated have been pushed
+    void done(void) {
+        if (pending.fetch_sub(1) == 1) {
+            idle_waiter.notify();
+        }
+    }
+    // true when every task pushed has been finished
+    bool finished(void) const {
+        return pending.load() == 0;
+    }
+    waiter_t& waiter(void) {
+        return idle_waiter;
+    }
+
+private:
+    // keep each worker's lock on its own cache line
+    struct alignas(64) worker_queue_t {
+        SpinLock lock;
+        std::deque<T> items;
+    };
+    std::vector<worker_queue_t> queues;
+    std::atomic<uint64_t> pending;
+    waiter_t idle_waiter;
+};
+
+}
@@ -5,7 +5,7 @@ BASH_TAP_ROOT=bash-tap
 
 PATH=../bin:$PATH # for seqwish
 
-plan tests 30
+plan tests 32
 
 is $(seqwish -h 2>&1 | grep "seqwish: a variation graph inducer" | wc -l) 1 "seqwish prints its help"
 
@@ -39,4 +39,8 @@ is $( seqwish -s HLA/TAP1-6890.fa.gz -p HLA/TAP1-6890.paf.gz -b HLA -g HLA/TAP1-
 is $( seqwish -s HLA/TAP2-6891.fa.gz -p HLA/TAP2-6891.paf.gz -b HLA -g HLA/TAP2-6891.fa.gz.gfa && md5sum HLA/TAP2-6891.fa.gz.gfa | cut -f 1 -d\ ) $( cat HLA/TAP2-6891.fa.gz.gfa.md5 ) "seqwish correctly builds the graph for TAP2-6891"
 is $( seqwish -s HLA/V-352962.fa.gz -p HLA/V-352962.paf.gz -b HLA -g HLA/V-352962.fa.gz.gfa && md5sum HLA/V-352962.fa.gz.gfa | cut -f 1 -d\ ) $( cat HLA/V-352962.fa.gz.gfa.md5 ) "seqwish correctly builds the graph for V-352962"
 
+# sequences from a pipe are read in a single pass
+is $( seqwish -s <(zcat HLA/A-3105.fa.gz) -p HLA/A-3105.paf.gz -b HLA -g HLA/A-3105.piped.gfa && md5sum HLA/A-3105.piped.gfa | cut -f 1 -d\ ) $( cat HLA/A-3105.fa.gz.gfa.md5 ) "seqwish builds the graph for A-3105 from sequences in a pipe"
+is $( zcat HLA/B-3106.fa.gz | seqwish -s /dev/stdin -p HLA/B-3106.paf.gz -b HLA -g HLA/B-3106.piped.gfa && md5sum HLA/B-3106.piped.gfa | cut -f 1 -d\ ) $( cat HLA/B-3106.fa.gz.gfa.md5 ) "seqwish builds the graph for B-3106 from sequences on stdin"
+
 rm -f HLA/*gfa
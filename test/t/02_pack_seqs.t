@@ -0,0 +1,22 @@
+#!/usr/bin/env bash
+
+BASH_TAP_ROOT=bash-tap
+. bash-tap/bash-tap-bootstrap
+
+PATH=../bin:$PATH # for seqwish
+
+plan tests 7
+
+is $( seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.paf.gz -b HLA --pack-seqs -g HLA/A-3105.packed.gfa && md5sum HLA/A-3105.packed.gfa | cut -f 1 -d\ ) $( cat HLA/A-3105.fa.gz.gfa.md5 ) "seqwish --pack-seqs builds the same graph for A-3105"
+is $( seqwish -s HLA/DRB1-3123.fa.gz -p HLA/DRB1-3123.paf.gz -b HLA --pack-seqs -g HLA/DRB1-3123.packed.gfa && md5sum HLA/DRB1-3123.packed.gfa | cut -f 1 -d\ ) $( cat HLA/DRB1-3123.fa.gz.gfa.md5 ) "seqwish --pack-seqs builds the same graph for DRB1-3123"
+
+# the first run of each builds the cached index and the second reuses it
+# the packed and unpacked indexes are cached apart, so neither run reads the other's
+rm -rf HLA/index.cache
+is $( seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.paf.gz -b HLA --index-cache HLA/index.cache -g HLA/A-3105.cached.gfa && md5sum HLA/A-3105.cached.gfa | cut -f 1 -d\ ) $( cat HLA/A-3105.fa.gz.gfa.md5 ) "seqwish builds the graph for A-3105 while caching its index"
+is $( seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.paf.gz -b HLA --index-cache HLA/index.cache --pack-seqs -g HLA/A-3105.cached.gfa && md5sum HLA/A-3105.cached.gfa | cut -f 1 -d\ ) $( cat HLA/A-3105.fa.gz.gfa.md5 ) "seqwish --pack-seqs builds the graph for A-3105 while caching its packed index"
+is $( seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.paf.gz -b HLA --index-cache HLA/index.cache --pack-seqs -g HLA/A-3105.cached.gfa && md5sum HLA/A-3105.cached.gfa | cut -f 1 -d\ ) $( cat HLA/A-3105.fa.gz.gfa.md5 ) "seqwish --pack-seqs builds the same graph for A-3105 from its cached packed index"
+is $( seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.paf.gz -b HLA --index-cache HLA/index.cache -g HLA/A-3105.cached.gfa && md5sum HLA/A-3105.cached.gfa | cut -f 1 -d\ ) $( cat HLA/A-3105.fa.gz.gfa.md5 ) "seqwish builds the same graph for A-3105 from its cached index"
+is $( seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.paf.gz -b HLA --index-cache HLA/index.cache --pack-seqs -g HLA/A-3105.cached.gfa -P 2>&1 | grep -c "index loaded from HLA/index.cache/.*packed" ) 1 "seqwish --pack-seqs reads its index from the cache"
+
+rm -rf HLA/*gfa HLA/index.cache
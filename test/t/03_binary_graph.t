@@ -0,0 +1,16 @@
+#!/usr/bin/env bash
+
+BASH_TAP_ROOT=bash-tap
+. bash-tap/bash-tap-bootstrap
+
+PATH=../bin:../scripts:$PATH # for seqwish and bingraph2gfa
+
+plan tests 4
+
+is $( seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.paf.gz -b HLA --binary-graph HLA/A-3105.sqwg && bingraph2gfa HLA/A-3105.sqwg | md5sum | cut -f 1 -d\ ) $( cat HLA/A-3105.fa.gz.gfa.md5 ) "seqwish --binary-graph writes the graph for A-3105"
+is $( seqwish -s HLA/DRB1-3123.fa.gz -p HLA/DRB1-3123.paf.gz -b HLA --binary-graph HLA/DRB1-3123.sqwg && bingraph2gfa HLA/DRB1-3123.sqwg | md5sum | cut -f 1 -d\ ) $( cat HLA/DRB1-3123.fa.gz.gfa.md5 ) "seqwish --binary-graph writes the graph for DRB1-3123"
+is $( seqwish -s HLA/DRB1-3123.fa.gz -p HLA/DRB1-3123.paf.gz -b HLA --binary-graph HLA/DRB1-3123.sqwg --step-index && bingraph2gfa HLA/DRB1-3123.sqwg | md5sum | cut -f 1 -d\ ) $( cat HLA/DRB1-3123.fa.gz.gfa.md5 ) "seqwish --binary-graph writes the graph for DRB1-3123 from the step index"
+# with both outputs at once they come from the same compacted graph
+is $( seqwish -s HLA/B-3106.fa.gz -p HLA/B-3106.paf.gz -b HLA -t 4 -g HLA/B-3106.fa.gz.gfa --binary-graph HLA/B-3106.sqwg && bingraph2gfa HLA/B-3106.sqwg | md5sum | cut -f 1 -d\ ) $( md5sum HLA/B-3106.fa.gz.gfa | cut -f 1 -d\ ) "seqwish --binary-graph writes the graph it writes in GFA for B-3106"
+
+rm -f HLA/*gfa HLA/*sqwg
@@ -0,0 +1,18 @@
+#!/usr/bin/env bash
+
+BASH_TAP_ROOT=bash-tap
+. bash-tap/bash-tap-bootstrap
+
+PATH=../bin:$PATH # for seqwish
+
+plan tests 5
+
+seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.paf.gz -b HLA -o HLA/A-3105.fa.gz -g HLA/A-3105.fa.gz.gfa
+is $( md5sum HLA/A-3105.fa.gz.seq | cut -f 1 -d\ ) $( cat HLA/A-3105.fa.gz.seq.md5 ) "seqwish correctly writes the VGP segments for A-3105"
+is $( md5sum HLA/A-3105.fa.gz.scf | cut -f 1 -d\ ) $( cat HLA/A-3105.fa.gz.scf.md5 ) "seqwish correctly writes the VGP joins for A-3105"
+is $( md5sum HLA/A-3105.fa.gz.sxs | cut -f 1 -d\ ) $( cat HLA/A-3105.fa.gz.sxs.md5 ) "seqwish correctly writes the VGP alignments for A-3105"
+# the segments are the nodes of the GFA, in the same order
+is $( awk '$1 == "S" { print $3 }' HLA/A-3105.fa.gz.seq | md5sum | cut -f 1 -d\ ) $( awk '$1 == "S" { print $3 }' HLA/A-3105.fa.gz.gfa | md5sum | cut -f 1 -d\ ) "seqwish writes the nodes of the GFA as VGP segments for A-3105"
+is $( seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.paf.gz -b HLA -o HLA/A-3105.fa.gz -t 4 && md5sum HLA/A-3105.fa.gz.seq HLA/A-3105.fa.gz.scf HLA/A-3105.fa.gz.sxs | cut -f 1 -d\  | md5sum | cut -f 1 -d\ ) $( cat HLA/A-3105.fa.gz.seq.md5 HLA/A-3105.fa.gz.scf.md5 HLA/A-3105.fa.gz.sxs.md5 | md5sum | cut -f 1 -d\ ) "seqwish writes the same VGP output for A-3105 with 4 threads"
+
+rm -f HLA/*gfa HLA/*.fa.gz.seq HLA/*.fa.gz.scf HLA/*.fa.gz.sxs
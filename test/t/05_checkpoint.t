@@ -0,0 +1,31 @@
+#!/usr/bin/env bash
+
+BASH_TAP_ROOT=bash-tap
+. bash-tap/bash-tap-bootstrap
+
+PATH=../bin:$PATH # for seqwish
+
+plan tests 8
+
+ckpt=HLA/B-3106.checkpoint
+rm -rf $ckpt
+is $( seqwish -s HLA/B-3106.fa.gz -p HLA/B-3106.paf.gz -b HLA --checkpoint $ckpt -g HLA/B-3106.fa.gz.gfa && md5sum HLA/B-3106.fa.gz.gfa | cut -f 1 -d\ ) $( cat HLA/B-3106.fa.gz.gfa.md5 ) "seqwish --checkpoint builds the graph for B-3106"
+is "$( cut -f 1 $ckpt/manifest | tr "\n" " " )" "seqwish-checkpoint seqidx alignments transclosure compact links " "seqwish --checkpoint lists the steps it completed"
+
+# a run stopped after a step left only the steps up to it in its manifest
+cp $ckpt/manifest HLA/B-3106.manifest
+head -n 3 HLA/B-3106.manifest >$ckpt/manifest
+is $( seqwish -s HLA/B-3106.fa.gz -p HLA/B-3106.paf.gz -b HLA --checkpoint $ckpt --resume -g HLA/B-3106.fa.gz.gfa && md5sum HLA/B-3106.fa.gz.gfa | cut -f 1 -d\ ) $( cat HLA/B-3106.fa.gz.gfa.md5 ) "seqwish --resume after the alignments builds the graph for B-3106"
+head -n 4 HLA/B-3106.manifest >$ckpt/manifest
+is $( seqwish -s HLA/B-3106.fa.gz -p HLA/B-3106.paf.gz -b HLA --checkpoint $ckpt --resume -g HLA/B-3106.fa.gz.gfa && md5sum HLA/B-3106.fa.gz.gfa | cut -f 1 -d\ ) $( cat HLA/B-3106.fa.gz.gfa.md5 ) "seqwish --resume after the transitive closure builds the graph for B-3106"
+
+# with another -k the sequence index is reused but the alignments and every step after them run again
+seqwish -s HLA/B-3106.fa.gz -p HLA/B-3106.paf.gz -b HLA -k 7 -g HLA/B-3106.k7.gfa
+is $( seqwish -s HLA/B-3106.fa.gz -p HLA/B-3106.paf.gz -b HLA -k 7 --checkpoint $ckpt --resume -P -g HLA/B-3106.k7.resumed.gfa 2>&1 | grep -c "index loaded from $ckpt" ) 1 "seqwish --resume with another -k reuses the sequence index"
+is $( diff <(cut -f 1,2 HLA/B-3106.manifest) <(cut -f 1,2 $ckpt/manifest) | grep -c "^>" ) 4 "seqwish --resume with another -k reruns the alignments and the steps after them"
+is $( md5sum HLA/B-3106.k7.resumed.gfa | cut -f 1 -d\ ) $( md5sum HLA/B-3106.k7.gfa | cut -f 1 -d\ ) "seqwish --resume with another -k builds the graph of a run from scratch"
+
+# a pipe can't be known again in a later run, so it can't be checkpointed
+is $( seqwish -s <(zcat HLA/B-3106.fa.gz) -p HLA/B-3106.paf.gz -b HLA --checkpoint $ckpt -g HLA/B-3106.piped.gfa 2>&1 | grep -c "need their inputs in regular files" ) 1 "seqwish --checkpoint rejects input from a pipe"
+
+rm -rf HLA/*gfa HLA/B-3106.manifest $ckpt
@@ -0,0 +1,26 @@
+#!/usr/bin/env bash
+
+BASH_TAP_ROOT=bash-tap
+. bash-tap/bash-tap-bootstrap
+
+PATH=../bin:$PATH # for seqwish
+
+plan tests 3
+
+# no alignment joins A-3105 to B-3106, so each can close in a shard of its own
+AB="-s HLA/A-3105.fa.gz,HLA/B-3106.fa.gz -p HLA/A-3105.paf.gz,HLA/B-3106.paf.gz -b HLA"
+shards=HLA/AB.shards
+rm -rf $shards
+seqwish $AB -g HLA/AB.gfa
+seqwish $AB --closure-shards 2 --closure-shard 0 --shard-dir $shards
+seqwish $AB --closure-shards 2 --closure-shard 1 --shard-dir $shards
+is $( ls $shards/*.done | wc -l ) 2 "seqwish --closure-shard closes each of 2 shards"
+is $( seqwish $AB --closure-shards 2 --shard-dir $shards -g HLA/AB.merged.gfa && md5sum HLA/AB.merged.gfa | cut -f 1 -d\ ) $( md5sum HLA/AB.gfa | cut -f 1 -d\ ) "seqwish --closure-shards merges 2 shards into the graph of an unsharded run"
+
+# the alignments of A-3105 join all its sequences, which leaves the second shard empty
+rm -rf $shards
+seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.paf.gz -b HLA --closure-shards 2 --closure-shard 0 --shard-dir $shards
+seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.paf.gz -b HLA --closure-shards 2 --closure-shard 1 --shard-dir $shards
+is $( seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.paf.gz -b HLA --closure-shards 2 --shard-dir $shards -g HLA/A-3105.fa.gz.gfa && md5sum HLA/A-3105.fa.gz.gfa | cut -f 1 -d\ ) $( cat HLA/A-3105.fa.gz.gfa.md5 ) "seqwish --closure-shards merges an empty shard into the graph for A-3105"
+
+rm -rf HLA/*gfa $shards
@@ -0,0 +1,31 @@
+#!/usr/bin/env bash
+
+BASH_TAP_ROOT=bash-tap
+. bash-tap/bash-tap-bootstrap
+
+PATH=../bin:$PATH # for seqwish
+
+plan tests 5
+
+# B-3106 aligns to nothing in A-3105, so it closes on its own at the end of the graph
+rm -rf HLA/A-3105.checkpoint
+seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.paf.gz -b HLA --checkpoint HLA/A-3105.checkpoint -g HLA/A-3105.fa.gz.gfa
+seqwish -s HLA/A-3105.fa.gz,HLA/B-3106.fa.gz -p HLA/A-3105.paf.gz,HLA/B-3106.paf.gz -b HLA -g HLA/AB.gfa
+is $( seqwish -s HLA/A-3105.fa.gz,HLA/B-3106.fa.gz -p HLA/B-3106.paf.gz -b HLA --extend HLA/A-3105.checkpoint -g HLA/AB.extended.gfa && md5sum HLA/AB.extended.gfa | cut -f 1 -d\ ) $( md5sum HLA/AB.gfa | cut -f 1 -d\ ) "seqwish --extend adds B-3106 to the graph for A-3105 as a run from scratch would"
+is $( seqwish -s HLA/A-3105.fa.gz,HLA/B-3106.fa.gz -p HLA/B-3106.paf.gz -b HLA --extend HLA/A-3105.checkpoint -t 4 -g HLA/AB.extended.gfa && md5sum HLA/AB.extended.gfa | cut -f 1 -d\ ) $( md5sum HLA/AB.gfa | cut -f 1 -d\ ) "seqwish --extend adds B-3106 to the graph for A-3105 with 4 threads"
+
+# the old half of A-3105 is closed without alignments, so the new half's alignments join bases of the old graph
+zcat HLA/A-3105.fa.gz | awk '/^>/ { n++ } n <= 6' >HLA/A-3105.old.fa
+zcat HLA/A-3105.fa.gz | awk '/^>/ { n++ } n > 6' >HLA/A-3105.new.fa
+zcat HLA/A-3105.fa.gz | awk '/^>/ && n++ < 6 { print substr($1, 2) }' >HLA/A-3105.old.names
+zcat HLA/A-3105.paf.gz | awk 'NR == FNR { old[$1] = 1; next } !(($1 in old) && ($6 in old))' HLA/A-3105.old.names - >HLA/A-3105.new.paf
+: >HLA/A-3105.old.paf
+rm -rf HLA/A-3105.old.checkpoint
+seqwish -s HLA/A-3105.old.fa -p HLA/A-3105.old.paf -b HLA --checkpoint HLA/A-3105.old.checkpoint -g HLA/A-3105.old.gfa
+# --validate full checks every base of the paths against the input as they are written
+seqwish -s HLA/A-3105.old.fa,HLA/A-3105.new.fa -p HLA/A-3105.new.paf -b HLA --extend HLA/A-3105.old.checkpoint --validate full -g HLA/A-3105.extended.gfa 2>HLA/A-3105.new.log
+is $? 0 "seqwish --extend writes paths that spell the input when the new alignments join bases of the old graph"
+is $( grep -c "warning: the new alignments close together" HLA/A-3105.new.log ) 1 "seqwish --extend warns when the new alignments join bases of the old graph"
+is $( grep -c "^P" HLA/A-3105.extended.gfa ) 11 "seqwish --extend writes a path for each sequence of A-3105"
+
+rm -rf HLA/*gfa HLA/A-3105.old.* HLA/A-3105.new.* HLA/A-3105.checkpoint
@@ -0,0 +1,47 @@
+#!/usr/bin/env bash
+
+BASH_TAP_ROOT=bash-tap
+. bash-tap/bash-tap-bootstrap
+
+PATH=../bin:$PATH # for seqwish
+
+plan tests 9
+
+# each filter of whole PAF rows must give the graph of the rows it keeps, found here by awk
+# the same filtered input given to seqwish unfiltered must match at any thread count
+
+# -m keeps the rows between the pairs of sequences it lists, in either order
+zcat HLA/A-3105.fa.gz | awk '/^>/ { print substr($1, 2) }' | awk '{ n[NR] = $1 } END { for (i = 2; i <= 6; ++i) print n[1], n[i]; print n[8] "\t" n[7]; print n[9], n[9] }' >HLA/A-3105.sml
+zcat HLA/A-3105.paf.gz | awk 'NR == FNR { pair[$1 " " $2] = 1; pair[$2 " " $1] = 1; next } ($1 " " $6) in pair' HLA/A-3105.sml - >HLA/A-3105.sml.paf
+seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.sml.paf -b HLA -g HLA/A-3105.sml.gfa
+for t in 1 8; do
+    is $( seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.paf.gz -b HLA -m HLA/A-3105.sml -t $t -g HLA/A-3105.sml.t$t.gfa && md5sum HLA/A-3105.sml.t$t.gfa | cut -f 1 -d\ ) $( md5sum HLA/A-3105.sml.gfa | cut -f 1 -d\ ) "seqwish -m -t $t builds the graph of the rows between the listed pairs for A-3105"
+done
+
+# --min-block-length keeps the rows whose alignment block is at least that long
+zcat HLA/DRB1-3123.paf.gz | awk '$11 >= 305' >HLA/DRB1-3123.mbl.paf
+seqwish -s HLA/DRB1-3123.fa.gz -p HLA/DRB1-3123.mbl.paf -b HLA -g HLA/DRB1-3123.mbl.gfa
+for t in 1 8; do
+    is $( seqwish -s HLA/DRB1-3123.fa.gz -p HLA/DRB1-3123.paf.gz -b HLA --min-block-length 305 -t $t -g HLA/DRB1-3123.mbl.t$t.gfa && md5sum HLA/DRB1-3123.mbl.t$t.gfa | cut -f 1 -d\ ) $( md5sum HLA/DRB1-3123.mbl.gfa | cut -f 1 -d\ ) "seqwish --min-block-length -t $t builds the graph of the rows with long enough blocks for DRB1-3123"
+done
+
+# --min-identity keeps the rows whose residue matches over block length is at least that
+zcat HLA/DRB1-3123.paf.gz | awk '$10 / $11 >= 0.85' >HLA/DRB1-3123.mid.paf
+seqwish -s HLA/DRB1-3123.fa.gz -p HLA/DRB1-3123.mid.paf -b HLA -g HLA/DRB1-3123.mid.gfa
+for t in 1 8; do
+    is $( seqwish -s HLA/DRB1-3123.fa.gz -p HLA/DRB1-3123.paf.gz -b HLA --min-identity 0.85 -t $t -g HLA/DRB1-3123.mid.t$t.gfa && md5sum HLA/DRB1-3123.mid.t$t.gfa | cut -f 1 -d\ ) $( md5sum HLA/DRB1-3123.mid.gfa | cut -f 1 -d\ ) "seqwish --min-identity -t $t builds the graph of the rows with high enough identity for DRB1-3123"
+done
+
+# --max-pair-mappings keeps the longest rows of each pair, by block length, then residue matches and coordinates,
+# and of rows equal in all of these the first in the input, here where every row of DRB1-3123 is given twice
+zcat HLA/DRB1-3123.paf.gz | awk '{ print; print }' >HLA/DRB1-3123.twice.paf
+awk -v OFS='\t' '{ print ($1 < $6 ? $1 " " $6 : $6 " " $1), NR, $0 }' HLA/DRB1-3123.twice.paf \
+    | LC_ALL=C sort -t "$(printf '\t')" -k1,1 -k13,13nr -k12,12nr -k5,5nr -k6,6nr -k10,10nr -k11,11nr -k7,7 -k2,2n \
+    | awk -F '\t' '$1 != pair { pair = $1; n = 0 } ++n <= 3' | LC_ALL=C sort -t "$(printf '\t')" -k2,2n | cut -f 3- >HLA/DRB1-3123.mpm.paf
+seqwish -s HLA/DRB1-3123.fa.gz -p HLA/DRB1-3123.mpm.paf -b HLA -g HLA/DRB1-3123.mpm.gfa
+is $( seqwish -s HLA/DRB1-3123.fa.gz -p HLA/DRB1-3123.twice.paf -b HLA --max-pair-mappings 3 --dry-run 2>&1 | grep "in all:" | cut -f 4 -d\  ) $( wc -l <HLA/DRB1-3123.mpm.paf ) "seqwish --max-pair-mappings keeps no more than 3 of the duplicated rows of each pair for DRB1-3123"
+for t in 1 8; do
+    is $( seqwish -s HLA/DRB1-3123.fa.gz -p HLA/DRB1-3123.twice.paf -b HLA --max-pair-mappings 3 -t $t -g HLA/DRB1-3123.mpm.t$t.gfa && md5sum HLA/DRB1-3123.mpm.t$t.gfa | cut -f 1 -d\ ) $( md5sum HLA/DRB1-3123.mpm.gfa | cut -f 1 -d\ ) "seqwish --max-pair-mappings -t $t builds the graph of the longest rows of each pair for DRB1-3123"
+done
+
+rm -f HLA/*gfa HLA/*.sml HLA/*.sml.paf HLA/*.mbl.paf HLA/*.mid.paf HLA/*.twice.paf HLA/*.mpm.paf
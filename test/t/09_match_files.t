@@ -0,0 +1,24 @@
+#!/usr/bin/env bash
+
+BASH_TAP_ROOT=bash-tap
+. bash-tap/bash-tap-bootstrap
+
+PATH=../bin:$PATH # for seqwish
+
+plan tests 8
+
+is $( seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.paf.gz -b HLA --write-matches HLA/A-3105.sqm -g HLA/A-3105.fa.gz.gfa && md5sum HLA/A-3105.fa.gz.gfa | cut -f 1 -d\ ) $( cat HLA/A-3105.fa.gz.gfa.md5 ) "seqwish --write-matches builds the graph for A-3105"
+is $( seqwish -s HLA/A-3105.fa.gz --read-matches HLA/A-3105.sqm -b HLA -g HLA/A-3105.read.gfa && md5sum HLA/A-3105.read.gfa | cut -f 1 -d\ ) $( cat HLA/A-3105.fa.gz.gfa.md5 ) "seqwish --read-matches builds the graph for A-3105 from the matches it wrote"
+
+# -k applies to the matches read as it would to those of the alignments
+seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.paf.gz -b HLA -k 23 -g HLA/A-3105.k23.gfa
+is $( seqwish -s HLA/A-3105.fa.gz --read-matches HLA/A-3105.sqm -b HLA -k 23 -g HLA/A-3105.read.k23.gfa && md5sum HLA/A-3105.read.k23.gfa | cut -f 1 -d\ ) $( md5sum HLA/A-3105.k23.gfa | cut -f 1 -d\ ) "seqwish --read-matches -k 23 builds the graph of the alignments at -k 23 for A-3105"
+is "$( seqwish -s HLA/A-3105.fa.gz --read-matches HLA/A-3105.sqm -b HLA -k 23 --dry-run 2>&1 | grep "in all:" | grep -o "giving .*bp over" )" "$( seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.paf.gz -b HLA -k 23 --dry-run 2>&1 | grep "in all:" | grep -o "giving .*bp over" )" "seqwish --read-matches --dry-run counts the matches of the alignments at -k 23 for A-3105"
+
+is $( seqwish -s HLA/B-3106.fa.gz --read-matches HLA/A-3105.sqm -b HLA -g HLA/B-3106.read.gfa 2>&1 | grep -c "error: HLA/A-3105.sqm was written against other input sequences" ) 1 "seqwish --read-matches rejects matches written against other sequences"
+ok $( [ ! -s HLA/B-3106.read.gfa ] && echo 1 || echo 0 ) "seqwish --read-matches writes no graph from matches written against other sequences"
+is $( seqwish -s HLA/A-3105.fa.gz --read-matches HLA/A-3105.sqm -b HLA --min-identity 0.9 -g HLA/A-3105.read.gfa 2>&1 | grep -c "ERROR: .*apply only to the alignments of -p" ) 1 "seqwish --read-matches rejects the filters of alignment rows without -p"
+# the filters choose among the rows of the PAFs, and the matches read are all kept
+is $( seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.paf.gz --read-matches HLA/A-3105.sqm -b HLA --min-identity 0.99 -g HLA/A-3105.read.gfa && md5sum HLA/A-3105.read.gfa | cut -f 1 -d\ ) $( cat HLA/A-3105.fa.gz.gfa.md5 ) "seqwish --read-matches keeps its matches when filtering the rows of -p"
+
+rm -f HLA/*gfa HLA/*.sqm
@@ -0,0 +1,20 @@
+#!/usr/bin/env bash
+
+BASH_TAP_ROOT=bash-tap
+. bash-tap/bash-tap-bootstrap
+
+PATH=../bin:$PATH # for seqwish
+
+plan tests 5
+
+# the empty block that ends every BGZF file
+bgzf_eof=1f8b08040000000000ff0600424302001b0003000000000000000000
+
+is $( seqwish -s HLA/A-3105.fa.gz -p HLA/A-3105.paf.gz -b HLA -g HLA/A-3105.fa.gz.gfa.gz && zcat HLA/A-3105.fa.gz.gfa.gz | md5sum | cut -f 1 -d\ ) $( cat HLA/A-3105.fa.gz.gfa.md5 ) "seqwish -g with .gz writes the graph for A-3105 in gzip"
+is $( tail -c 28 HLA/A-3105.fa.gz.gfa.gz | od -An -tx1 | tr -d ' \n' ) $bgzf_eof "seqwish -g with .gz ends the graph for A-3105 with the BGZF EOF block"
+is $( seqwish -s HLA/B-3106.fa.gz -p HLA/B-3106.paf.gz -b HLA -t 4 -g HLA/B-3106.fa.gz.gfa.gz && zcat HLA/B-3106.fa.gz.gfa.gz | md5sum | cut -f 1 -d\ ) $( cat HLA/B-3106.fa.gz.gfa.md5 ) "seqwish -g with .gz writes the graph for B-3106 in gzip with 4 threads"
+is $( tail -c 28 HLA/B-3106.fa.gz.gfa.gz | od -An -tx1 | tr -d ' \n' ) $bgzf_eof "seqwish -g with .gz ends the graph for B-3106 with the BGZF EOF block"
+# a BGZF file is a run of gzip members, each with the BC extra field giving its size, as the first shows
+is $( gzip -t HLA/B-3106.fa.gz.gfa.gz && head -c 16 HLA/B-3106.fa.gz.gfa.gz | od -An -tx1 | tr -d ' \n' | cut -c 1-8,21-32 ) 1f8b0804060042430200 "seqwish -g with .gz writes an intact gzip stream with BGZF headers for B-3106"
+
+rm -f HLA/*gfa HLA/*gfa.gz